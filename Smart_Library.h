@@ -0,0 +1,6557 @@
+// Smart Library Management System: the library engine (entities, indexes,
+// persistence and circulation). Header-only; the interactive menu lives in
+// Smart_Library_Management_System.cpp and the benchmarks in
+// Smart_Library_Benchmark.cpp.
+#ifndef SMART_LIBRARY_H
+#define SMART_LIBRARY_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <algorithm>
+#include <stdexcept>
+#include <exception>
+#include <ctime>
+#include <cstdint>
+#include <new>
+#include <utility>
+#include <functional>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <sstream>
+#include <thread>
+#include <chrono>
+#include <cstdlib>
+#include <cmath>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#endif
+
+using namespace std;
+
+// Forward declarations
+class SnapshotWriter;
+class SnapshotReader;
+class MappedFile;
+class Book;
+class Member;
+class Transaction;
+
+// Custom exceptions
+class LibraryException : public exception {
+protected:
+    string message;
+public:
+    LibraryException(const string& msg) : message(msg) {}
+    virtual const char* what() const noexcept override {
+        return message.c_str();
+    }
+};
+
+class BookNotFoundException : public LibraryException {
+public:
+    BookNotFoundException(const string& bookId) 
+        : LibraryException("Book with ID " + bookId + " not found in the library.") {}
+};
+
+class InvalidMemberException : public LibraryException {
+public:
+    InvalidMemberException(const string& memberId) 
+        : LibraryException("Member with ID " + memberId + " is not registered.") {}
+};
+
+class MaxIssueLimitException : public LibraryException {
+public:
+    MaxIssueLimitException(const string& memberId) 
+        : LibraryException("Member with ID " + memberId + " has reached maximum book issue limit.") {}
+};
+
+// Interned identifier: a 32-bit handle into the global symbol table.
+// Comparing, hashing and copying a Symbol never touches the heap.
+class Symbol {
+    private:
+        uint32_t value;
+    
+    public:
+        enum : uint32_t { INVALID = 0xFFFFFFFFu };
+    
+        Symbol() : value(INVALID) {}
+        explicit Symbol(uint32_t v) : value(v) {}
+    
+        uint32_t getValue() const { return value; }
+        bool isValid() const { return value != INVALID; }
+        const string& str() const;
+    
+        bool operator==(const Symbol& other) const { return value == other.value; }
+        bool operator!=(const Symbol& other) const { return value != other.value; }
+    };
+
+struct SymbolHash {
+    size_t operator()(const Symbol& symbol) const {
+        // Fibonacci hashing spreads consecutive symbols across the table
+        return static_cast<size_t>(symbol.getValue() * 2654435761u);
+    }
+};
+
+// Global string <-> Symbol table. Each distinct ID string is stored once;
+// the open-addressing index holds symbol numbers tagged with their name's hash,
+// so probing only compares names whose hashes match. Interning takes a lock
+// but find and name do not, since books read lazily from a snapshot are
+// interned while circulation looks other IDs up: names sit in chunks that
+// never move, and a full slot table or chunk directory is replaced by a larger
+// copy instead of being resized. Replaced ones are kept until the table goes
+// away, as a reader may still be using one.
+class SymbolTable {
+    private:
+        static const size_t CHUNK_BITS = 12;
+        static const size_t CHUNK_SIZE = size_t(1) << CHUNK_BITS;
+    
+        struct Slots {
+            size_t mask;
+            unique_ptr<atomic<uint64_t>[]> entries; // hash << 32 | symbol; Symbol::INVALID marks an empty slot
+            explicit Slots(size_t count) : mask(count - 1), entries(new atomic<uint64_t>[count]) {
+                for (size_t i = 0; i < count; ++i) {
+                    entries[i].store(Symbol::INVALID, memory_order_relaxed);
+                }
+            }
+        };
+    
+        struct Directory {
+            size_t capacity;
+            unique_ptr<atomic<string*>[]> chunks; // symbol >> CHUNK_BITS -> its chunk of names
+            explicit Directory(size_t count) : capacity(count), chunks(new atomic<string*>[count]) {}
+        };
+    
+        atomic<Slots*> slots;
+        atomic<Directory*> directory;
+        atomic<uint32_t> count;
+    
+        mutex internLock; // guards the owners below and every store
+        vector<unique_ptr<Slots>> slotTables;
+        vector<unique_ptr<Directory>> directories;
+        vector<unique_ptr<string[]>> chunks;
+    
+        static uint32_t symbolIn(uint64_t slot) { return static_cast<uint32_t>(slot); }
+    
+        string& storedName(uint32_t symbol) const {
+            return directory.load(memory_order_acquire)->chunks[symbol >> CHUNK_BITS].load(memory_order_acquire)
+                [symbol & (CHUNK_SIZE - 1)];
+        }
+    
+        bool sameName(uint32_t symbol, const char* name, size_t length) const {
+            const string& stored = storedName(symbol);
+            return stored.size() == length && memcmp(stored.data(), name, length) == 0;
+        }
+    
+        size_t probe(const Slots& table, const char* name, size_t length, uint32_t hash) const {
+            size_t pos = hash & table.mask;
+            uint64_t slot;
+            while (symbolIn(slot = table.entries[pos].load(memory_order_acquire)) != Symbol::INVALID
+                   && (static_cast<uint32_t>(slot >> 32) != hash || !sameName(symbolIn(slot), name, length))) {
+                pos = (pos + 1) & table.mask;
+            }
+            return pos;
+        }
+    
+        Symbol lookup(const char* name, size_t length, uint32_t hash) const {
+            const Slots& table = *slots.load(memory_order_acquire);
+            uint32_t symbol = symbolIn(table.entries[probe(table, name, length, hash)].load(memory_order_acquire));
+            return symbol == Symbol::INVALID ? Symbol() : Symbol(symbol);
+        }
+    
+        void grow() {
+            const Slots& old = *slots.load(memory_order_relaxed);
+            unique_ptr<Slots> grown(new Slots((old.mask + 1) * 2));
+            for (size_t i = 0; i <= old.mask; ++i) {
+                uint64_t slot = old.entries[i].load(memory_order_relaxed);
+                if (symbolIn(slot) != Symbol::INVALID) {
+                    size_t pos = (slot >> 32) & grown->mask;
+                    while (symbolIn(grown->entries[pos].load(memory_order_relaxed)) != Symbol::INVALID) {
+                        pos = (pos + 1) & grown->mask;
+                    }
+                    grown->entries[pos].store(slot, memory_order_relaxed);
+                }
+            }
+            slots.store(grown.get(), memory_order_release);
+            slotTables.push_back(move(grown));
+        }
+    
+        // Make sure the chunk holding 'symbol' exists
+        void addChunkFor(uint32_t symbol) {
+            size_t chunk = symbol >> CHUNK_BITS;
+            Directory* current = directory.load(memory_order_relaxed);
+            if (chunk < chunks.size()) {
+                return;
+            }
+            if (chunk >= current->capacity) {
+                unique_ptr<Directory> grown(new Directory(current->capacity * 2));
+                for (size_t i = 0; i < grown->capacity; ++i) {
+                    grown->chunks[i].store(i < chunks.size() ? chunks[i].get() : nullptr, memory_order_relaxed);
+                }
+                directory.store(grown.get(), memory_order_release);
+                directories.push_back(move(grown));
+                current = directories.back().get();
+            }
+            chunks.emplace_back(new string[CHUNK_SIZE]);
+            current->chunks[chunk].store(chunks.back().get(), memory_order_release);
+        }
+    
+    public:
+        SymbolTable() : count(0) {
+            slotTables.emplace_back(new Slots(64));
+            slots.store(slotTables.back().get());
+            directories.emplace_back(new Directory(16));
+            directory.store(directories.back().get());
+        }
+    
+        SymbolTable(const SymbolTable&) = delete;
+        SymbolTable& operator=(const SymbolTable&) = delete;
+    
+        // FNV-1a over the raw bytes, so names can be looked up without building a string
+        static uint32_t hashOf(const char* name, size_t length) {
+            uint32_t hash = 2166136261u;
+            for (size_t i = 0; i < length; ++i) {
+                hash = (hash ^ static_cast<unsigned char>(name[i])) * 16777619u;
+            }
+            return hash;
+        }
+    
+        // Return the symbol for name, adding it to the table if it is new
+        Symbol intern(const char* name, size_t length) {
+            uint32_t hash = hashOf(name, length);
+            Symbol existing = lookup(name, length, hash);
+            if (existing.isValid()) {
+                return existing;
+            }
+            lock_guard<mutex> guard(internLock);
+            uint32_t symbol = count.load(memory_order_relaxed);
+            if ((symbol + 1) * 2 > slots.load(memory_order_relaxed)->mask + 1) {
+                grow();
+            }
+            Slots& table = *slots.load(memory_order_relaxed);
+            size_t pos = probe(table, name, length, hash);
+            if (symbolIn(table.entries[pos].load(memory_order_relaxed)) == Symbol::INVALID) {
+                addChunkFor(symbol);
+                storedName(symbol).assign(name, length);
+                table.entries[pos].store(static_cast<uint64_t>(hash) << 32 | symbol, memory_order_release);
+                count.store(symbol + 1, memory_order_release);
+            }
+            return Symbol(symbolIn(table.entries[pos].load(memory_order_relaxed)));
+        }
+    
+        Symbol intern(const string& name) { return intern(name.data(), name.size()); }
+    
+        // Look up an existing symbol; returns an invalid Symbol for unknown names
+        Symbol find(const char* name, size_t length) const { return lookup(name, length, hashOf(name, length)); }
+    
+        Symbol find(const string& name) const { return find(name.data(), name.size()); }
+    
+        const string& name(Symbol symbol) const { return storedName(symbol.getValue()); }
+    
+        size_t size() const { return count.load(memory_order_acquire); }
+    };
+
+inline SymbolTable& symbols() {
+    static SymbolTable table;
+    return table;
+}
+
+inline const string& Symbol::str() const {
+    return symbols().name(*this);
+}
+
+// Thread-safe replacement for ctime(): formats a timestamp as "Www Mmm dd hh:mm:ss yyyy"
+inline string formatTimestamp(time_t when) {
+    struct tm local;
+#ifdef _WIN32
+    localtime_s(&local, &when);
+#else
+    localtime_r(&when, &local);
+#endif
+    char text[32];
+    size_t length = strftime(text, sizeof(text), "%a %b %e %H:%M:%S %Y", &local);
+    return string(text, length);
+}
+
+// formatTimestamp with a per-minute cache: the text for the current minute is
+// kept and only the seconds digits are patched, so a burst of events costs one
+// localtime/strftime per minute. An instance is not shared between threads;
+// each formatting thread owns its own.
+class TimestampFormatter {
+    private:
+        time_t minuteStart;
+        string text;
+    
+    public:
+        TimestampFormatter() : minuteStart(-1) {}
+    
+        const string& format(time_t when) {
+            if (when < 0) {
+                text = formatTimestamp(when);
+                return text;
+            }
+            time_t start = when - when % 60;
+            if (start != minuteStart) {
+                text = formatTimestamp(start);
+                minuteStart = start;
+            }
+            int seconds = static_cast<int>(when - start);
+            text[17] = static_cast<char>('0' + seconds / 10); // "Www Mmm dd hh:mm:SS yyyy"
+            text[18] = static_cast<char>('0' + seconds % 10);
+            return text;
+        }
+    };
+
+// Concrete type of a catalog entry
+enum class BookKind : uint8_t { Book, EBook, Journal };
+
+class Book {
+    private:
+        BookKind kind;
+        Symbol bookId;
+        string title;
+        string author;
+        atomic<bool> isAvailable; // read lock-free by reports
+        string category;
+    
+    protected:
+        Book(BookKind k, const string& id, const string& t, const string& a, const string& cat)
+            : kind(k), bookId(symbols().intern(id)), title(t), author(a), isAvailable(true), category(cat) {}
+    
+    public:
+        Book(const string& id, const string& t, const string& a, const string& cat)
+            : Book(BookKind::Book, id, t, a, cat) {}
+    
+        // Getters
+        BookKind getKind() const { return kind; }
+        Symbol getBookSymbol() const { return bookId; }
+        const string& getBookId() const { return bookId.str(); }
+        const string& getTitle() const { return title; }
+        const string& getAuthor() const { return author; }
+        bool getAvailability() const { return isAvailable; }
+        const string& getCategory() const { return category; }
+    
+        // Setters
+        void setAvailability(bool status) { isAvailable = status; }
+    
+        // Display book details in tabular format. Dispatches on the kind tag, so
+        // an EBook or Journal shows its own details through a Book pointer too.
+        void displayDetails() const;
+    };
+
+class EBook : public Book {
+    private:
+        string format;
+        int fileSizeMB;
+    
+    public:
+        EBook(const string& id, const string& t, const string& a, 
+              const string& cat, const string& fmt, int size)
+            : Book(BookKind::EBook, id, t, a, cat), format(fmt), fileSizeMB(size) {}
+    
+        const string& getFormat() const { return format; }
+        int getFileSize() const { return fileSizeMB; }
+    
+        // Display eBook details in tabular format
+        void displayDetails() const {
+            cout << "| " << getBookId() << "\t| " << getTitle() << "\t| " << getAuthor() << "\t| "
+                 << getCategory() << "\t| Format: " << format << ", File Size: " << fileSizeMB << " MB |\n";
+        }
+    };
+
+class Journal : public Book {
+    private:
+        int volume;
+        int issue;
+        string publishDate;
+    
+    public:
+        Journal(const string& id, const string& t, const string& a, 
+               const string& cat, int vol, int iss, const string& date)
+            : Book(BookKind::Journal, id, t, a, cat), volume(vol), issue(iss), publishDate(date) {}
+    
+        int getVolume() const { return volume; }
+        int getIssue() const { return issue; }
+        const string& getPublishDate() const { return publishDate; }
+    
+        // Display journal details in tabular format
+        void displayDetails() const {
+            cout << "| " << getBookId() << "\t| " << getTitle() << "\t| " << getAuthor() << "\t| "
+                 << getCategory() << "\t| Volume: " << volume << ", Issue: " << issue 
+                 << ", Publish Date: " << publishDate << " |\n";
+        }
+    };
+
+inline void Book::displayDetails() const {
+    switch (kind) {
+        case BookKind::EBook:
+            static_cast<const EBook*>(this)->displayDetails();
+            return;
+        case BookKind::Journal:
+            static_cast<const Journal*>(this)->displayDetails();
+            return;
+        case BookKind::Book:
+            break;
+    }
+    cout << "| " << bookId.str() << "\t| " << title << "\t| " << author << "\t| "
+         << category << "\t| " << (isAvailable ? "Available" : "Not Available") << "\t|\n";
+}
+
+// Loan rules per material type, looked up by kind tag instead of a virtual call:
+// how many days a loan runs, and the fine per day once it is late. Every kind
+// has the standard 14 days / Rs. 2 until different terms are agreed.
+struct LoanPolicy {
+    int loanDays;
+    double finePerDay;
+};
+
+inline const LoanPolicy& loanPolicyFor(BookKind kind) {
+    static const LoanPolicy policies[] = {
+        { 14, 2.0 }, // Book
+        { 14, 2.0 }, // EBook
+        { 14, 2.0 }, // Journal
+    };
+    return policies[static_cast<uint8_t>(kind)];
+}
+
+class Member {
+    private:
+        Symbol memberId;
+        string name;
+        string contactInfo;
+        vector<Symbol> issuedBooks;
+        int maxBooksAllowed;
+    
+    public:
+        Member(const string& id, const string& n, const string& contact, int maxBooks = 3)
+            : memberId(symbols().intern(id)), name(n), contactInfo(contact), maxBooksAllowed(maxBooks) {}
+    
+        // Getters
+        Symbol getMemberSymbol() const { return memberId; }
+        const string& getMemberId() const { return memberId.str(); }
+        const string& getName() const { return name; }
+        const string& getContactInfo() const { return contactInfo; }
+        int getIssuedBooksCount() const { return issuedBooks.size(); }
+        const vector<Symbol>& getIssuedBooks() const { return issuedBooks; }
+        int getMaxBooksAllowed() const { return maxBooksAllowed; }
+    
+        bool atIssueLimit() const { return static_cast<int>(issuedBooks.size()) >= maxBooksAllowed; }
+    
+        // Issue and return books
+        void issueBook(Symbol bookId) {
+            if (static_cast<int>(issuedBooks.size()) >= maxBooksAllowed) {
+                throw MaxIssueLimitException(memberId.str());
+            }
+            issuedBooks.push_back(bookId);
+        }
+    
+        void returnBook(Symbol bookId) {
+            auto it = find(issuedBooks.begin(), issuedBooks.end(), bookId);
+            if (it != issuedBooks.end()) {
+                issuedBooks.erase(it);
+            }
+        }
+    
+        // Display member details in tabular format
+        void displayDetails() const {
+            cout << "| " << memberId.str() << "\t| " << name << "\t\t| " << contactInfo << "\t| "
+                 << issuedBooks.size() << "/" << maxBooksAllowed << "\t|\n";
+        }
+    };
+
+class Transaction {
+    private:
+        uint32_t transactionNumber; // fixed-width form of "T<number>"
+        Symbol memberId;
+        Symbol bookId;
+        time_t issueDate;
+        time_t returnDate;
+        double fine;
+        bool isReturned;
+        BookKind kind; // selects the loan policy
+    
+    public:
+        Transaction(uint32_t tNumber, Symbol mId, Symbol bId, BookKind k = BookKind::Book)
+            : transactionNumber(tNumber), memberId(mId), bookId(bId), issueDate(time(nullptr)), 
+              returnDate(0), fine(0.0), isReturned(false), kind(k) {}
+    
+        // Restore a transaction with its recorded state (used when loading a snapshot)
+        Transaction(uint32_t tNumber, Symbol mId, Symbol bId, time_t issued, time_t returned,
+                    double fineAmount, bool returnStatus, BookKind k = BookKind::Book)
+            : transactionNumber(tNumber), memberId(mId), bookId(bId), issueDate(issued),
+              returnDate(returned), fine(fineAmount), isReturned(returnStatus), kind(k) {}
+    
+        // Getters
+        uint32_t getTransactionNumber() const { return transactionNumber; }
+        string getTransactionId() const { return "T" + to_string(transactionNumber); }
+        Symbol getMemberSymbol() const { return memberId; }
+        Symbol getBookSymbol() const { return bookId; }
+        const string& getMemberId() const { return memberId.str(); }
+        const string& getBookId() const { return bookId.str(); }
+        time_t getIssueDate() const { return issueDate; }
+        time_t getReturnDate() const { return returnDate; }
+        double getFine() const { return fine; }
+        bool getReturnStatus() const { return isReturned; }
+        BookKind getKind() const { return kind; }
+    
+        // Return book and calculate fine
+        void returnBook(time_t when = time(nullptr)) {
+            if (!isReturned) {
+                returnDate = when;
+                isReturned = true;
+                calculateFine();
+            }
+        }
+    
+        static const int SECONDS_PER_DAY = 60 * 60 * 24;
+    
+        // Fine owed for a loan of a 'kind' item issued at 'issued' if it ends at
+        // 'until' (see loanPolicyFor)
+        static double fineFor(time_t issued, time_t until, BookKind kind) {
+            const LoanPolicy& policy = loanPolicyFor(kind);
+            // Calculate days between issue and return
+            double diffSeconds = difftime(until, issued);
+            int diffDays = static_cast<int>(diffSeconds / SECONDS_PER_DAY);
+    
+            if (diffDays > policy.loanDays) {
+                return (diffDays - policy.loanDays) * policy.finePerDay;
+            }
+            return 0.0;
+        }
+    
+        time_t getDueDate() const { return issueDate + loanPolicyFor(kind).loanDays * SECONDS_PER_DAY; }
+    
+        // Calculate fine
+        void calculateFine() {
+            fine = fineFor(issueDate, returnDate, kind);
+        }
+    
+        // Display transaction details in tabular format
+        void displayDetails(ostream& out = cout) const;
+    };
+
+// Append the table row for a transaction; shared by displayDetails and the
+// output sink, which formats rows off the circulation threads
+inline void appendTransactionRow(string& out, const Transaction& transaction, TimestampFormatter& dates) {
+    out += "| T";
+    out += to_string(transaction.getTransactionNumber());
+    out += "\t| ";
+    out += transaction.getMemberId();
+    out += "\t| ";
+    out += transaction.getBookId();
+    out += "\t| ";
+    out += dates.format(transaction.getIssueDate());
+    out += "\t| ";
+    if (transaction.getReturnStatus()) {
+        char fine[32];
+        snprintf(fine, sizeof(fine), "%g", transaction.getFine()); // same digits as ostream << double
+        out += dates.format(transaction.getReturnDate());
+        out += "\t| Rs. ";
+        out += fine;
+        out += "\t|\n";
+    } else {
+        out += "Not returned yet\t| N/A\t|\n";
+    }
+}
+
+inline void Transaction::displayDetails(ostream& out) const {
+    TimestampFormatter dates;
+    string row;
+    appendTransactionRow(row, *this, dates);
+    out << row;
+}
+
+class Librarian {
+    private:
+        string staffId;
+        string name;
+        string position;
+    
+    public:
+        Librarian(const string& id, const string& n, const string& pos)
+            : staffId(id), name(n), position(pos) {}
+    
+        // Getters
+        const string& getStaffId() const { return staffId; }
+        const string& getName() const { return name; }
+        const string& getPosition() const { return position; }
+    
+        // Display librarian details in tabular format
+        void displayDetails() const {
+            cout << "| " << staffId << "\t| " << name << "\t\t| " << position << "\t|\n";
+        }
+    };
+
+// Template class for sorting and searching
+template<typename T>
+class GenericManager {
+public:
+    // Generic search function
+    static int search(const std::vector<T*>& items, const std::string& id, const std::string& (T::*getIdFunc)() const) {
+        for (size_t i = 0; i < items.size(); ++i) {
+            if ((items[i]->*getIdFunc)() == id) {
+                return static_cast<int>(i);
+            }
+        }
+        return -1; // Not found
+    }
+
+    // Generic sort function (sorts by ID). Each ID is looked up once and sorted
+    // alongside its item by reference, so comparisons never call back into the
+    // objects and no ID string is copied.
+    static void sort(std::vector<T*>& items, const std::string& (T::*getIdFunc)() const) {
+        typedef std::pair<const std::string*, T*> Keyed;
+        std::vector<Keyed> keyed;
+        keyed.reserve(items.size());
+        for (T* item : items) {
+            keyed.push_back(Keyed(&(item->*getIdFunc)(), item));
+        }
+        std::sort(keyed.begin(), keyed.end(), [](const Keyed& a, const Keyed& b) {
+            return *a.first < *b.first;
+        });
+        for (size_t i = 0; i < items.size(); ++i) {
+            items[i] = keyed[i].second;
+        }
+    }
+};
+
+// Open-addressing hash map (linear probing) used as a persistent ID index.
+// Keys are copied once on insert; lookups compare against the stored key,
+// so finding an entry never allocates.
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+class HashIndex {
+private:
+    struct Slot {
+        Key key;
+        Value value;
+        bool used;
+        Slot() : key(), value(), used(false) {}
+    };
+
+    std::vector<Slot> slots;
+    size_t count;
+    Hash hasher;
+
+    size_t mask() const { return slots.size() - 1; }
+
+    size_t probe(const Key& key) const {
+        size_t pos = hasher(key) & mask();
+        while (slots[pos].used && !(slots[pos].key == key)) {
+            pos = (pos + 1) & mask();
+        }
+        return pos;
+    }
+
+    void rehash(size_t newCapacity) {
+        std::vector<Slot> old;
+        old.swap(slots);
+        slots.resize(newCapacity);
+        count = 0;
+        for (auto& slot : old) {
+            if (slot.used) {
+                slots[probe(slot.key)] = std::move(slot);
+                ++count;
+            }
+        }
+    }
+
+public:
+    HashIndex() : slots(16), count(0) {}
+
+    size_t size() const { return count; }
+
+    // Grow so that n entries fit without rehashing (load factor <= 0.5)
+    void reserve(size_t n) {
+        size_t capacity = slots.size();
+        while (capacity < n * 2) capacity *= 2;
+        if (capacity != slots.size()) rehash(capacity);
+    }
+
+    void clear() {
+        for (auto& slot : slots) slot = Slot();
+        count = 0;
+    }
+
+    // Insert a new key; returns false (and leaves the entry untouched) if it exists
+    bool insert(const Key& key, const Value& value) {
+        if ((count + 1) * 2 > slots.size()) {
+            rehash(slots.size() * 2);
+        }
+        size_t pos = probe(key);
+        if (slots[pos].used) {
+            return false;
+        }
+        slots[pos].key = key;
+        slots[pos].value = value;
+        slots[pos].used = true;
+        ++count;
+        return true;
+    }
+
+    Value* find(const Key& key) {
+        size_t pos = probe(key);
+        return slots[pos].used ? &slots[pos].value : nullptr;
+    }
+
+    const Value* find(const Key& key) const {
+        size_t pos = probe(key);
+        return slots[pos].used ? &slots[pos].value : nullptr;
+    }
+
+    // Visit every entry as f(key, value); the index must not be modified meanwhile
+    template<typename F>
+    void forEach(F f) {
+        for (auto& slot : slots) {
+            if (slot.used) f(slot.key, slot.value);
+        }
+    }
+
+    template<typename F>
+    void forEach(F f) const {
+        for (const auto& slot : slots) {
+            if (slot.used) f(slot.key, slot.value);
+        }
+    }
+
+    // Remove a key using backward-shift deletion, so no tombstones are left behind
+    bool erase(const Key& key) {
+        size_t hole = probe(key);
+        if (!slots[hole].used) {
+            return false;
+        }
+        size_t next = (hole + 1) & mask();
+        while (slots[next].used) {
+            size_t home = hasher(slots[next].key) & mask();
+            // Move the entry back if its home slot is not inside (hole, next]
+            if (((next - home) & mask()) >= ((next - hole) & mask())) {
+                slots[hole] = std::move(slots[next]);
+                hole = next;
+            }
+            next = (next + 1) & mask();
+        }
+        slots[hole] = Slot();
+        --count;
+        return true;
+    }
+};
+
+// Typed object pool. Objects are constructed in place inside fixed-size chunks,
+// so creating one rarely touches the global allocator, and the whole pool is
+// released in one pass when it is destroyed. A destroyed object's slot is
+// threaded onto an intrusive free list and reused by the next create().
+template<typename T, size_t ChunkSize = 256>
+class ObjectPool {
+private:
+    union FreeSlot {
+        FreeSlot* next;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    std::vector<FreeSlot*> chunks;
+    size_t used; // slots handed out from the last chunk
+    FreeSlot* freeList;
+    size_t freeCount;
+
+public:
+    ObjectPool() : used(ChunkSize), freeList(nullptr), freeCount(0) {}
+    ObjectPool(const ObjectPool&) = delete;
+    ObjectPool& operator=(const ObjectPool&) = delete;
+
+    ~ObjectPool() {
+        std::vector<FreeSlot*> freed;
+        freed.reserve(freeCount);
+        for (FreeSlot* slot = freeList; slot; slot = slot->next) {
+            freed.push_back(slot);
+        }
+        std::sort(freed.begin(), freed.end());
+        for (size_t c = 0; c < chunks.size(); ++c) {
+            size_t n = (c + 1 == chunks.size()) ? used : ChunkSize;
+            for (size_t i = 0; i < n; ++i) {
+                if (!std::binary_search(freed.begin(), freed.end(), chunks[c] + i)) {
+                    reinterpret_cast<T*>(chunks[c] + i)->~T();
+                }
+            }
+            ::operator delete(chunks[c]);
+        }
+    }
+
+    template<typename... Args>
+    T* create(Args&&... args) {
+        FreeSlot* slot;
+        if (freeList) {
+            slot = freeList;
+            freeList = slot->next;
+            freeCount--;
+        } else {
+            if (used == ChunkSize) {
+                chunks.push_back(static_cast<FreeSlot*>(::operator new(sizeof(FreeSlot) * ChunkSize)));
+                used = 0;
+            }
+            slot = chunks.back() + used++;
+        }
+        return new (slot->storage) T(std::forward<Args>(args)...);
+    }
+
+    void destroy(T* object) {
+        object->~T();
+        FreeSlot* slot = reinterpret_cast<FreeSlot*>(object);
+        slot->next = freeList;
+        freeList = slot;
+        freeCount++;
+    }
+
+    // Objects currently alive
+    size_t size() const {
+        return (chunks.empty() ? 0 : (chunks.size() - 1) * ChunkSize + used) - freeCount;
+    }
+};
+
+// Contiguous member registry. Records live in a deque so references stay valid
+// as the store grows; a handle is the record's position in registration order.
+class MemberStore {
+    private:
+        deque<Member> records;
+        HashIndex<Symbol, uint32_t, SymbolHash> index; // memberId -> handle
+    
+    public:
+        typedef uint32_t Handle;
+    
+        Member& add(const Member& member) {
+            if (!index.insert(member.getMemberSymbol(), static_cast<Handle>(records.size()))) {
+                throw LibraryException("Member with ID " + member.getMemberId() + " is already registered.");
+            }
+            records.push_back(member);
+            return records.back();
+        }
+    
+        Member* find(Symbol memberId) {
+            const Handle* handle = index.find(memberId);
+            return handle ? &records[*handle] : nullptr;
+        }
+    
+        const Handle* findHandle(Symbol memberId) const {
+            return index.find(memberId);
+        }
+    
+        Member& get(Handle handle) { return records[handle]; }
+        const Member& get(Handle handle) const { return records[handle]; }
+    
+        size_t size() const { return records.size(); }
+    
+        void reserve(size_t count) { index.reserve(count); }
+    
+        deque<Member>::const_iterator begin() const { return records.begin(); }
+        deque<Member>::const_iterator end() const { return records.end(); }
+    };
+
+// FIFO of member handles waiting for one title. Consumed entries are skipped
+// via a head offset and compacted once they make up half of the buffer.
+class HoldQueue {
+    private:
+        vector<MemberStore::Handle> holders;
+        size_t head;
+    
+    public:
+        HoldQueue() : head(0) {}
+    
+        bool empty() const { return head == holders.size(); }
+        size_t size() const { return holders.size() - head; }
+        MemberStore::Handle at(size_t i) const { return holders[head + i]; }
+    
+        void push(MemberStore::Handle member) { holders.push_back(member); }
+    
+        MemberStore::Handle pop() {
+            MemberStore::Handle member = holders[head++];
+            if (head * 2 >= holders.size()) {
+                holders.erase(holders.begin(), holders.begin() + head);
+                head = 0;
+            }
+            return member;
+        }
+    };
+
+// Fixed-capacity ring of the most recent circulation events. Producers claim a
+// ticket with one atomic increment and publish a copy of the transaction into
+// slot ticket % Capacity under a per-slot sequence number (a seqlock), so no
+// lock is taken and memory stays constant. A producer only waits if the slot's
+// previous occupant, Capacity tickets earlier, is still being written. Readers
+// copy the newest entries and keep only those whose sequence number did not
+// change while they were read.
+template<size_t Capacity>
+class RecentTransactionLog {
+    private:
+        struct Slot {
+            atomic<uint64_t> sequence; // 2*ticket+1 while writing, 2*ticket+2 once published
+            atomic<uint32_t> transactionNumber;
+            atomic<uint32_t> memberId;
+            atomic<uint32_t> bookId;
+            atomic<int64_t> issueDate;
+            atomic<int64_t> returnDate;
+            atomic<double> fine;
+            atomic<bool> isReturned;
+            atomic<uint8_t> kind;
+            Slot() : sequence(0) {}
+        };
+    
+        Slot slots[Capacity];
+        atomic<uint64_t> nextTicket;
+    
+    public:
+        RecentTransactionLog() : nextTicket(0) {}
+    
+        void push(const Transaction& transaction) {
+            uint64_t ticket = nextTicket.fetch_add(1);
+            Slot& slot = slots[ticket % Capacity];
+            uint64_t previous = ticket < Capacity ? 0 : 2 * (ticket - Capacity) + 2;
+            while (slot.sequence.load(memory_order_acquire) != previous) {
+                this_thread::yield();
+            }
+            slot.sequence.store(2 * ticket + 1, memory_order_relaxed);
+            atomic_thread_fence(memory_order_release);
+            slot.transactionNumber.store(transaction.getTransactionNumber(), memory_order_relaxed);
+            slot.memberId.store(transaction.getMemberSymbol().getValue(), memory_order_relaxed);
+            slot.bookId.store(transaction.getBookSymbol().getValue(), memory_order_relaxed);
+            slot.issueDate.store(static_cast<int64_t>(transaction.getIssueDate()), memory_order_relaxed);
+            slot.returnDate.store(static_cast<int64_t>(transaction.getReturnDate()), memory_order_relaxed);
+            slot.fine.store(transaction.getFine(), memory_order_relaxed);
+            slot.isReturned.store(transaction.getReturnStatus(), memory_order_relaxed);
+            slot.kind.store(static_cast<uint8_t>(transaction.getKind()), memory_order_relaxed);
+            slot.sequence.store(2 * ticket + 2, memory_order_release);
+        }
+    
+        // Copies of up to count entries, most recent first. Costs O(count)
+        // regardless of how many events have been recorded.
+        vector<Transaction> latest(size_t count) const {
+            vector<Transaction> result;
+            uint64_t head = nextTicket.load(memory_order_acquire);
+            for (uint64_t back = 1; back <= head && back <= Capacity && result.size() < count; ++back) {
+                uint64_t ticket = head - back;
+                const Slot& slot = slots[ticket % Capacity];
+                uint64_t before = slot.sequence.load(memory_order_acquire);
+                if (before != 2 * ticket + 2) {
+                    continue; // still being written, or already overwritten
+                }
+                Transaction copy(slot.transactionNumber.load(memory_order_relaxed),
+                                 Symbol(slot.memberId.load(memory_order_relaxed)),
+                                 Symbol(slot.bookId.load(memory_order_relaxed)),
+                                 static_cast<time_t>(slot.issueDate.load(memory_order_relaxed)),
+                                 static_cast<time_t>(slot.returnDate.load(memory_order_relaxed)),
+                                 slot.fine.load(memory_order_relaxed),
+                                 slot.isReturned.load(memory_order_relaxed),
+                                 static_cast<BookKind>(slot.kind.load(memory_order_relaxed)));
+                atomic_thread_fence(memory_order_acquire);
+                if (slot.sequence.load(memory_order_relaxed) == before) {
+                    result.push_back(copy);
+                }
+            }
+            return result;
+        }
+    
+        bool empty() const { return nextTicket.load() == 0; }
+    };
+
+// Calendar queue of open loans ordered by due date, one bucket per day. Issuing
+// adds an entry and returning removes it (found through a transaction number
+// -> bucket position index), so the index only ever holds open loans and
+// asking "what is overdue now" costs O(overdue) rather than a scan of every
+// transaction.
+class DueDateIndex {
+    public:
+        struct Entry {
+            time_t dueDate;
+            Symbol bookId;
+            uint32_t transactionNumber;
+        };
+    
+    private:
+        map<int64_t, vector<Entry>> buckets; // due day -> loans due that day
+        HashIndex<uint32_t, uint32_t> positions; // transaction number -> index in its bucket
+        mutable mutex lock;
+    
+        static int64_t dayOf(time_t when) { return static_cast<int64_t>(when) / Transaction::SECONDS_PER_DAY; }
+    
+    public:
+        void add(const Transaction& transaction) {
+            Entry entry = { transaction.getDueDate(), transaction.getBookSymbol(), transaction.getTransactionNumber() };
+            int64_t day = dayOf(entry.dueDate);
+            lock_guard<mutex> guard(lock);
+            vector<Entry>& bucket = buckets[day];
+            if (positions.insert(entry.transactionNumber, static_cast<uint32_t>(bucket.size()))) {
+                bucket.push_back(entry);
+            }
+            // Emptied days are dropped from the front here rather than on return,
+            // so a day whose last loan comes and goes keeps its bucket
+            while (buckets.begin()->first < day && buckets.begin()->second.empty()) {
+                buckets.erase(buckets.begin());
+            }
+        }
+    
+        // Drop a loan's entry once it is returned
+        void remove(const Transaction& transaction) {
+            lock_guard<mutex> guard(lock);
+            const uint32_t* position = positions.find(transaction.getTransactionNumber());
+            auto bucket = buckets.find(dayOf(transaction.getDueDate()));
+            if (!position || bucket == buckets.end()) {
+                return;
+            }
+            vector<Entry>& entries = bucket->second;
+            uint32_t at = *position;
+            positions.erase(transaction.getTransactionNumber());
+            if (at + 1 != entries.size()) {
+                entries[at] = entries.back();
+                *positions.find(entries[at].transactionNumber) = at;
+            }
+            entries.pop_back();
+        }
+    
+        // Open loans due before asOf, earliest day first
+        vector<Entry> dueBefore(time_t asOf) const {
+            vector<Entry> result;
+            lock_guard<mutex> guard(lock);
+            auto end = buckets.upper_bound(dayOf(asOf));
+            for (auto it = buckets.begin(); it != end; ++it) {
+                for (const Entry& entry : it->second) {
+                    if (entry.dueDate < asOf) {
+                        result.push_back(entry);
+                    }
+                }
+            }
+            return result;
+        }
+    
+        size_t size() const {
+            lock_guard<mutex> guard(lock);
+            return positions.size();
+        }
+    
+        void clear() {
+            lock_guard<mutex> guard(lock);
+            buckets.clear();
+            positions.clear();
+        }
+    };
+
+// Inverted index over book titles, authors and categories. Words are lowercase
+// ASCII letter/digit runs; each maps to the ordinals (registration order) of the
+// books containing it. Ordinals only grow, so a posting list is appended to as a
+// varint-encoded gap sequence. Words are interned to dense IDs on insert; the
+// alphabetical word order used for prefix lookups is brought up to date lazily
+// by the next query, so a bulk load sorts its new words once instead of paying
+// an ordered insert per word.
+class CatalogSearchIndex {
+    private:
+        struct PostingList {
+            vector<uint8_t> gaps; // varint deltas between consecutive ordinals
+            uint32_t last;
+            uint32_t count;
+            PostingList() : last(0), count(0) {}
+    
+            void add(uint32_t ordinal) {
+                if (count != 0 && ordinal == last) {
+                    return; // word repeated within the same book
+                }
+                uint32_t gap = count == 0 ? ordinal : ordinal - last;
+                while (gap >= 0x80) {
+                    gaps.push_back(static_cast<uint8_t>(gap | 0x80));
+                    gap >>= 7;
+                }
+                gaps.push_back(static_cast<uint8_t>(gap));
+                last = ordinal;
+                count++;
+            }
+    
+            void decodeInto(vector<uint32_t>& out) const {
+                uint32_t ordinal = 0;
+                size_t pos = 0;
+                while (pos < gaps.size()) {
+                    uint32_t gap = 0;
+                    int shift = 0;
+                    uint8_t byte;
+                    do {
+                        byte = gaps[pos++];
+                        gap |= static_cast<uint32_t>(byte & 0x7F) << shift;
+                        shift += 7;
+                    } while (byte & 0x80);
+                    ordinal += gap;
+                    out.push_back(ordinal);
+                }
+            }
+        };
+    
+        SymbolTable words;             // word <-> dense word ID
+        vector<PostingList> postings;  // by word ID
+    
+        // Word IDs in alphabetical order; IDs added since the last query are
+        // merged in by sortWords(). Queries may run concurrently, hence the lock.
+        mutable vector<uint32_t> sortedWords;
+        mutable atomic<bool> sortedStale;
+        mutable mutex sortLock;
+    
+        void sortWords() const {
+            if (!sortedStale.load(memory_order_acquire)) {
+                return;
+            }
+            lock_guard<mutex> guard(sortLock);
+            if (!sortedStale.load(memory_order_relaxed)) {
+                return;
+            }
+            auto byName = [this](uint32_t a, uint32_t b) {
+                return words.name(Symbol(a)) < words.name(Symbol(b));
+            };
+            size_t sortedCount = sortedWords.size();
+            for (uint32_t id = static_cast<uint32_t>(sortedCount); id < words.size(); ++id) {
+                sortedWords.push_back(id);
+            }
+            sort(sortedWords.begin() + sortedCount, sortedWords.end(), byName);
+            inplace_merge(sortedWords.begin(), sortedWords.begin() + sortedCount, sortedWords.end(), byName);
+            sortedStale.store(false, memory_order_release);
+        }
+    
+        // Ordinals of books with a word starting with 'prefix', ascending
+        vector<uint32_t> matchPrefix(const string& prefix) const {
+            sortWords();
+            vector<uint32_t> result;
+            size_t listsMerged = 0;
+            auto it = lower_bound(sortedWords.begin(), sortedWords.end(), prefix,
+                                  [this](uint32_t id, const string& key) { return words.name(Symbol(id)) < key; });
+            for (; it != sortedWords.end() && words.name(Symbol(*it)).compare(0, prefix.size(), prefix) == 0; ++it) {
+                postings[*it].decodeInto(result);
+                listsMerged++;
+            }
+            if (listsMerged > 1) {
+                sort(result.begin(), result.end());
+                result.erase(unique(result.begin(), result.end()), result.end());
+            }
+            return result;
+        }
+    
+        // Keep the entries of 'into' that also occur in 'other'. Each probe
+        // gallops forward, so a short list against a long one costs
+        // O(short * log long).
+        static void intersect(vector<uint32_t>& into, const vector<uint32_t>& other) {
+            size_t kept = 0;
+            auto from = other.begin();
+            for (uint32_t ordinal : into) {
+                size_t step = 1;
+                auto bound = from;
+                while (bound != other.end() && *bound < ordinal) {
+                    from = bound;
+                    bound = static_cast<size_t>(other.end() - bound) > step ? bound + step : other.end();
+                    step *= 2;
+                }
+                from = lower_bound(from, bound, ordinal);
+                if (from == other.end()) {
+                    break;
+                }
+                if (*from == ordinal) {
+                    into[kept++] = ordinal;
+                }
+            }
+            into.resize(kept);
+        }
+    
+    public:
+        CatalogSearchIndex() : sortedStale(false) {}
+    
+        // Call f with each run of letters and digits in text, lowercased
+        template<typename F>
+        static void forEachWord(const char* text, size_t length, F f) {
+            string word;
+            for (size_t i = 0; i < length; ++i) {
+                unsigned char u = static_cast<unsigned char>(text[i]);
+                if ((u >= '0' && u <= '9') || (u >= 'a' && u <= 'z')) {
+                    word += static_cast<char>(u);
+                } else if (u >= 'A' && u <= 'Z') {
+                    word += static_cast<char>(u - 'A' + 'a');
+                } else if (!word.empty()) {
+                    f(word);
+                    word.clear();
+                }
+            }
+            if (!word.empty()) {
+                f(word);
+            }
+        }
+    
+        static vector<string> tokenize(const string& text) {
+            vector<string> tokens;
+            forEachWord(text.data(), text.size(), [&tokens](const string& word) { tokens.push_back(word); });
+            return tokens;
+        }
+    
+        // Ordinals must be added in increasing order
+        void add(uint32_t ordinal, const char* text, size_t length) {
+            forEachWord(text, length, [this, ordinal](const string& word) {
+                uint32_t id = words.intern(word).getValue();
+                if (id == postings.size()) {
+                    postings.push_back(PostingList());
+                    sortedStale.store(true, memory_order_relaxed);
+                }
+                postings[id].add(ordinal);
+            });
+        }
+    
+        void add(uint32_t ordinal, const string& text) { add(ordinal, text.data(), text.size()); }
+    
+        // Books matching every query word, each word as a prefix; ascending ordinals
+        vector<uint32_t> query(const string& text) const {
+            vector<vector<uint32_t>> matches;
+            for (const string& word : tokenize(text)) {
+                matches.push_back(matchPrefix(word));
+                if (matches.back().empty()) {
+                    return vector<uint32_t>();
+                }
+            }
+            if (matches.empty()) {
+                return vector<uint32_t>();
+            }
+            // Intersect the rarest words first so the working set shrinks fastest
+            sort(matches.begin(), matches.end(), [](const vector<uint32_t>& a, const vector<uint32_t>& b) {
+                return a.size() < b.size();
+            });
+            vector<uint32_t> result = move(matches[0]);
+            for (size_t i = 1; i < matches.size() && !result.empty(); ++i) {
+                intersect(result, matches[i]);
+            }
+            return result;
+        }
+    };
+
+inline int popcount64(uint64_t word) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcountll(word);
+#else
+    word = word - ((word >> 1) & 0x5555555555555555ULL);
+    word = (word & 0x3333333333333333ULL) + ((word >> 2) & 0x3333333333333333ULL);
+    word = (word + (word >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return static_cast<int>((word * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+// A catalog column of fixed-size values. The first rows may be served straight
+// from a snapshot mapping (see CatalogColumns::attach); rows appended after
+// that are owned.
+template<typename T>
+class ColumnVector {
+    private:
+        const T* mapped;
+        size_t mappedCount;
+        vector<T> owned;
+    
+    public:
+        ColumnVector() : mapped(nullptr), mappedCount(0) {}
+    
+        // Serve the first 'count' values from 'data', which outlives the column;
+        // the column must be empty
+        void attach(const T* data, size_t count) {
+            mapped = data;
+            mappedCount = count;
+        }
+    
+        void push_back(const T& value) { owned.push_back(value); }
+        size_t size() const { return mappedCount + owned.size(); }
+        T operator[](size_t i) const { return i < mappedCount ? mapped[i] : owned[i - mappedCount]; }
+    
+        // Position of the first value not less than 'value'; the column is sorted
+        size_t lowerBound(T value) const {
+            size_t low = 0, high = size();
+            while (low < high) {
+                size_t middle = low + (high - low) / 2;
+                if ((*this)[middle] < value) {
+                    low = middle + 1;
+                } else {
+                    high = middle;
+                }
+            }
+            return low;
+        }
+    };
+
+// A catalog column of strings packed back to back, served from a snapshot
+// mapping for the first rows like ColumnVector
+class StringColumn {
+    private:
+        const uint32_t* mappedOffsets; // mapped row i spans [mappedOffsets[i], mappedOffsets[i + 1])
+        const char* mappedArena;
+        size_t mappedCount;
+        vector<uint32_t> offsets;      // owned rows, the same way
+        string arena;
+    
+    public:
+        StringColumn() : mappedOffsets(nullptr), mappedArena(nullptr), mappedCount(0), offsets(1, 0) {}
+    
+        void attach(const uint32_t* rowOffsets, const char* bytes, size_t count) {
+            mappedOffsets = rowOffsets;
+            mappedArena = bytes;
+            mappedCount = count;
+        }
+    
+        void push_back(const char* value, size_t length) {
+            arena.append(value, length);
+            offsets.push_back(static_cast<uint32_t>(arena.size()));
+        }
+    
+        void push_back(const string& value) { push_back(value.data(), value.size()); }
+    
+        size_t size() const { return mappedCount + offsets.size() - 1; }
+    
+        const char* data(size_t i) const {
+            return i < mappedCount ? mappedArena + mappedOffsets[i] : arena.data() + offsets[i - mappedCount];
+        }
+    
+        size_t length(size_t i) const {
+            return i < mappedCount ? mappedOffsets[i + 1] - mappedOffsets[i]
+                                   : offsets[i - mappedCount + 1] - offsets[i - mappedCount];
+        }
+    
+        string str(size_t i) const { return string(data(i), length(i)); }
+    
+        bool equals(size_t i, const char* value, size_t valueLength) const {
+            return length(i) == valueLength && memcmp(data(i), value, valueLength) == 0;
+        }
+    };
+
+// Struct-of-arrays record of the catalog, one row per book in registration
+// order: an availability bitset, a category code and a kind tag per row, and
+// the IDs, titles and authors packed into character arenas. Counting
+// available books is a popcount over the bitset instead of a pointer chase per
+// Book. Subtype fields live in side tables holding only rows of that kind, so
+// subtype queries scan a dense array of one type.
+//
+// The columns hold everything a Book is made of, so a snapshot stores the
+// catalog as these columns plus a hash index of the IDs. Loading one attaches
+// the columns to the mapped file instead of decoding it (only the bitset is
+// copied, as it changes); the Library then creates Book objects on first use.
+class CatalogColumns {
+    public:
+        static const size_t KINDS = 3;
+        static const uint32_t NO_ROW = 0xFFFFFFFFu;
+    
+    private:
+        unique_ptr<atomic<uint64_t>[]> availableWords;
+        size_t wordCapacity;
+        size_t rows;
+    
+        ColumnVector<uint32_t> categoryCodes;
+        vector<string> categoryNames;
+        HashIndex<string, uint32_t> categoryIndex; // category name -> code
+        ColumnVector<uint8_t> kinds;
+    
+        // Side tables: catalog row and fields of each e-book and of each
+        // journal issue, rows ascending
+        ColumnVector<uint32_t> ebookRows;
+        ColumnVector<int32_t> ebookSizes;
+        StringColumn ebookFormats;
+        ColumnVector<uint32_t> journalRows;
+        ColumnVector<int32_t> journalVolumes;
+        ColumnVector<int32_t> journalIssues;
+        StringColumn journalDates;
+    
+        StringColumn ids;
+        StringColumn titles;
+        StringColumn authors;
+    
+        // Rows served from a snapshot mapping, found by ID through its hash
+        // index (slots hold hash << 32 | row, NO_ROW when empty)
+        shared_ptr<MappedFile> image;
+        size_t mappedRows;
+        ColumnVector<uint64_t> idSlots;
+    
+        void growWords(size_t needed) {
+            size_t capacity = wordCapacity == 0 ? 16 : wordCapacity;
+            while (capacity < needed) {
+                capacity *= 2;
+            }
+            unique_ptr<atomic<uint64_t>[]> grown(new atomic<uint64_t>[capacity]);
+            for (size_t i = 0; i < capacity; ++i) {
+                grown[i].store(i < wordCapacity ? availableWords[i].load(memory_order_relaxed) : 0,
+                               memory_order_relaxed);
+            }
+            availableWords = move(grown);
+            wordCapacity = capacity;
+        }
+    
+        static LibraryException corrupt() { return LibraryException("Snapshot is truncated or corrupt."); }
+    
+        static void writeStrings(SnapshotWriter& out, const StringColumn& column, const vector<uint32_t>& order);
+        template<typename T>
+        static void attachColumn(SnapshotReader& in, size_t count, ColumnVector<T>& column);
+        static void attachColumn(SnapshotReader& in, size_t count, StringColumn& column);
+    
+        // Side table rows must ascend and be exactly the rows of the table's kind
+        void checkSideRows(const ColumnVector<uint32_t>& sideRows, BookKind kind) const;
+    
+        uint32_t codeOf(const string& category) {
+            const uint32_t* code = categoryIndex.find(category);
+            if (code) {
+                return *code;
+            }
+            uint32_t next = static_cast<uint32_t>(categoryNames.size());
+            categoryIndex.insert(category, next);
+            categoryNames.push_back(category);
+            return next;
+        }
+    
+    public:
+        CatalogColumns() : wordCapacity(0), rows(0), mappedRows(0) {}
+    
+        // Subtype fields are added with appendEBook/appendJournal for the returned row
+        uint32_t append(const string& id, const string& title, const string& author, const string& category,
+                        bool available, BookKind kind) {
+            uint32_t row = static_cast<uint32_t>(rows);
+            if (row / 64 >= wordCapacity) {
+                growWords(row / 64 + 1);
+            }
+            rows++;
+            setAvailable(row, available);
+            categoryCodes.push_back(codeOf(category));
+            kinds.push_back(static_cast<uint8_t>(kind));
+            ids.push_back(id);
+            titles.push_back(title);
+            authors.push_back(author);
+            return row;
+        }
+    
+        void appendEBook(uint32_t row, const string& format, int sizeMB) {
+            ebookRows.push_back(row);
+            ebookSizes.push_back(sizeMB);
+            ebookFormats.push_back(format);
+        }
+    
+        void appendJournal(uint32_t row, int volume, int issue, const string& publishDate) {
+            journalRows.push_back(row);
+            journalVolumes.push_back(volume);
+            journalIssues.push_back(issue);
+            journalDates.push_back(publishDate);
+        }
+    
+        void setAvailable(uint32_t row, bool available) {
+            uint64_t bit = uint64_t(1) << (row % 64);
+            if (available) {
+                availableWords[row / 64].fetch_or(bit, memory_order_relaxed);
+            } else {
+                availableWords[row / 64].fetch_and(~bit, memory_order_relaxed);
+            }
+        }
+    
+        bool isAvailable(uint32_t row) const {
+            return (availableWords[row / 64].load(memory_order_relaxed) >> (row % 64)) & 1;
+        }
+    
+        size_t size() const { return rows; }
+    
+        size_t countAvailable() const {
+            size_t count = 0;
+            for (size_t i = 0; i < (rows + 63) / 64; ++i) {
+                count += popcount64(availableWords[i].load(memory_order_relaxed)); // bits past 'rows' stay 0
+            }
+            return count;
+        }
+    
+        const vector<string>& getCategoryNames() const { return categoryNames; }
+        uint32_t categoryOf(uint32_t row) const { return categoryCodes[row]; }
+        BookKind kindOf(uint32_t row) const { return static_cast<BookKind>(kinds[row]); }
+    
+        const StringColumn& getIds() const { return ids; }
+        const StringColumn& getTitles() const { return titles; }
+        const StringColumn& getAuthors() const { return authors; }
+    
+        // Subtype fields of an e-book or journal row
+        string formatOf(uint32_t row) const { return ebookFormats.str(ebookRows.lowerBound(row)); }
+        int fileSizeOf(uint32_t row) const { return ebookSizes[ebookRows.lowerBound(row)]; }
+        int volumeOf(uint32_t row) const { return journalVolumes[journalRows.lowerBound(row)]; }
+        int issueOf(uint32_t row) const { return journalIssues[journalRows.lowerBound(row)]; }
+        string publishDateOf(uint32_t row) const { return journalDates.str(journalRows.lowerBound(row)); }
+    
+        // Rows of e-books larger than sizeMB, in registration order
+        vector<uint32_t> ebooksLargerThan(int sizeMB) const {
+            vector<uint32_t> found;
+            for (size_t i = 0; i < ebookSizes.size(); ++i) {
+                if (ebookSizes[i] > sizeMB) {
+                    found.push_back(ebookRows[i]);
+                }
+            }
+            return found;
+        }
+    
+        // Rows of journal issues of the given volume, in registration order
+        vector<uint32_t> journalsOfVolume(int volume) const {
+            vector<uint32_t> found;
+            for (size_t i = 0; i < journalVolumes.size(); ++i) {
+                if (journalVolumes[i] == volume) {
+                    found.push_back(journalRows[i]);
+                }
+            }
+            return found;
+        }
+    
+        void writeId(ostream& out, uint32_t row) const { out.write(ids.data(row), ids.length(row)); }
+        void writeTitle(ostream& out, uint32_t row) const { out.write(titles.data(row), titles.length(row)); }
+    
+        // Rows loaded from a snapshot; the rows after them were appended since
+        size_t getMappedRows() const { return mappedRows; }
+    
+        // The first mapped row with this ID, or NO_ROW. Probing stops after one
+        // pass over the table, so a corrupt file cannot make it loop.
+        uint32_t findMappedId(const char* id, size_t length) const {
+            if (mappedRows == 0) {
+                return NO_ROW;
+            }
+            uint32_t hash = SymbolTable::hashOf(id, length);
+            size_t mask = idSlots.size() - 1;
+            for (size_t pos = hash & mask, probes = 0; probes <= mask; pos = (pos + 1) & mask, ++probes) {
+                uint64_t slot = idSlots[pos];
+                uint32_t row = static_cast<uint32_t>(slot);
+                if (row == NO_ROW) {
+                    break;
+                }
+                if (static_cast<uint32_t>(slot >> 32) == hash && row < mappedRows && ids.equals(row, id, length)) {
+                    return row;
+                }
+            }
+            return NO_ROW;
+        }
+    
+        // Snapshot section, version 4 on: the rows in 'order' (registration
+        // order on load) and a hash index of their IDs. Arrays are aligned to
+        // their element size so attach can use them in place.
+        void write(SnapshotWriter& out, const vector<uint32_t>& order) const;
+    
+        // Serve the columns from a snapshot section, which 'in' reads from
+        // 'file'; only on empty columns. Returns the number of rows.
+        size_t attach(SnapshotReader& in, const shared_ptr<MappedFile>& file);
+    };
+
+// Book ordinals in ID order, for ordered listings and ID range queries. IDs
+// compare in natural order (digit runs by value, so B9 < B10 < B100 and
+// B100..B199 is one contiguous range). Each ID is normalized once on insert
+// into a key whose byte order is that natural order: a digit run becomes '0',
+// a length byte and the digits without leading zeros. Comparisons check an
+// 8-byte big-endian prefix of the key first and only read the key arena on
+// ties. Ordinals added since the last ordered read are sorted among themselves
+// and merged in by that read, so the catalog is never re-sorted as a whole.
+class OrderedIdIndex {
+    private:
+        string keyArena;
+        vector<uint32_t> keyOffsets; // ordinal i spans [keyOffsets[i], keyOffsets[i + 1])
+        vector<uint64_t> prefixes;   // first 8 key bytes, zero-padded
+    
+        // Reads may run concurrently, hence the lock around the merge
+        mutable vector<uint32_t> ordered;
+        mutable atomic<bool> stale;
+        mutable mutex mergeLock;
+    
+        static string normalize(const char* id, size_t length) {
+            string key;
+            key.reserve(length + 2);
+            size_t i = 0;
+            while (i < length) {
+                if (!isdigit(static_cast<unsigned char>(id[i]))) {
+                    key += id[i++];
+                    continue;
+                }
+                size_t start = i;
+                while (i < length && isdigit(static_cast<unsigned char>(id[i]))) {
+                    i++;
+                }
+                while (start < i && id[start] == '0') {
+                    start++;
+                }
+                key += '0';
+                key += static_cast<char>(min<size_t>(i - start, 255));
+                key.append(id + start, i - start);
+            }
+            return key;
+        }
+    
+        static string normalize(const string& id) { return normalize(id.data(), id.size()); }
+    
+        static uint64_t prefixOf(const char* key, size_t length) {
+            uint64_t prefix = 0;
+            for (size_t i = 0; i < 8; ++i) {
+                prefix = (prefix << 8) | (i < length ? static_cast<unsigned char>(key[i]) : 0);
+            }
+            return prefix;
+        }
+    
+        // Order of an entry relative to a normalized key (<0, 0, >0)
+        int compare(uint32_t ordinal, uint64_t prefix, const char* key, size_t length) const {
+            if (prefixes[ordinal] != prefix) {
+                return prefixes[ordinal] < prefix ? -1 : 1;
+            }
+            size_t ownLength = keyOffsets[ordinal + 1] - keyOffsets[ordinal];
+            int order = memcmp(keyArena.data() + keyOffsets[ordinal], key, min(ownLength, length));
+            if (order != 0) {
+                return order;
+            }
+            return ownLength < length ? -1 : (ownLength > length ? 1 : 0);
+        }
+    
+        // Equal keys (e.g. B01 and B1) keep registration order
+        bool less(uint32_t a, uint32_t b) const {
+            int order = compare(a, prefixes[b], keyArena.data() + keyOffsets[b], keyOffsets[b + 1] - keyOffsets[b]);
+            return order < 0 || (order == 0 && a < b);
+        }
+    
+        void merge() const {
+            if (!stale.load(memory_order_acquire)) {
+                return;
+            }
+            lock_guard<mutex> guard(mergeLock);
+            if (!stale.load(memory_order_relaxed)) {
+                return;
+            }
+            auto byKey = [this](uint32_t a, uint32_t b) { return less(a, b); };
+            size_t mergedCount = ordered.size();
+            for (uint32_t ordinal = static_cast<uint32_t>(mergedCount); ordinal < prefixes.size(); ++ordinal) {
+                ordered.push_back(ordinal);
+            }
+            sort(ordered.begin() + mergedCount, ordered.end(), byKey);
+            inplace_merge(ordered.begin(), ordered.begin() + mergedCount, ordered.end(), byKey);
+            stale.store(false, memory_order_release);
+        }
+    
+    public:
+        OrderedIdIndex() : keyOffsets(1, 0), stale(false) {}
+    
+        // Books are added in registration order; returns the new entry's ordinal
+        uint32_t add(const char* id, size_t length) {
+            string key = normalize(id, length);
+            keyArena += key;
+            keyOffsets.push_back(static_cast<uint32_t>(keyArena.size()));
+            prefixes.push_back(prefixOf(key.data(), key.size()));
+            stale.store(true, memory_order_release);
+            return static_cast<uint32_t>(prefixes.size() - 1);
+        }
+    
+        uint32_t add(const string& id) { return add(id.data(), id.size()); }
+    
+        void reserve(size_t count) {
+            keyOffsets.reserve(count + 1);
+            prefixes.reserve(count);
+        }
+    
+        // All ordinals in ID order
+        const vector<uint32_t>& inOrder() const {
+            merge();
+            return ordered;
+        }
+    
+        // Ordinals whose ID lies between 'from' and 'to' (inclusive), in ID order
+        vector<uint32_t> range(const string& from, const string& to) const {
+            merge();
+            string low = normalize(from), high = normalize(to);
+            uint64_t lowPrefix = prefixOf(low.data(), low.size());
+            uint64_t highPrefix = prefixOf(high.data(), high.size());
+            auto first = lower_bound(ordered.begin(), ordered.end(), 0u, [&](uint32_t ordinal, unsigned) {
+                return compare(ordinal, lowPrefix, low.data(), low.size()) < 0;
+            });
+            vector<uint32_t> result;
+            for (auto it = first; it != ordered.end() && compare(*it, highPrefix, high.data(), high.size()) <= 0; ++it) {
+                result.push_back(*it);
+            }
+            return result;
+        }
+    };
+
+// Read a whole file into memory with one call; returns false if it cannot be opened
+inline bool readFile(const string& path, string& contents) {
+    ifstream file(path.c_str(), ios::binary | ios::ate);
+    if (!file) {
+        return false;
+    }
+    contents.assign(static_cast<size_t>(file.tellg()), '\0');
+    file.seekg(0);
+    file.read(&contents[0], contents.size());
+    return true;
+}
+
+// Flush a stdio stream and force its data to disk
+inline bool syncFile(FILE* file) {
+    if (fflush(file) != 0) {
+        return false;
+    }
+#ifdef _WIN32
+    return _commit(_fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+// Force the directory entry of 'path' (a create or rename) to disk. Windows
+// cannot sync a directory; NTFS logs the rename in its own journal.
+inline bool syncDirectoryOf(const string& path) {
+#ifdef _WIN32
+    (void)path;
+    return true;
+#else
+    size_t slash = path.find_last_of('/');
+    string directory = slash == string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+    int fd = ::open(directory.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+#endif
+}
+
+// Cut a file back to 'length' bytes and sync it
+inline bool truncateFile(const string& path, size_t length) {
+#ifdef _WIN32
+    int fd = _open(path.c_str(), _O_WRONLY | _O_BINARY);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = _chsize_s(fd, static_cast<__int64>(length)) == 0 && _commit(fd) == 0;
+    _close(fd);
+#else
+    int fd = ::open(path.c_str(), O_WRONLY);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = ftruncate(fd, static_cast<off_t>(length)) == 0 && fsync(fd) == 0;
+    ::close(fd);
+#endif
+    return ok;
+}
+
+// Names of the entries in 'directory'; empty if it cannot be read
+inline vector<string> listDirectory(const string& directory) {
+    vector<string> names;
+#ifdef _WIN32
+    _finddata_t found;
+    intptr_t handle = _findfirst((directory + "\\*").c_str(), &found);
+    if (handle == -1) {
+        return names;
+    }
+    do {
+        names.push_back(found.name);
+    } while (_findnext(handle, &found) == 0);
+    _findclose(handle);
+#else
+    DIR* dir = opendir(directory.c_str());
+    if (!dir) {
+        return names;
+    }
+    while (dirent* entry = readdir(dir)) {
+        names.push_back(entry->d_name);
+    }
+    closedir(dir);
+#endif
+    return names;
+}
+
+// Replace 'path' with 'head' followed by 'tail' so that a crash or power loss
+// leaves either the old file or the complete new one: the bytes go to a
+// temporary file, which is synced, renamed over 'path', and then the directory
+// is synced so the rename is on disk too. Returns false if any step fails.
+inline bool replaceFile(const string& path, const string& head, const string& tail = string()) {
+    string tempPath = path + ".tmp";
+    FILE* file = fopen(tempPath.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+    bool ok = fwrite(head.data(), 1, head.size(), file) == head.size()
+           && fwrite(tail.data(), 1, tail.size(), file) == tail.size()
+           && syncFile(file);
+    ok = fclose(file) == 0 && ok;
+    if (!ok) {
+        remove(tempPath.c_str());
+        return false;
+    }
+#ifdef _WIN32
+    remove(path.c_str()); // rename() does not replace an existing file on Windows
+#endif
+    return rename(tempPath.c_str(), path.c_str()) == 0 && syncDirectoryOf(path);
+}
+
+// Outcome of a bulk import
+struct ImportReport {
+    size_t rows;       // data rows read (header excluded)
+    size_t imported;
+    size_t duplicates; // ID already in the library or earlier in the file
+    size_t invalid;    // rows that failed to parse or validate
+    double seconds;
+    ImportReport() : rows(0), imported(0), duplicates(0), invalid(0), seconds(0.0) {}
+};
+
+// Parallel parser for CSV/TSV files. A file is streamed in windows of a few MB
+// cut at line boundaries; each window is cut into chunks that are parsed by
+// their own threads into typed records, so parsing scales with cores while the
+// caller applies records in file order and memory stays bounded by one window.
+// CSV fields may be double-quoted ("" escapes a quote) but cannot span lines.
+class DelimitedParser {
+    public:
+        static const size_t WINDOW_BYTES = 16 << 20;
+    
+        struct Error {
+            size_t line;
+            string message;
+        };
+    
+        template<typename Record>
+        struct Result {
+            vector<vector<Record>> chunks; // records per chunk, in file order
+            vector<Error> errors;
+            size_t rows;
+            size_t lines; // lines consumed, header and blank lines included
+            size_t bytes;
+            Result() : rows(0), lines(0), bytes(0) {}
+        };
+    
+        // TSV for .tsv/.tab files, CSV otherwise
+        static char delimiterFor(const string& path) {
+            size_t dot = path.find_last_of('.');
+            string extension = dot == string::npos ? "" : path.substr(dot + 1);
+            for (char& c : extension) {
+                c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+            }
+            return extension == "tsv" || extension == "tab" ? '\t' : ',';
+        }
+    
+        static void splitLine(const char* begin, const char* end, char delimiter, vector<string>& fields) {
+            fields.clear();
+            if (end > begin && end[-1] == '\r') {
+                --end;
+            }
+            string field;
+            const char* p = begin;
+            while (true) {
+                field.clear();
+                if (delimiter == ',' && p < end && *p == '"') {
+                    for (++p; p < end; ++p) {
+                        if (*p == '"') {
+                            if (p + 1 < end && p[1] == '"') {
+                                field += '"';
+                                ++p;
+                            } else {
+                                ++p;
+                                break;
+                            }
+                        } else {
+                            field += *p;
+                        }
+                    }
+                    while (p < end && *p != delimiter) {
+                        field += *p++;
+                    }
+                } else {
+                    const char* stop = static_cast<const char*>(memchr(p, delimiter, end - p));
+                    if (!stop) {
+                        stop = end;
+                    }
+                    field.assign(p, stop);
+                    p = stop;
+                }
+                fields.push_back(field);
+                if (p >= end) {
+                    break;
+                }
+                ++p; // skip the delimiter
+            }
+        }
+    
+        static bool parseInt(const string& text, int& value) {
+            if (text.empty()) {
+                return false;
+            }
+            char* stop;
+            long parsed = strtol(text.c_str(), &stop, 10);
+            if (*stop != '\0' || parsed < 0 || parsed > 0x7FFFFFFF) {
+                return false;
+            }
+            value = static_cast<int>(parsed);
+            return true;
+        }
+    
+        // Parse every line with 'convert', a callable
+        //   bool(const vector<string>& fields, Record& out, string& error).
+        // A first line whose first field is 'headerField' (if not empty) is
+        // treated as a header.
+        template<typename Record, typename Convert>
+        static Result<Record> parse(const string& image, char delimiter, const string& headerField, Convert convert) {
+            const char* data = image.data();
+            size_t size = image.size();
+    
+            size_t start = 0;
+            vector<string> fields;
+            const char* firstEnd = static_cast<const char*>(memchr(data, '\n', size));
+            size_t firstLength = firstEnd ? static_cast<size_t>(firstEnd - data) : size;
+            splitLine(data, data + firstLength, delimiter, fields);
+            size_t headerLines = 0;
+            if (!headerField.empty() && !fields.empty() && fields[0] == headerField) {
+                start = firstEnd ? firstLength + 1 : size;
+                headerLines = 1;
+            }
+    
+            // Roughly 1 MB per chunk, a few chunks per thread for balance
+            const size_t MIN_CHUNK = 1 << 20;
+            size_t threads = max(1u, thread::hardware_concurrency());
+            size_t chunkCount = min(threads * 4, (size - start) / MIN_CHUNK + 1);
+            vector<size_t> bounds(1, start);
+            for (size_t i = 1; i < chunkCount; ++i) {
+                size_t cut = max(bounds.back(), start + (size - start) * i / chunkCount);
+                const char* newline = static_cast<const char*>(memchr(data + cut, '\n', size - cut));
+                bounds.push_back(newline ? static_cast<size_t>(newline - data) + 1 : size);
+            }
+            bounds.push_back(size);
+    
+            Result<Record> result;
+            result.chunks.resize(chunkCount);
+            vector<vector<Error>> chunkErrors(chunkCount);
+            vector<size_t> chunkLines(chunkCount, 0);
+            atomic<size_t> nextChunk(0);
+    
+            auto worker = [&]() {
+                vector<string> row;
+                for (size_t chunk = nextChunk++; chunk < chunkCount; chunk = nextChunk++) {
+                    const char* p = data + bounds[chunk];
+                    const char* end = data + bounds[chunk + 1];
+                    while (p < end) {
+                        const char* lineEnd = static_cast<const char*>(memchr(p, '\n', end - p));
+                        if (!lineEnd) {
+                            lineEnd = end;
+                        }
+                        chunkLines[chunk]++;
+                        if (lineEnd > p && !(lineEnd == p + 1 && *p == '\r')) {
+                            splitLine(p, lineEnd, delimiter, row);
+                            Record record;
+                            string error;
+                            if (convert(row, record, error)) {
+                                result.chunks[chunk].push_back(move(record));
+                            } else {
+                                Error failure = { chunkLines[chunk], error };
+                                chunkErrors[chunk].push_back(failure);
+                            }
+                        }
+                        p = lineEnd + 1;
+                    }
+                }
+            };
+    
+            vector<thread> pool;
+            for (size_t i = 1; i < min(threads, chunkCount); ++i) {
+                pool.push_back(thread(worker));
+            }
+            worker();
+            for (auto& t : pool) {
+                t.join();
+            }
+    
+            // Turn chunk-relative line numbers into file line numbers
+            size_t lineOffset = headerLines;
+            for (size_t chunk = 0; chunk < chunkCount; ++chunk) {
+                for (Error& error : chunkErrors[chunk]) {
+                    error.line += lineOffset;
+                    result.errors.push_back(error);
+                }
+                lineOffset += chunkLines[chunk];
+                result.rows += result.chunks[chunk].size();
+            }
+            result.rows += result.errors.size();
+            result.lines = lineOffset;
+            result.bytes = size;
+            return result;
+        }
+    
+        // Parse a file window by window, calling apply(Result<Record>& window,
+        // size_t fileBytes) for each before the next is read. Error line numbers
+        // are file line numbers. Returns false if the file cannot be opened.
+        template<typename Record, typename Convert, typename Apply>
+        static bool stream(const string& path, const string& headerField, Convert convert, Apply apply,
+                           size_t windowBytes = WINDOW_BYTES) {
+            ifstream in(path.c_str(), ios::binary | ios::ate);
+            if (!in) {
+                return false;
+            }
+            size_t fileBytes = static_cast<size_t>(in.tellg());
+            in.seekg(0);
+            char delimiter = delimiterFor(path);
+    
+            string window, carry;
+            size_t linesBefore = 0;
+            bool first = true;
+            while (true) {
+                window.swap(carry);
+                carry.clear();
+                size_t kept = window.size();
+                window.resize(kept + windowBytes);
+                in.read(&window[kept], windowBytes);
+                window.resize(kept + static_cast<size_t>(in.gcount()));
+                bool last = !in;
+                if (!last) {
+                    // Hold back the partial last line for the next window
+                    size_t cut = window.find_last_of('\n');
+                    if (cut == string::npos) {
+                        carry.swap(window); // a line longer than a window: read on
+                        continue;
+                    }
+                    carry.assign(window, cut + 1, string::npos);
+                    window.resize(cut + 1);
+                }
+                Result<Record> result = parse<Record>(window, delimiter, first ? headerField : string(), convert);
+                for (Error& error : result.errors) {
+                    error.line += linesBefore;
+                }
+                linesBefore += result.lines;
+                apply(result, fileBytes);
+                first = false;
+                if (last) {
+                    return true;
+                }
+            }
+        }
+    };
+
+// Little-endian binary encoder for snapshots; the record stream is built in
+// memory and written to disk in a single call.
+class SnapshotWriter {
+    private:
+        string buffer;
+    
+        void putRaw(uint64_t value, int bytes) {
+            for (int i = 0; i < bytes; ++i) {
+                buffer.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+            }
+        }
+    
+    public:
+        void putU8(uint8_t value) { putRaw(value, 1); }
+        void putU32(uint32_t value) { putRaw(value, 4); }
+        void putU64(uint64_t value) { putRaw(value, 8); }
+        void putI64(int64_t value) { putRaw(static_cast<uint64_t>(value), 8); }
+    
+        void putF64(double value) {
+            uint64_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            putRaw(bits, 8);
+        }
+    
+        void putString(const string& value) {
+            putU32(static_cast<uint32_t>(value.size()));
+            buffer.append(value);
+        }
+    
+        void putBytes(const char* bytes, size_t length) { buffer.append(bytes, length); }
+    
+        // Pad with zeros to a multiple of 'alignment' bytes from the start, so an
+        // array that follows can be used in place from a mapping
+        void align(size_t alignment) {
+            buffer.append((alignment - buffer.size() % alignment) % alignment, '\0');
+        }
+    
+        const string& data() const { return buffer; }
+    };
+
+// Bounds-checked decoder over a snapshot image held in memory
+class SnapshotReader {
+    private:
+        const char* begin;
+        const char* cursor;
+        const char* end;
+    
+        uint64_t getRaw(int bytes) {
+            need(bytes);
+            uint64_t value = 0;
+            for (int i = 0; i < bytes; ++i) {
+                value |= static_cast<uint64_t>(static_cast<unsigned char>(cursor[i])) << (8 * i);
+            }
+            cursor += bytes;
+            return value;
+        }
+    
+        void need(size_t bytes) const {
+            if (static_cast<size_t>(end - cursor) < bytes) {
+                throw LibraryException("Snapshot is truncated or corrupt.");
+            }
+        }
+    
+    public:
+        SnapshotReader(const char* data, size_t size) : begin(data), cursor(data), end(data + size) {}
+    
+        uint8_t getU8() { return static_cast<uint8_t>(getRaw(1)); }
+        uint32_t getU32() { return static_cast<uint32_t>(getRaw(4)); }
+        uint64_t getU64() { return getRaw(8); }
+        int64_t getI64() { return static_cast<int64_t>(getRaw(8)); }
+    
+        double getF64() {
+            uint64_t bits = getRaw(8);
+            double value;
+            memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+    
+        string getString() {
+            uint32_t length = getU32();
+            need(length);
+            string value(cursor, length);
+            cursor += length;
+            return value;
+        }
+    
+        // A string field interned straight from the image; no string is built
+        // when the symbol already exists
+        Symbol getSymbol() {
+            uint32_t length = getU32();
+            return symbols().intern(getBytes(length), length);
+        }
+    
+        // View of the next 'length' raw bytes, without copying them
+        const char* getBytes(size_t length) {
+            need(length);
+            const char* bytes = cursor;
+            cursor += length;
+            return bytes;
+        }
+    
+        // Skip the padding SnapshotWriter::align wrote
+        void align(size_t alignment) {
+            size_t offset = static_cast<size_t>(cursor - begin);
+            getBytes((alignment - offset % alignment) % alignment);
+        }
+    
+        // 'count' values of an integer type T written with align(sizeof(T))
+        // and little-endian puts. They are used in place where the host's
+        // layout matches; otherwise they are decoded into 'decoded'.
+        template<typename T>
+        const T* getArray(size_t count, vector<T>& decoded) {
+            align(sizeof(T));
+            if (count > remaining() / sizeof(T)) {
+                throw LibraryException("Snapshot is truncated or corrupt.");
+            }
+            const char* bytes = getBytes(count * sizeof(T));
+            uint16_t probe = 1;
+            unsigned char lowByte;
+            memcpy(&lowByte, &probe, 1);
+            if (lowByte == 1 && reinterpret_cast<uintptr_t>(bytes) % alignof(T) == 0) {
+                return reinterpret_cast<const T*>(bytes);
+            }
+            decoded.resize(count);
+            for (size_t i = 0; i < count; ++i) {
+                uint64_t value = 0;
+                for (size_t b = 0; b < sizeof(T); ++b) {
+                    value |= static_cast<uint64_t>(static_cast<unsigned char>(bytes[i * sizeof(T) + b])) << (8 * b);
+                }
+                decoded[i] = static_cast<T>(value);
+            }
+            return decoded.data();
+        }
+    
+        bool atEnd() const { return cursor == end; }
+        size_t remaining() const { return static_cast<size_t>(end - cursor); }
+    };
+
+// Calendar month (UTC) of a timestamp, counted from January 1970
+inline int32_t monthIndexOf(time_t when) {
+    int64_t days = static_cast<int64_t>(when) / 86400 - (static_cast<int64_t>(when) % 86400 < 0 ? 1 : 0);
+    // Civil date from a day count (Howard Hinnant's algorithm)
+    days += 719468;
+    int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+    int64_t dayOfEra = days - era * 146097;
+    int64_t yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    int64_t dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    int64_t shifted = (5 * dayOfYear + 2) / 153; // months counted from March
+    int64_t month = shifted < 10 ? shifted + 3 : shifted - 9;
+    int64_t year = yearOfEra + era * 400 + (month <= 2 ? 1 : 0);
+    return static_cast<int32_t>((year - 1970) * 12 + month - 1);
+}
+
+// "YYYY-MM" for a month index
+inline string monthLabel(int32_t month) {
+    int32_t years = month >= 0 ? month / 12 : (month - 11) / 12;
+    char text[32];
+    snprintf(text, sizeof(text), "%04d-%02d", static_cast<int>(1970 + years), static_cast<int>(month - years * 12 + 1));
+    return text;
+}
+
+inline void appendVarint(string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+// Multi-byte varints and errors; see readVarint
+inline uint64_t readLongVarint(const char*& cursor, const char* end) {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (cursor == end) {
+            break;
+        }
+        uint8_t byte = static_cast<uint8_t>(*cursor++);
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return value;
+        }
+    }
+    throw LibraryException("Loan history segment is truncated or corrupt.");
+}
+
+// Decode a varint, refusing to read past 'end'. One- and two-byte values, the
+// common case for codes and deltas, stay on an inlined path.
+inline uint64_t readVarint(const char*& cursor, const char* end) {
+    if (end - cursor >= 2) {
+        uint8_t first = static_cast<uint8_t>(cursor[0]);
+        if (!(first & 0x80)) {
+            cursor += 1;
+            return first;
+        }
+        uint8_t second = static_cast<uint8_t>(cursor[1]);
+        if (!(second & 0x80)) {
+            cursor += 2;
+            return (first & 0x7F) | static_cast<uint64_t>(second) << 7;
+        }
+    }
+    return readLongVarint(cursor, end);
+}
+
+// Signed deltas as unsigned varints: 0, -1, 1, -2, ... map to 0, 1, 2, 3, ...
+inline uint64_t zigzag(int64_t value) {
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+inline int64_t unzigzag(uint64_t value) {
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+// Read-only view of a whole file: mapped into memory where mmap is available,
+// otherwise read in
+class MappedFile {
+    private:
+        const char* base;
+        size_t length;
+        string copy;
+    
+        MappedFile() : base(nullptr), length(0) {}
+    
+    public:
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+    
+        ~MappedFile() {
+#ifndef _WIN32
+            if (base && copy.empty()) {
+                munmap(const_cast<char*>(base), length);
+            }
+#endif
+        }
+    
+        // Null if the file cannot be opened
+        static shared_ptr<MappedFile> open(const string& path) {
+            shared_ptr<MappedFile> file(new MappedFile());
+#ifdef _WIN32
+            if (!readFile(path, file->copy)) {
+                return nullptr;
+            }
+            file->base = file->copy.data();
+            file->length = file->copy.size();
+#else
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                return nullptr;
+            }
+            struct stat info;
+            if (fstat(fd, &info) != 0) {
+                close(fd);
+                return nullptr;
+            }
+            file->length = static_cast<size_t>(info.st_size);
+            if (file->length == 0) {
+                close(fd);
+                file->base = file->copy.data();
+                return file;
+            }
+            void* mapped = mmap(nullptr, file->length, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+            if (mapped == MAP_FAILED) {
+                return nullptr;
+            }
+            file->base = static_cast<const char*>(mapped);
+#endif
+            return file;
+        }
+    
+        const char* data() const { return base; }
+        size_t size() const { return length; }
+    };
+
+// CatalogColumns' snapshot section (see CatalogColumns::write)
+inline void CatalogColumns::writeStrings(SnapshotWriter& out, const StringColumn& column,
+                                        const vector<uint32_t>& order) {
+    out.align(4);
+    uint32_t offset = 0;
+    out.putU32(offset);
+    for (uint32_t row : order) {
+        offset += static_cast<uint32_t>(column.length(row));
+        out.putU32(offset);
+    }
+    for (uint32_t row : order) {
+        out.putBytes(column.data(row), column.length(row));
+    }
+}
+
+template<typename T>
+void CatalogColumns::attachColumn(SnapshotReader& in, size_t count, ColumnVector<T>& column) {
+    vector<T> decoded;
+    const T* values = in.getArray<T>(count, decoded);
+    if (decoded.empty()) {
+        column.attach(values, count);
+        return;
+    }
+    for (T value : decoded) {
+        column.push_back(value);
+    }
+}
+
+inline void CatalogColumns::attachColumn(SnapshotReader& in, size_t count, StringColumn& column) {
+    vector<uint32_t> decoded;
+    const uint32_t* offsets = in.getArray<uint32_t>(count + 1, decoded);
+    if (offsets[0] != 0) {
+        throw corrupt();
+    }
+    for (size_t i = 0; i < count; ++i) {
+        if (offsets[i] > offsets[i + 1]) {
+            throw corrupt();
+        }
+    }
+    const char* bytes = in.getBytes(offsets[count]);
+    if (decoded.empty()) {
+        column.attach(offsets, bytes, count);
+        return;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        column.push_back(bytes + offsets[i], offsets[i + 1] - offsets[i]);
+    }
+}
+
+inline void CatalogColumns::checkSideRows(const ColumnVector<uint32_t>& sideRows, BookKind kind) const {
+    size_t expected = 0;
+    for (size_t row = 0; row < kinds.size(); ++row) {
+        if (kinds[row] >= KINDS) {
+            throw corrupt();
+        }
+        if (static_cast<BookKind>(kinds[row]) == kind) {
+            if (expected >= sideRows.size() || sideRows[expected] != row) {
+                throw corrupt();
+            }
+            expected++;
+        }
+    }
+    if (expected != sideRows.size()) {
+        throw corrupt();
+    }
+}
+
+inline void CatalogColumns::write(SnapshotWriter& out, const vector<uint32_t>& order) const {
+    size_t count = order.size();
+    out.putU32(static_cast<uint32_t>(count));
+    out.align(8);
+    for (size_t word = 0; word < (count + 63) / 64; ++word) {
+        uint64_t bits = 0;
+        for (size_t i = word * 64; i < min(count, word * 64 + 64); ++i) {
+            bits |= static_cast<uint64_t>(isAvailable(order[i]) ? 1 : 0) << (i % 64);
+        }
+        out.putU64(bits);
+    }
+    for (uint32_t row : order) {
+        out.putU8(kinds[row]);
+    }
+    out.putU32(static_cast<uint32_t>(categoryNames.size()));
+    for (const string& name : categoryNames) {
+        out.putString(name);
+    }
+    out.align(4);
+    for (uint32_t row : order) {
+        out.putU32(categoryCodes[row]);
+    }
+    writeStrings(out, ids, order);
+    writeStrings(out, titles, order);
+    writeStrings(out, authors, order);
+    
+    // Side tables in the new row order
+    vector<uint32_t> ebookPositions, journalPositions;
+    vector<uint32_t> ebookNewRows, journalNewRows;
+    for (size_t i = 0; i < count; ++i) {
+        if (kindOf(order[i]) == BookKind::EBook) {
+            ebookNewRows.push_back(static_cast<uint32_t>(i));
+            ebookPositions.push_back(static_cast<uint32_t>(ebookRows.lowerBound(order[i])));
+        } else if (kindOf(order[i]) == BookKind::Journal) {
+            journalNewRows.push_back(static_cast<uint32_t>(i));
+            journalPositions.push_back(static_cast<uint32_t>(journalRows.lowerBound(order[i])));
+        }
+    }
+    out.putU32(static_cast<uint32_t>(ebookNewRows.size()));
+    out.align(4);
+    for (uint32_t row : ebookNewRows) {
+        out.putU32(row);
+    }
+    for (uint32_t position : ebookPositions) {
+        out.putU32(static_cast<uint32_t>(ebookSizes[position]));
+    }
+    writeStrings(out, ebookFormats, ebookPositions);
+    out.putU32(static_cast<uint32_t>(journalNewRows.size()));
+    out.align(4);
+    for (uint32_t row : journalNewRows) {
+        out.putU32(row);
+    }
+    for (uint32_t position : journalPositions) {
+        out.putU32(static_cast<uint32_t>(journalVolumes[position]));
+    }
+    for (uint32_t position : journalPositions) {
+        out.putU32(static_cast<uint32_t>(journalIssues[position]));
+    }
+    writeStrings(out, journalDates, journalPositions);
+    
+    // ID index at most half full; the first row under an ID wins, as in the
+    // Library's own index
+    size_t slotCount = 16;
+    while (slotCount < count * 2) {
+        slotCount *= 2;
+    }
+    vector<uint64_t> slots(slotCount, NO_ROW);
+    for (size_t i = 0; i < count; ++i) {
+        const char* id = ids.data(order[i]);
+        size_t length = ids.length(order[i]);
+        uint32_t hash = SymbolTable::hashOf(id, length);
+        size_t pos = hash & (slotCount - 1);
+        bool duplicate = false;
+        while (static_cast<uint32_t>(slots[pos]) != NO_ROW) {
+            uint32_t other = static_cast<uint32_t>(slots[pos]);
+            if (static_cast<uint32_t>(slots[pos] >> 32) == hash && ids.equals(order[other], id, length)) {
+                duplicate = true;
+                break;
+            }
+            pos = (pos + 1) & (slotCount - 1);
+        }
+        if (!duplicate) {
+            slots[pos] = static_cast<uint64_t>(hash) << 32 | i;
+        }
+    }
+    out.putU32(static_cast<uint32_t>(slotCount));
+    out.align(8);
+    for (uint64_t slot : slots) {
+        out.putU64(slot);
+    }
+}
+
+inline size_t CatalogColumns::attach(SnapshotReader& in, const shared_ptr<MappedFile>& file) {
+    size_t count = in.getU32();
+    growWords(count / 64 + 1);
+    in.align(8);
+    for (size_t word = 0; word < (count + 63) / 64; ++word) {
+        uint64_t bits = in.getU64();
+        if (word == count / 64) {
+            bits &= (uint64_t(1) << (count % 64)) - 1; // bits past the last row stay 0
+        }
+        availableWords[word].store(bits, memory_order_relaxed);
+    }
+    attachColumn(in, count, kinds);
+    uint32_t categoryCount = in.getU32();
+    for (uint32_t code = 0; code < categoryCount; ++code) {
+        categoryNames.push_back(in.getString());
+        categoryIndex.insert(categoryNames.back(), code);
+    }
+    attachColumn(in, count, categoryCodes);
+    for (size_t row = 0; row < count; ++row) {
+        if (categoryCodes[row] >= categoryCount) {
+            throw corrupt();
+        }
+    }
+    attachColumn(in, count, ids);
+    attachColumn(in, count, titles);
+    attachColumn(in, count, authors);
+    
+    size_t ebookCount = in.getU32();
+    attachColumn(in, ebookCount, ebookRows);
+    attachColumn(in, ebookCount, ebookSizes);
+    attachColumn(in, ebookCount, ebookFormats);
+    checkSideRows(ebookRows, BookKind::EBook);
+    size_t journalCount = in.getU32();
+    attachColumn(in, journalCount, journalRows);
+    attachColumn(in, journalCount, journalVolumes);
+    attachColumn(in, journalCount, journalIssues);
+    attachColumn(in, journalCount, journalDates);
+    checkSideRows(journalRows, BookKind::Journal);
+    
+    size_t slotCount = in.getU32();
+    if (slotCount <= count || (slotCount & (slotCount - 1)) != 0) {
+        throw corrupt();
+    }
+    attachColumn(in, slotCount, idSlots);
+    
+    image = file;
+    rows = count;
+    mappedRows = count;
+    return count;
+}
+
+// One loan as the analytics scans see it, live or sealed
+struct LoanFacts {
+    Symbol memberId;
+    Symbol bookId;
+    time_t issued;
+    time_t returned;   // 0 while the loan is open
+    int64_t finePaise; // charged at return
+    BookKind kind;
+};
+
+// One month of closed loan history, sealed. Rows are the loans returned in that
+// month, in transaction-number order, and each field is its own column:
+// transaction numbers and issue times as varint deltas from the previous row,
+// the return time as a varint of the time held, fines in paise with the item
+// kind in the low two bits, and member and book IDs as fixed-width codes (one
+// to four bytes, by dictionary size) into per-segment dictionaries. A lookup
+// finds the ID's code in the dictionary, skipping the month if it is absent,
+// scans the fixed-width column for it, and decodes each match from the nearest
+// entry of a block table that records where every BLOCK_ROWS-th row starts in
+// the varint columns. The columns are held in memory or in a mapped spill
+// file; the image format is the same for spill files and snapshots.
+class HistorySegment {
+    public:
+        static const uint32_t BLOCK_ROWS = 128;
+    
+    private:
+        static const uint32_t IMAGE_MAGIC = 0x53484C53; // "SLHS"
+        static const uint32_t IMAGE_VERSION = 1;
+        enum Column { Numbers, Issued, Held, Fines, Members, Books, COLUMNS };
+        static const int VARINT_COLUMNS = Members; // the columns before Members
+    
+        struct Block {
+            uint32_t offsets[VARINT_COLUMNS];
+            uint32_t number; // values the deltas of the block's first row apply to
+            int64_t issued;
+        };
+    
+        // Decoding position; rows are visited in order
+        struct Cursor {
+            const char* at[VARINT_COLUMNS];
+            uint32_t row;
+            uint32_t number;
+            int64_t issued;
+        };
+    
+        // Dictionary of one ID column: code -> ID. Codes are assigned in symbol
+        // order when sealing; a segment read back from an image (where symbol
+        // values differ) gets a lookup array of codes in symbol order instead.
+        struct Dictionary {
+            vector<Symbol> ids;
+            vector<uint32_t> lookup; // empty if 'ids' is itself in symbol order
+            uint32_t width;          // bytes per code
+    
+            Dictionary() : width(1) {}
+    
+            void setWidth() {
+                width = ids.size() <= 0x100 ? 1 : ids.size() <= 0x10000 ? 2 : ids.size() <= 0x1000000 ? 3 : 4;
+            }
+    
+            Symbol idAt(uint32_t position) const { return ids[lookup.empty() ? position : lookup[position]]; }
+    
+            // Code of 'id', or -1 if it does not occur in this month
+            int64_t codeOf(Symbol id) const {
+                size_t low = 0, high = ids.size();
+                while (low < high) {
+                    size_t middle = (low + high) / 2;
+                    if (idAt(static_cast<uint32_t>(middle)).getValue() < id.getValue()) {
+                        low = middle + 1;
+                    } else {
+                        high = middle;
+                    }
+                }
+                if (low == ids.size() || idAt(static_cast<uint32_t>(low)) != id) {
+                    return -1;
+                }
+                return lookup.empty() ? static_cast<int64_t>(low) : lookup[low];
+            }
+    
+            size_t memoryBytes() const { return ids.capacity() * sizeof(Symbol) + lookup.capacity() * sizeof(uint32_t); }
+        };
+    
+        int32_t month;
+        uint32_t rows;
+        uint32_t firstNumber, lastNumber;
+        Dictionary members, books;
+        vector<Block> blocks;
+        uint32_t columnEnds[COLUMNS]; // column i spans [columnEnds[i - 1], columnEnds[i])
+        string owned;                 // column bytes held in memory...
+        shared_ptr<MappedFile> mapping; // ...or a mapping of the spill file
+        const char* columns;
+        string spillPath;
+    
+        HistorySegment() : month(0), rows(0), firstNumber(0), lastNumber(0), columns(nullptr) {}
+    
+        const char* columnBegin(int column) const { return columns + (column == 0 ? 0 : columnEnds[column - 1]); }
+        const char* columnEnd(int column) const { return columns + columnEnds[column]; }
+    
+        static void appendCode(string& out, uint32_t code, uint32_t width) {
+            for (uint32_t i = 0; i < width; ++i) {
+                out.push_back(static_cast<char>(code >> (8 * i)));
+            }
+        }
+    
+        static uint32_t codeAt(const char* column, uint32_t row, uint32_t width) {
+            const unsigned char* at = reinterpret_cast<const unsigned char*>(column) + static_cast<size_t>(row) * width;
+            uint32_t code = 0;
+            for (uint32_t i = 0; i < width; ++i) {
+                code |= static_cast<uint32_t>(at[i]) << (8 * i);
+            }
+            return code;
+        }
+    
+        // Dictionary of the distinct IDs in symbol order, and each row's code
+        static void encodeIds(const vector<Symbol>& ids, Dictionary& dictionary, string& column) {
+            vector<uint32_t> values;
+            values.reserve(ids.size());
+            for (Symbol id : ids) {
+                values.push_back(id.getValue());
+            }
+            sort(values.begin(), values.end());
+            values.erase(unique(values.begin(), values.end()), values.end());
+            dictionary.ids.clear();
+            dictionary.ids.reserve(values.size());
+            for (uint32_t value : values) {
+                dictionary.ids.push_back(Symbol(value));
+            }
+            dictionary.setWidth();
+            column.reserve(ids.size() * dictionary.width);
+            for (Symbol id : ids) {
+                uint32_t code = static_cast<uint32_t>(lower_bound(values.begin(), values.end(), id.getValue()) - values.begin());
+                appendCode(column, code, dictionary.width);
+            }
+        }
+    
+        static void writeDictionary(SnapshotWriter& out, const Dictionary& dictionary) {
+            out.putU32(static_cast<uint32_t>(dictionary.ids.size()));
+            for (Symbol id : dictionary.ids) {
+                out.putString(id.str());
+            }
+        }
+    
+        static void readDictionary(SnapshotReader& in, Dictionary& dictionary) {
+            uint32_t count = in.getU32();
+            dictionary.ids.reserve(count);
+            for (uint32_t i = 0; i < count; ++i) {
+                dictionary.ids.push_back(in.getSymbol());
+            }
+            dictionary.setWidth();
+            const vector<Symbol>& ids = dictionary.ids;
+            bool ordered = true;
+            for (size_t i = 1; i < ids.size() && ordered; ++i) {
+                ordered = ids[i - 1].getValue() < ids[i].getValue();
+            }
+            if (!ordered) {
+                dictionary.lookup.resize(ids.size());
+                for (uint32_t code = 0; code < ids.size(); ++code) {
+                    dictionary.lookup[code] = code;
+                }
+                sort(dictionary.lookup.begin(), dictionary.lookup.end(), [&ids](uint32_t a, uint32_t b) {
+                    return ids[a].getValue() < ids[b].getValue();
+                });
+            }
+        }
+    
+        static LibraryException corrupt() {
+            return LibraryException("Loan history segment is truncated or corrupt.");
+        }
+    
+        void seek(Cursor& cursor, uint32_t row) const {
+            const Block& block = blocks[row / BLOCK_ROWS];
+            for (int column = 0; column < VARINT_COLUMNS; ++column) {
+                cursor.at[column] = columnBegin(column) + block.offsets[column];
+            }
+            cursor.row = row / BLOCK_ROWS * BLOCK_ROWS;
+            cursor.number = block.number;
+            cursor.issued = block.issued;
+        }
+    
+        // Step over a row, keeping only the running delta bases
+        void skip(Cursor& cursor) const {
+            cursor.number += static_cast<uint32_t>(readVarint(cursor.at[Numbers], columnEnd(Numbers)));
+            cursor.issued += unzigzag(readVarint(cursor.at[Issued], columnEnd(Issued)));
+            readVarint(cursor.at[Held], columnEnd(Held));
+            readVarint(cursor.at[Fines], columnEnd(Fines));
+            cursor.row++;
+        }
+    
+        Transaction decode(Cursor& cursor) const {
+            uint32_t row = cursor.row;
+            cursor.number += static_cast<uint32_t>(readVarint(cursor.at[Numbers], columnEnd(Numbers)));
+            cursor.issued += unzigzag(readVarint(cursor.at[Issued], columnEnd(Issued)));
+            int64_t held = unzigzag(readVarint(cursor.at[Held], columnEnd(Held)));
+            uint64_t fine = readVarint(cursor.at[Fines], columnEnd(Fines));
+            uint32_t member = codeAt(columnBegin(Members), row, members.width);
+            uint32_t book = codeAt(columnBegin(Books), row, books.width);
+            cursor.row++;
+            if (member >= members.ids.size() || book >= books.ids.size() || (fine & 3) > 2) {
+                throw corrupt();
+            }
+            return Transaction(cursor.number, members.ids[member], books.ids[book],
+                               static_cast<time_t>(cursor.issued), static_cast<time_t>(cursor.issued + held),
+                               static_cast<double>(fine >> 2) / 100.0, true, static_cast<BookKind>(fine & 3));
+        }
+    
+        // Rows whose code in a fixed-width column is 'code'
+        template<uint32_t Width>
+        static void findRows(const char* column, uint32_t rows, uint32_t code, vector<uint32_t>& found) {
+            const unsigned char* at = reinterpret_cast<const unsigned char*>(column);
+            for (uint32_t row = 0; row < rows; ++row, at += Width) {
+                uint32_t value = 0;
+                for (uint32_t i = 0; i < Width; ++i) {
+                    value |= static_cast<uint32_t>(at[i]) << (8 * i);
+                }
+                if (value == code) {
+                    found.push_back(row);
+                }
+            }
+        }
+    
+        void collect(Column column, const Dictionary& dictionary, Symbol id, vector<Transaction>& out) const {
+            int64_t code = dictionary.codeOf(id);
+            if (code < 0) {
+                return;
+            }
+            vector<uint32_t> matches;
+            const char* begin = columnBegin(column);
+            uint32_t target = static_cast<uint32_t>(code);
+            switch (dictionary.width) {
+                case 1: findRows<1>(begin, rows, target, matches); break;
+                case 2: findRows<2>(begin, rows, target, matches); break;
+                case 3: findRows<3>(begin, rows, target, matches); break;
+                default: findRows<4>(begin, rows, target, matches); break;
+            }
+            Cursor cursor;
+            cursor.row = rows; // not positioned yet
+            for (uint32_t row : matches) {
+                if (cursor.row > row || row / BLOCK_ROWS != cursor.row / BLOCK_ROWS) {
+                    seek(cursor, row);
+                }
+                while (cursor.row < row) {
+                    skip(cursor);
+                }
+                out.push_back(decode(cursor));
+            }
+        }
+    
+    public:
+        HistorySegment(const HistorySegment&) = delete;
+        HistorySegment& operator=(const HistorySegment&) = delete;
+    
+        // Seal the loans returned in 'month'; 'loans' must be sorted by
+        // transaction number
+        static shared_ptr<HistorySegment> seal(int32_t month, const vector<const Transaction*>& loans) {
+            shared_ptr<HistorySegment> segment(new HistorySegment());
+            segment->month = month;
+            segment->rows = static_cast<uint32_t>(loans.size());
+            segment->firstNumber = loans.empty() ? 0 : loans.front()->getTransactionNumber();
+            segment->lastNumber = loans.empty() ? 0 : loans.back()->getTransactionNumber();
+    
+            string data[COLUMNS];
+            vector<Symbol> ids;
+            ids.reserve(loans.size());
+            for (const Transaction* loan : loans) {
+                ids.push_back(loan->getMemberSymbol());
+            }
+            encodeIds(ids, segment->members, data[Members]);
+            ids.clear();
+            for (const Transaction* loan : loans) {
+                ids.push_back(loan->getBookSymbol());
+            }
+            encodeIds(ids, segment->books, data[Books]);
+    
+            uint32_t number = 0;
+            int64_t issued = 0;
+            for (size_t row = 0; row < loans.size(); ++row) {
+                const Transaction& loan = *loans[row];
+                if (row % BLOCK_ROWS == 0) {
+                    Block block;
+                    for (int column = 0; column < VARINT_COLUMNS; ++column) {
+                        block.offsets[column] = static_cast<uint32_t>(data[column].size());
+                    }
+                    block.number = number;
+                    block.issued = issued;
+                    segment->blocks.push_back(block);
+                }
+                int64_t issueDate = static_cast<int64_t>(loan.getIssueDate());
+                int64_t paise = llround(loan.getFine() * 100.0);
+                appendVarint(data[Numbers], loan.getTransactionNumber() - number);
+                appendVarint(data[Issued], zigzag(issueDate - issued));
+                appendVarint(data[Held], zigzag(static_cast<int64_t>(loan.getReturnDate()) - issueDate));
+                appendVarint(data[Fines], static_cast<uint64_t>(max<int64_t>(paise, 0)) << 2 | static_cast<uint8_t>(loan.getKind()));
+                number = loan.getTransactionNumber();
+                issued = issueDate;
+            }
+            for (int column = 0; column < COLUMNS; ++column) {
+                segment->owned += data[column];
+                segment->columnEnds[column] = static_cast<uint32_t>(segment->owned.size());
+            }
+            segment->owned.shrink_to_fit();
+            segment->columns = segment->owned.data();
+            return segment;
+        }
+    
+        // Encode the segment; dictionary IDs are written as strings because
+        // symbol values differ between runs
+        void write(SnapshotWriter& out) const {
+            out.putU32(IMAGE_MAGIC);
+            out.putU32(IMAGE_VERSION);
+            out.putU32(static_cast<uint32_t>(month));
+            out.putU32(rows);
+            out.putU32(firstNumber);
+            out.putU32(lastNumber);
+            writeDictionary(out, members);
+            writeDictionary(out, books);
+            out.putU32(static_cast<uint32_t>(blocks.size()));
+            for (const Block& block : blocks) {
+                for (int column = 0; column < VARINT_COLUMNS; ++column) {
+                    out.putU32(block.offsets[column]);
+                }
+                out.putU32(block.number);
+                out.putI64(block.issued);
+            }
+            for (int column = 0; column < COLUMNS; ++column) {
+                out.putU32(columnEnds[column]);
+            }
+            out.putString(string(columns, columnEnds[COLUMNS - 1]));
+        }
+    
+        // Decode an image written by write(). With a mapping, the columns are
+        // used in place; otherwise they are copied out of the reader.
+        static shared_ptr<HistorySegment> read(SnapshotReader& in, const shared_ptr<MappedFile>& mapping) {
+            if (in.getU32() != IMAGE_MAGIC || in.getU32() != IMAGE_VERSION) {
+                throw LibraryException("Not a loan history segment, or an unsupported version.");
+            }
+            shared_ptr<HistorySegment> segment(new HistorySegment());
+            segment->month = static_cast<int32_t>(in.getU32());
+            segment->rows = in.getU32();
+            segment->firstNumber = in.getU32();
+            segment->lastNumber = in.getU32();
+            readDictionary(in, segment->members);
+            readDictionary(in, segment->books);
+            uint32_t blockCount = in.getU32();
+            if (blockCount != (segment->rows + BLOCK_ROWS - 1) / BLOCK_ROWS) {
+                throw corrupt();
+            }
+            segment->blocks.resize(blockCount);
+            for (Block& block : segment->blocks) {
+                for (int column = 0; column < VARINT_COLUMNS; ++column) {
+                    block.offsets[column] = in.getU32();
+                }
+                block.number = in.getU32();
+                block.issued = in.getI64();
+            }
+            for (int column = 0; column < COLUMNS; ++column) {
+                segment->columnEnds[column] = in.getU32();
+            }
+            uint32_t length = in.getU32();
+            if (length != segment->columnEnds[COLUMNS - 1]) {
+                throw corrupt();
+            }
+            const char* bytes = in.getBytes(length);
+            for (int column = 0; column < COLUMNS; ++column) {
+                uint32_t begin = column == 0 ? 0 : segment->columnEnds[column - 1];
+                if (segment->columnEnds[column] < begin || segment->columnEnds[column] > length) {
+                    throw corrupt();
+                }
+                for (const Block& block : segment->blocks) {
+                    if (column < VARINT_COLUMNS && block.offsets[column] > segment->columnEnds[column] - begin) {
+                        throw corrupt();
+                    }
+                }
+            }
+            if (static_cast<uint64_t>(segment->rows) * segment->members.width != segment->columnEnds[Members] - segment->columnEnds[Members - 1]
+                || static_cast<uint64_t>(segment->rows) * segment->books.width != segment->columnEnds[Books] - segment->columnEnds[Books - 1]) {
+                throw corrupt();
+            }
+            if (mapping) {
+                segment->mapping = mapping;
+                segment->columns = bytes;
+            } else {
+                segment->owned.assign(bytes, length);
+                segment->columns = segment->owned.data();
+            }
+            return segment;
+        }
+    
+        // Write the segment to 'path' and return a copy that reads its columns
+        // from a mapping of that file. The file is synced and renamed into place
+        // and the rename synced before this returns, since the caller then
+        // drops the in-memory copy and the loans exist nowhere else.
+        shared_ptr<HistorySegment> spill(const string& path) const {
+            SnapshotWriter out;
+            write(out);
+            if (!replaceFile(path, out.data())) {
+                throw LibraryException("Could not write loan history to " + path + ".");
+            }
+            return open(path);
+        }
+    
+        // Map a spill file written by spill()
+        static shared_ptr<HistorySegment> open(const string& path) {
+            shared_ptr<MappedFile> mapping = MappedFile::open(path);
+            if (!mapping) {
+                throw LibraryException("Could not open loan history file " + path + ".");
+            }
+            SnapshotReader in(mapping->data(), mapping->size());
+            shared_ptr<HistorySegment> segment = read(in, mapping);
+            segment->spillPath = path;
+            return segment;
+        }
+    
+        // Loans of one member or one book in this month, appended to 'out'
+        void collectMember(Symbol memberId, vector<Transaction>& out) const {
+            collect(Members, members, memberId, out);
+        }
+    
+        void collectBook(Symbol bookId, vector<Transaction>& out) const {
+            collect(Books, books, bookId, out);
+        }
+
+        // Visit the loans of blocks [firstBlock, endBlock) in row order without
+        // building Transactions; transaction numbers are not decoded
+        template<typename F>
+        void scanBlocks(size_t firstBlock, size_t endBlock, F f) const {
+            if (firstBlock >= endBlock) {
+                return;
+            }
+            const Block& block = blocks[firstBlock];
+            const char* issuedAt = columnBegin(Issued) + block.offsets[Issued];
+            const char* heldAt = columnBegin(Held) + block.offsets[Held];
+            const char* finesAt = columnBegin(Fines) + block.offsets[Fines];
+            const char* memberCodes = columnBegin(Members);
+            const char* bookCodes = columnBegin(Books);
+            int64_t issued = block.issued;
+            uint32_t end = static_cast<uint32_t>(min<size_t>(rows, endBlock * BLOCK_ROWS));
+            LoanFacts loan;
+            for (uint32_t row = static_cast<uint32_t>(firstBlock * BLOCK_ROWS); row < end; ++row) {
+                issued += unzigzag(readVarint(issuedAt, columnEnd(Issued)));
+                int64_t held = unzigzag(readVarint(heldAt, columnEnd(Held)));
+                uint64_t fine = readVarint(finesAt, columnEnd(Fines));
+                uint32_t member = codeAt(memberCodes, row, members.width);
+                uint32_t book = codeAt(bookCodes, row, books.width);
+                if (member >= members.ids.size() || book >= books.ids.size() || (fine & 3) > 2) {
+                    throw corrupt();
+                }
+                loan.memberId = members.ids[member];
+                loan.bookId = books.ids[book];
+                loan.issued = static_cast<time_t>(issued);
+                loan.returned = static_cast<time_t>(issued + held);
+                loan.finePaise = static_cast<int64_t>(fine >> 2);
+                loan.kind = static_cast<BookKind>(fine & 3);
+                f(loan);
+            }
+        }
+
+        size_t blockCount() const { return blocks.size(); }
+        int32_t getMonth() const { return month; }
+        uint32_t size() const { return rows; }
+        uint32_t getFirstNumber() const { return firstNumber; }
+        uint32_t getLastNumber() const { return lastNumber; }
+        bool isSpilled() const { return !spillPath.empty(); }
+        const string& getSpillPath() const { return spillPath; }
+    
+        // Bytes held in process memory; a spilled segment's columns are in the
+        // page cache instead and not counted
+        size_t memoryBytes() const {
+            return sizeof(*this) + owned.capacity() + blocks.capacity() * sizeof(Block)
+                 + members.memoryBytes() + books.memoryBytes();
+        }
+    
+        size_t columnBytes() const { return columnEnds[COLUMNS - 1]; }
+    };
+
+// Every loan ever made. Open loans, and loans returned in the current month,
+// are live Transaction objects in creation order, with their member and book
+// IDs copied into two columns so history lookups scan those instead of the
+// objects. Sealing moves loans returned in earlier months into one
+// HistorySegment per month and recycles their objects. The Library guards this with historyLock and seals or spills only
+// while circulation is paused.
+class TransactionHistory {
+    private:
+        ObjectPool<Transaction> pool;
+        vector<Transaction*> live;
+        vector<Symbol> liveMembers, liveBooks; // IDs of live[i]
+        vector<shared_ptr<const HistorySegment>> sealed; // by month, then first transaction number
+    
+        static void collectLive(const vector<Symbol>& ids, Symbol id, const vector<Transaction*>& loans,
+                                vector<Transaction>& out) {
+            for (size_t i = 0; i < ids.size(); ++i) {
+                if (ids[i] == id) {
+                    out.push_back(*loans[i]);
+                }
+            }
+        }
+    
+        void sortSealed() {
+            sort(sealed.begin(), sealed.end(), [](const shared_ptr<const HistorySegment>& a,
+                                                  const shared_ptr<const HistorySegment>& b) {
+                return a->getMonth() != b->getMonth() ? a->getMonth() < b->getMonth()
+                                                      : a->getFirstNumber() < b->getFirstNumber();
+            });
+        }
+    
+    public:
+        template<typename... Args>
+        Transaction* create(Args&&... args) {
+            Transaction* transaction = pool.create(std::forward<Args>(args)...);
+            live.push_back(transaction);
+            liveMembers.push_back(transaction->getMemberSymbol());
+            liveBooks.push_back(transaction->getBookSymbol());
+            return transaction;
+        }
+    
+        // Live loans of one member or one book, appended to 'out'
+        void collectMember(Symbol memberId, vector<Transaction>& out) const {
+            collectLive(liveMembers, memberId, live, out);
+        }
+    
+        void collectBook(Symbol bookId, vector<Transaction>& out) const {
+            collectLive(liveBooks, bookId, live, out);
+        }
+    
+        const vector<Transaction*>& getLive() const { return live; }
+        const vector<shared_ptr<const HistorySegment>>& getSealed() const { return sealed; }
+        bool empty() const { return live.empty() && sealed.empty(); }
+        void reserve(size_t count) {
+            live.reserve(count);
+            liveMembers.reserve(count);
+            liveBooks.reserve(count);
+        }
+    
+        void addSealed(const shared_ptr<const HistorySegment>& segment) {
+            sealed.push_back(segment);
+            sortSealed();
+        }
+    
+        // Seal the loans returned before the month of 'before'. Returns how many
+        // loans were sealed.
+        size_t seal(time_t before) {
+            int32_t current = monthIndexOf(before);
+            map<int32_t, vector<const Transaction*>> byMonth;
+            size_t kept = 0;
+            for (Transaction* transaction : live) {
+                int32_t month = transaction->getReturnStatus() ? monthIndexOf(transaction->getReturnDate()) : current;
+                if (month < current) {
+                    byMonth[month].push_back(transaction);
+                } else {
+                    liveMembers[kept] = transaction->getMemberSymbol();
+                    liveBooks[kept] = transaction->getBookSymbol();
+                    live[kept++] = transaction;
+                }
+            }
+            size_t count = live.size() - kept;
+            if (count == 0) {
+                return 0;
+            }
+            live.resize(kept);
+            live.shrink_to_fit();
+            liveMembers.resize(kept);
+            liveMembers.shrink_to_fit();
+            liveBooks.resize(kept);
+            liveBooks.shrink_to_fit();
+            for (auto& entry : byMonth) {
+                vector<const Transaction*>& loans = entry.second;
+                sort(loans.begin(), loans.end(), [](const Transaction* a, const Transaction* b) {
+                    return a->getTransactionNumber() < b->getTransactionNumber();
+                });
+                sealed.push_back(HistorySegment::seal(entry.first, loans));
+                for (const Transaction* loan : loans) {
+                    pool.destroy(const_cast<Transaction*>(loan));
+                }
+            }
+            sortSealed();
+            return count;
+        }
+    
+        // Move in-memory segments to files named '<prefix>-YYYY-MM-T<first>.seg'
+        void spill(const string& prefix) {
+            for (auto& segment : sealed) {
+                if (!segment->isSpilled()) {
+                    segment = segment->spill(prefix + "-" + monthLabel(segment->getMonth()) + "-T"
+                                             + to_string(segment->getFirstNumber()) + ".seg");
+                }
+            }
+        }
+    
+        // Delete spill files under 'prefix' (and leftover temporary files) that
+        // no sealed segment reads, e.g. from a spill whose snapshot was never
+        // written. Only safe once a snapshot of the current state is on disk,
+        // since older snapshots may refer to them. Returns how many were removed.
+        size_t removeStaleSpills(const string& prefix) const {
+            size_t slash = prefix.find_last_of('/');
+            string directory = slash == string::npos ? "." : slash == 0 ? "/" : prefix.substr(0, slash);
+            string leading = slash == string::npos ? "" : prefix.substr(0, slash + 1);
+            string stem = prefix.substr(leading.size()) + "-";
+            vector<string> referenced;
+            for (const auto& segment : sealed) {
+                if (segment->isSpilled()) {
+                    referenced.push_back(segment->getSpillPath());
+                }
+            }
+            size_t removed = 0;
+            for (const string& name : listDirectory(directory)) {
+                bool segmentFile = name.size() > stem.size() + 4 && name.compare(0, stem.size(), stem) == 0
+                                   && (name.compare(name.size() - 4, 4, ".seg") == 0
+                                       || (name.size() > stem.size() + 8 && name.compare(name.size() - 8, 8, ".seg.tmp") == 0));
+                string path = leading + name;
+                if (segmentFile && find(referenced.begin(), referenced.end(), path) == referenced.end()
+                    && remove(path.c_str()) == 0) {
+                    removed++;
+                }
+            }
+            return removed;
+        }
+    
+        size_t sealedLoans() const {
+            size_t count = 0;
+            for (const auto& segment : sealed) {
+                count += segment->size();
+            }
+            return count;
+        }
+    
+        size_t sealedMemoryBytes() const {
+            size_t bytes = sealed.capacity() * sizeof(sealed[0]);
+            for (const auto& segment : sealed) {
+                bytes += segment->memoryBytes();
+            }
+            return bytes;
+        }
+    
+        // Pool slot, the pointer in the live list and the two ID columns
+        static size_t liveBytesPerLoan() { return sizeof(Transaction) + sizeof(Transaction*) + 2 * sizeof(Symbol); }
+    };
+
+// Fixed set of worker threads for data-parallel jobs. run() hands the same job
+// to every worker, with the calling thread as worker 0, and returns once all of
+// them have finished; a job splits its input into tasks that the workers claim
+// from a shared counter, as the import parser does with its chunks.
+class WorkerPool {
+    private:
+        mutex lock;
+        condition_variable wake;     // workers: new job or stopping
+        condition_variable finished; // run(): every worker is done
+        vector<thread> workers;
+        const function<void(size_t)>* job;
+        uint64_t generation;
+        size_t running;
+        bool stopping;
+        exception_ptr failure; // first exception thrown by a worker
+    
+        void work(size_t index) {
+            uint64_t seen = 0;
+            unique_lock<mutex> guard(lock);
+            while (true) {
+                wake.wait(guard, [this, &seen] { return generation != seen || stopping; });
+                if (stopping) {
+                    return;
+                }
+                seen = generation;
+                const function<void(size_t)>& current = *job;
+                guard.unlock();
+                exception_ptr error;
+                try {
+                    current(index);
+                } catch (...) {
+                    error = current_exception();
+                }
+                guard.lock();
+                if (error && !failure) {
+                    failure = error;
+                }
+                if (--running == 0) {
+                    finished.notify_one();
+                }
+            }
+        }
+    
+    public:
+        explicit WorkerPool(size_t threads) : job(nullptr), generation(0), running(0), stopping(false) {
+            for (size_t i = 1; i < threads; ++i) {
+                workers.push_back(thread(&WorkerPool::work, this, i));
+            }
+        }
+    
+        ~WorkerPool() {
+            {
+                lock_guard<mutex> guard(lock);
+                stopping = true;
+            }
+            wake.notify_all();
+            for (auto& worker : workers) {
+                worker.join();
+            }
+        }
+    
+        WorkerPool(const WorkerPool&) = delete;
+        WorkerPool& operator=(const WorkerPool&) = delete;
+    
+        size_t size() const { return workers.size() + 1; }
+    
+        // Run job(worker index) on every worker; one run at a time. Rethrows the
+        // first exception any worker threw.
+        void run(const function<void(size_t)>& task) {
+            {
+                lock_guard<mutex> guard(lock);
+                job = &task;
+                running = workers.size();
+                failure = nullptr;
+                generation++;
+            }
+            wake.notify_all();
+            exception_ptr error;
+            try {
+                task(0);
+            } catch (...) {
+                error = current_exception();
+            }
+            unique_lock<mutex> guard(lock);
+            finished.wait(guard, [this] { return running == 0; });
+            if (!error) {
+                error = failure;
+            }
+            if (error) {
+                rethrow_exception(error);
+            }
+        }
+    };
+
+// Result of a circulation analysis: every loan issued up to 'asOf', the live
+// ones and the sealed history alike. Fines are in rupees.
+struct AnalyticsReport {
+    struct Ranked {
+        Symbol id;     // book or member
+        uint64_t loans;
+        double fines;  // members: charged plus accrued on open loans
+    };
+    
+    struct CategoryCirculation {
+        string category;
+        uint64_t loans;
+        uint64_t openLoans;
+        double fines;
+    };
+    
+    time_t asOf;
+    uint64_t loans;
+    uint64_t openLoans;        // not returned by asOf
+    uint64_t overdueLoans;     // open and past their due date at asOf
+    double finesCharged;       // on loans returned by asOf
+    double finesOutstanding;   // accrued by asOf on loans still open then
+    uint64_t activeMembers;    // members with at least one loan
+    uint64_t membersWithFines;
+    vector<Ranked> topTitles;  // most borrowed first
+    vector<Ranked> topMembers;
+    vector<CategoryCirculation> categories; // most loans first
+    size_t threads;
+    double seconds;
+};
+
+// Fines, top titles, per-category circulation and member activity over the
+// loan history, computed on a WorkerPool. Loans are split into tasks (runs of
+// live loans, runs of segment blocks); each worker adds the loans it claims to
+// its own partial counters, indexed by symbol value, so the scan takes no
+// locks. The partials are then summed in parallel over symbol ranges, each
+// worker ranking its range, and the per-worker rankings are merged last.
+class CirculationAnalytics {
+    public:
+        enum : uint32_t { NO_CATEGORY = 0xFFFFFFFFu };
+    
+    private:
+        static const size_t LIVE_TASK_ROWS = 1 << 16;
+        static const size_t SEALED_TASK_BLOCKS = (1 << 16) / HistorySegment::BLOCK_ROWS;
+        static const size_t MERGE_TASK_SYMBOLS = 1 << 16;
+    
+        struct Partial {
+            vector<uint32_t> bookLoans;   // by symbol value
+            vector<uint32_t> memberLoans;
+            vector<int64_t> memberFines;  // paise
+            vector<uint64_t> categoryLoans, categoryOpen;
+            vector<int64_t> categoryFines;
+            uint64_t loans, openLoans, overdueLoans;
+            int64_t charged, outstanding;
+            // Filled while merging
+            vector<AnalyticsReport::Ranked> topTitles, topMembers; // heaps, worst first
+            uint64_t activeMembers, membersWithFines;
+        };
+    
+        struct Task {
+            const HistorySegment* segment; // null: live loans
+            size_t begin, end;             // rows of the live loans, or blocks
+        };
+    
+        const vector<LoanFacts>& live;
+        const vector<shared_ptr<const HistorySegment>>& sealed;
+        const vector<uint32_t>& categoryBySymbol;
+        size_t symbolCount;
+        size_t categoryCount;
+        time_t asOf;
+        size_t topN;
+        vector<Partial> partials;
+    
+        CirculationAnalytics(const vector<LoanFacts>& l, const vector<shared_ptr<const HistorySegment>>& s,
+                             const vector<uint32_t>& categories, size_t symbols, size_t categoryNames,
+                             time_t when, size_t top)
+            : live(l), sealed(s), categoryBySymbol(categories), symbolCount(symbols),
+              categoryCount(categoryNames), asOf(when), topN(top) {}
+    
+        void add(Partial& partial, const LoanFacts& loan) const {
+            if (loan.issued > asOf) {
+                return;
+            }
+            uint32_t member = loan.memberId.getValue();
+            uint32_t book = loan.bookId.getValue();
+            partial.loans++;
+            partial.bookLoans[book]++;
+            partial.memberLoans[member]++;
+            bool open = loan.returned == 0 || loan.returned > asOf;
+            int64_t fine;
+            if (open) {
+                fine = llround(Transaction::fineFor(loan.issued, asOf, loan.kind) * 100.0);
+                partial.openLoans++;
+                partial.outstanding += fine;
+                if (asOf > loan.issued + loanPolicyFor(loan.kind).loanDays * Transaction::SECONDS_PER_DAY) {
+                    partial.overdueLoans++;
+                }
+            } else {
+                fine = loan.finePaise;
+                partial.charged += fine;
+            }
+            partial.memberFines[member] += fine;
+            uint32_t category = book < categoryBySymbol.size() ? categoryBySymbol[book] : NO_CATEGORY;
+            if (category != NO_CATEGORY) {
+                partial.categoryLoans[category]++;
+                partial.categoryOpen[category] += open;
+                partial.categoryFines[category] += fine;
+            }
+        }
+    
+        // Most loans first, then by ID
+        static bool ranksBefore(const AnalyticsReport::Ranked& a, const AnalyticsReport::Ranked& b) {
+            return a.loans != b.loans ? a.loans > b.loans : a.id.str() < b.id.str();
+        }
+    
+        // Keep the best 'topN' candidates in a heap with the worst on top
+        void offer(vector<AnalyticsReport::Ranked>& heap, const AnalyticsReport::Ranked& candidate) const {
+            if (heap.size() < topN) {
+                heap.push_back(candidate);
+                push_heap(heap.begin(), heap.end(), ranksBefore);
+            } else if (topN != 0 && ranksBefore(candidate, heap.front())) {
+                pop_heap(heap.begin(), heap.end(), ranksBefore);
+                heap.back() = candidate;
+                push_heap(heap.begin(), heap.end(), ranksBefore);
+            }
+        }
+    
+        void scan(const vector<Task>& tasks, atomic<size_t>& next, size_t worker) {
+            Partial& partial = partials[worker];
+            partial.bookLoans.assign(symbolCount, 0);
+            partial.memberLoans.assign(symbolCount, 0);
+            partial.memberFines.assign(symbolCount, 0);
+            partial.categoryLoans.assign(categoryCount, 0);
+            partial.categoryOpen.assign(categoryCount, 0);
+            partial.categoryFines.assign(categoryCount, 0);
+            partial.loans = partial.openLoans = partial.overdueLoans = 0;
+            partial.charged = partial.outstanding = 0;
+            for (size_t i = next++; i < tasks.size(); i = next++) {
+                const Task& task = tasks[i];
+                if (task.segment) {
+                    task.segment->scanBlocks(task.begin, task.end, [this, &partial](const LoanFacts& loan) {
+                        add(partial, loan);
+                    });
+                } else {
+                    for (size_t row = task.begin; row < task.end; ++row) {
+                        add(partial, live[row]);
+                    }
+                }
+            }
+        }
+    
+        // Sum every partial's counters into partials[0], one range of symbols
+        // per task, and rank the range into this worker's heaps
+        void merge(atomic<size_t>& next, size_t worker) {
+            Partial& mine = partials[worker];
+            Partial& total = partials[0];
+            mine.topTitles.clear();
+            mine.topMembers.clear();
+            mine.activeMembers = mine.membersWithFines = 0;
+            size_t rangeCount = (symbolCount + MERGE_TASK_SYMBOLS - 1) / MERGE_TASK_SYMBOLS;
+            for (size_t range = next++; range < rangeCount; range = next++) {
+                size_t end = min(symbolCount, (range + 1) * MERGE_TASK_SYMBOLS);
+                for (size_t symbol = range * MERGE_TASK_SYMBOLS; symbol < end; ++symbol) {
+                    for (size_t other = 1; other < partials.size(); ++other) {
+                        total.bookLoans[symbol] += partials[other].bookLoans[symbol];
+                        total.memberLoans[symbol] += partials[other].memberLoans[symbol];
+                        total.memberFines[symbol] += partials[other].memberFines[symbol];
+                    }
+                    if (total.bookLoans[symbol] != 0) {
+                        AnalyticsReport::Ranked title = { Symbol(static_cast<uint32_t>(symbol)), total.bookLoans[symbol], 0.0 };
+                        offer(mine.topTitles, title);
+                    }
+                    if (total.memberLoans[symbol] != 0) {
+                        mine.activeMembers++;
+                        mine.membersWithFines += total.memberFines[symbol] != 0;
+                        AnalyticsReport::Ranked member = { Symbol(static_cast<uint32_t>(symbol)), total.memberLoans[symbol],
+                                                           total.memberFines[symbol] / 100.0 };
+                        offer(mine.topMembers, member);
+                    }
+                }
+            }
+        }
+    
+    public:
+        // Analyse 'live' and 'sealed' as of 'asOf'. 'categoryBySymbol' gives the
+        // category code of each book's symbol (NO_CATEGORY for other symbols);
+        // every symbol in the loans is below 'symbolCount'.
+        static AnalyticsReport run(WorkerPool& pool, const vector<LoanFacts>& live,
+                                   const vector<shared_ptr<const HistorySegment>>& sealed,
+                                   const vector<uint32_t>& categoryBySymbol, const vector<string>& categoryNames,
+                                   size_t symbolCount, time_t asOf, size_t topN) {
+            auto started = chrono::steady_clock::now();
+            CirculationAnalytics analytics(live, sealed, categoryBySymbol, symbolCount, categoryNames.size(), asOf, topN);
+            analytics.partials.resize(pool.size());
+    
+            vector<Task> tasks;
+            for (size_t begin = 0; begin < live.size(); begin += LIVE_TASK_ROWS) {
+                Task task = { nullptr, begin, min(live.size(), begin + LIVE_TASK_ROWS) };
+                tasks.push_back(task);
+            }
+            for (const auto& segment : sealed) {
+                for (size_t begin = 0; begin < segment->blockCount(); begin += SEALED_TASK_BLOCKS) {
+                    Task task = { segment.get(), begin, min(segment->blockCount(), begin + SEALED_TASK_BLOCKS) };
+                    tasks.push_back(task);
+                }
+            }
+            atomic<size_t> nextTask(0);
+            pool.run([&analytics, &tasks, &nextTask](size_t worker) { analytics.scan(tasks, nextTask, worker); });
+            atomic<size_t> nextRange(0);
+            pool.run([&analytics, &nextRange](size_t worker) { analytics.merge(nextRange, worker); });
+    
+            AnalyticsReport report;
+            report.asOf = asOf;
+            report.loans = report.openLoans = report.overdueLoans = 0;
+            report.activeMembers = report.membersWithFines = 0;
+            int64_t charged = 0, outstanding = 0;
+            vector<AnalyticsReport::CategoryCirculation> categories(categoryNames.size());
+            for (size_t code = 0; code < categories.size(); ++code) {
+                categories[code].category = categoryNames[code];
+                categories[code].loans = categories[code].openLoans = 0;
+                categories[code].fines = 0.0;
+            }
+            vector<int64_t> categoryFines(categories.size(), 0);
+            for (const Partial& partial : analytics.partials) {
+                report.loans += partial.loans;
+                report.openLoans += partial.openLoans;
+                report.overdueLoans += partial.overdueLoans;
+                charged += partial.charged;
+                outstanding += partial.outstanding;
+                report.activeMembers += partial.activeMembers;
+                report.membersWithFines += partial.membersWithFines;
+                for (size_t code = 0; code < categories.size(); ++code) {
+                    categories[code].loans += partial.categoryLoans[code];
+                    categories[code].openLoans += partial.categoryOpen[code];
+                    categoryFines[code] += partial.categoryFines[code];
+                }
+                report.topTitles.insert(report.topTitles.end(), partial.topTitles.begin(), partial.topTitles.end());
+                report.topMembers.insert(report.topMembers.end(), partial.topMembers.begin(), partial.topMembers.end());
+            }
+            report.finesCharged = charged / 100.0;
+            report.finesOutstanding = outstanding / 100.0;
+            for (auto* ranking : { &report.topTitles, &report.topMembers }) {
+                sort(ranking->begin(), ranking->end(), ranksBefore);
+                if (ranking->size() > topN) {
+                    ranking->resize(topN);
+                }
+            }
+            for (size_t code = 0; code < categories.size(); ++code) {
+                categories[code].fines = categoryFines[code] / 100.0;
+            }
+            stable_sort(categories.begin(), categories.end(),
+                        [](const AnalyticsReport::CategoryCirculation& a, const AnalyticsReport::CategoryCirculation& b) {
+                            return a.loans > b.loans;
+                        });
+            report.categories = move(categories);
+            report.threads = pool.size();
+            report.seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+            return report;
+        }
+    };
+
+// Kinds of state change recorded in the transaction journal
+enum class JournalOp : uint8_t { Issue = 1, Return = 2, Reserve = 3, ReserveServed = 4 };
+
+// Append-only write-ahead journal of circulation changes. Each record carries a
+// log sequence number (LSN) that keeps increasing across checkpoints. Appends
+// are buffered; commit() makes them durable, and whichever caller flushes first
+// writes and syncs every record appended so far (group commit), so concurrent
+// callers share a single fsync. If a write or sync fails, the file is cut back
+// to its last synced record and the journal stays failed: every later append
+// and commit throws until it is reopened, so a record that may have missed the
+// disk is never reported durable. The library's memory is then ahead of its
+// files; restart from the snapshot and journal.
+class TransactionJournal {
+    private:
+        FILE* file; // unbuffered, so a batch goes out in one write
+        string path;
+        mutable mutex lock;
+        condition_variable flushed;
+        string pending;
+        uint64_t appendedLsn; // last LSN placed in the buffer
+        uint64_t durableLsn;  // last LSN known to be on disk
+        size_t durableBytes;  // file length up to that record
+        uint64_t syncs;       // group commits written since construction
+        bool flushing;
+        bool failed;
+    
+        static uint32_t checksum(const char* data, size_t size) {
+            uint32_t hash = 2166136261u; // FNV-1a
+            for (size_t i = 0; i < size; ++i) {
+                hash = (hash ^ static_cast<unsigned char>(data[i])) * 16777619u;
+            }
+            return hash;
+        }
+    
+        // Called with the lock held
+        void throwIfFailed() const {
+            if (failed) {
+                throw LibraryException("Journal " + path + " could not be written or synced; no further changes can be logged.");
+            }
+        }
+    
+    public:
+        struct Record {
+            JournalOp op;
+            uint64_t lsn;
+            int64_t timestamp;
+            uint32_t transactionNumber;
+            string memberId;
+            string bookId;
+        };
+    
+        TransactionJournal()
+            : file(nullptr), appendedLsn(0), durableLsn(0), durableBytes(0), syncs(0), flushing(false), failed(false) {}
+        TransactionJournal(const TransactionJournal&) = delete;
+        TransactionJournal& operator=(const TransactionJournal&) = delete;
+    
+        ~TransactionJournal() {
+            try {
+                close();
+            } catch (const LibraryException&) {
+                // The records that could not be written were never reported durable
+            }
+        }
+    
+        // Read every intact record of a journal file. Reading stops at the first
+        // torn or corrupt record; validBytes reports the length of the good prefix.
+        static vector<Record> readAll(const string& journalPath, size_t& validBytes) {
+            vector<Record> records;
+            validBytes = 0;
+            ifstream in(journalPath.c_str(), ios::binary | ios::ate);
+            if (!in) {
+                return records;
+            }
+            string image(static_cast<size_t>(in.tellg()), '\0');
+            in.seekg(0);
+            in.read(&image[0], image.size());
+    
+            SnapshotReader reader(image.data(), image.size());
+            try {
+                while (reader.remaining() >= 8) {
+                    uint32_t length = reader.getU32();
+                    uint32_t expected = reader.getU32();
+                    size_t offset = image.size() - reader.remaining();
+                    if (reader.remaining() < length || checksum(image.data() + offset, length) != expected) {
+                        break;
+                    }
+                    SnapshotReader payload(image.data() + offset, length);
+                    Record record;
+                    record.op = static_cast<JournalOp>(payload.getU8());
+                    record.lsn = payload.getU64();
+                    record.timestamp = payload.getI64();
+                    record.transactionNumber = payload.getU32();
+                    record.memberId = payload.getString();
+                    record.bookId = payload.getString();
+                    records.push_back(record);
+                    reader = SnapshotReader(image.data() + offset + length, image.size() - offset - length);
+                    validBytes = offset + length;
+                }
+            } catch (const LibraryException&) {
+                // A record that decodes badly ends the readable part of the log
+            }
+            return records;
+        }
+    
+        // Open for appending; new records are numbered after lastLsn
+        void open(const string& journalPath, uint64_t lastLsn) {
+            close();
+            path = journalPath;
+            file = fopen(path.c_str(), "ab");
+            if (!file) {
+                throw LibraryException("Could not open journal " + path + ".");
+            }
+            setvbuf(file, nullptr, _IONBF, 0);
+            fseek(file, 0, SEEK_END);
+            long length = ftell(file);
+            if (length < 0) {
+                fclose(file);
+                file = nullptr;
+                throw LibraryException("Could not open journal " + path + ".");
+            }
+            durableBytes = static_cast<size_t>(length);
+            appendedLsn = durableLsn = lastLsn;
+            pending.clear();
+            failed = false;
+        }
+    
+        bool isOpen() const { return file != nullptr; }
+    
+        // Commit what is buffered and close the file. The file is closed even if
+        // that commit fails; the failure is then thrown.
+        void close() {
+            if (!file) {
+                return;
+            }
+            bool committed = true;
+            try {
+                commit(lastLsn());
+            } catch (const LibraryException&) {
+                committed = false;
+            }
+            fclose(file);
+            file = nullptr;
+            if (!committed) {
+                throw LibraryException("Could not write to journal " + path + "; its last records were not logged.");
+            }
+        }
+    
+        // Buffer one record and return its LSN; it is durable once commit(lsn) returns
+        uint64_t append(JournalOp op, time_t timestamp, uint32_t transactionNumber,
+                        const string& memberId, const string& bookId) {
+            lock_guard<mutex> guard(lock);
+            throwIfFailed();
+            uint64_t lsn = ++appendedLsn;
+            SnapshotWriter payload;
+            payload.putU8(static_cast<uint8_t>(op));
+            payload.putU64(lsn);
+            payload.putI64(static_cast<int64_t>(timestamp));
+            payload.putU32(transactionNumber);
+            payload.putString(memberId);
+            payload.putString(bookId);
+    
+            SnapshotWriter header;
+            header.putU32(static_cast<uint32_t>(payload.data().size()));
+            header.putU32(checksum(payload.data().data(), payload.data().size()));
+            pending += header.data();
+            pending += payload.data();
+            return lsn;
+        }
+    
+        // Block until every record up to lsn is on disk; throws if the journal
+        // has failed before they got there
+        void commit(uint64_t lsn) {
+            unique_lock<mutex> guard(lock);
+            while (durableLsn < lsn) {
+                throwIfFailed();
+                if (flushing) {
+                    flushed.wait(guard);
+                    continue;
+                }
+                // Become the leader for this group: take everything buffered so far
+                flushing = true;
+                string batch;
+                batch.swap(pending);
+                uint64_t batchLsn = appendedLsn;
+                guard.unlock();
+    
+                bool ok = fwrite(batch.data(), 1, batch.size(), file) == batch.size() && syncFile(file);
+                if (!ok) {
+                    // Leave no torn record for later appends to land behind;
+                    // nothing is appended once failed, so this is best effort
+                    clearerr(file);
+                    truncateFile(path, durableBytes);
+                }
+    
+                guard.lock();
+                flushing = false;
+                if (ok) {
+                    durableLsn = batchLsn;
+                    durableBytes += batch.size();
+                    syncs++;
+                } else {
+                    failed = true;
+                    pending.insert(0, batch); // never durable, but not dropped either
+                }
+                flushed.notify_all();
+            }
+        }
+    
+        uint64_t lastLsn() const {
+            lock_guard<mutex> guard(lock);
+            return appendedLsn;
+        }
+    
+        uint64_t syncCount() const {
+            lock_guard<mutex> guard(lock);
+            return syncs;
+        }
+    
+        // Drop all records, e.g. once a snapshot covering them has been written
+        void truncate() {
+            commit(lastLsn());
+            lock_guard<mutex> guard(lock);
+            throwIfFailed();
+            if (!truncateFile(path, 0)) {
+                failed = true;
+                throw LibraryException("Could not truncate journal " + path + ".");
+            }
+            durableBytes = 0;
+        }
+    };
+
+// One item of a circulation batch (see Library::processBatch)
+enum class CirculationOp : uint8_t { Issue, Return };
+
+struct CirculationRequest {
+    string memberId;
+    string bookId;
+    CirculationOp op;
+};
+
+// Outcome of an issue or return; the error values mirror the exceptions thrown
+// by issueBook and returnBook
+enum class CirculationStatus : uint8_t {
+    Issued,
+    Returned,
+    Reserved,       // book was out; the member joined its hold queue
+    InvalidMember,
+    BookNotFound,
+    LimitReached,
+    NoActiveLoan
+};
+
+// Result of the non-throwing circulation calls (tryIssueBook, tryReturnBook).
+// Failures carry only the status and the offending ID; the message text is
+// formatted on demand, so a rejected scan costs no exception and no string
+// building unless someone reads the message.
+class CirculationResult {
+    private:
+        CirculationStatus status;
+        uint32_t transactionNumber; // set for Issued and Returned
+        string subject;             // member or book ID the error refers to
+    
+        CirculationResult(CirculationStatus s, uint32_t number, const string& id)
+            : status(s), transactionNumber(number), subject(id) {}
+    
+    public:
+        static CirculationResult success(CirculationStatus s, uint32_t number = 0) {
+            return CirculationResult(s, number, string());
+        }
+    
+        static CirculationResult failure(CirculationStatus s, const string& id = string()) {
+            return CirculationResult(s, 0, id);
+        }
+    
+        bool ok() const {
+            return status == CirculationStatus::Issued || status == CirculationStatus::Returned
+                   || status == CirculationStatus::Reserved;
+        }
+        explicit operator bool() const { return ok(); }
+    
+        CirculationStatus getStatus() const { return status; }
+        uint32_t getTransactionNumber() const { return transactionNumber; }
+    
+        string message() const {
+            switch (status) {
+                case CirculationStatus::Issued: return "Book issued successfully!";
+                case CirculationStatus::Returned: return "Book returned successfully!";
+                case CirculationStatus::Reserved: return "Book is not available. Adding to reservation queue.";
+                case CirculationStatus::InvalidMember: return InvalidMemberException(subject).what();
+                case CirculationStatus::BookNotFound: return BookNotFoundException(subject).what();
+                case CirculationStatus::LimitReached: return MaxIssueLimitException(subject).what();
+                case CirculationStatus::NoActiveLoan: break;
+            }
+            return "No active transaction found for this book and member.";
+        }
+    
+        // Throw the exception the throwing API uses for this status, if any
+        void throwIfError() const {
+            switch (status) {
+                case CirculationStatus::InvalidMember: throw InvalidMemberException(subject);
+                case CirculationStatus::BookNotFound: throw BookNotFoundException(subject);
+                case CirculationStatus::LimitReached: throw MaxIssueLimitException(subject);
+                case CirculationStatus::NoActiveLoan: throw LibraryException(message());
+                default: break;
+            }
+        }
+    };
+
+// What the circulation calls report to the console. Events are queued by the
+// calling thread and rendered later by the output sink.
+enum class EventKind : uint8_t {
+    Issued,          // transaction receipt
+    Returned,        // transaction receipt
+    Reserved,
+    HoldProcessing,  // a returned book has holders waiting
+    HoldRejected,    // result says why the holder could not be served
+    Failed,          // result of a rejected issue or return
+    Notice           // preformatted text
+};
+
+struct LibraryEvent {
+    EventKind kind;
+    Transaction transaction;
+    CirculationResult result;
+    string text;
+    
+    LibraryEvent(EventKind k, const Transaction& t, const CirculationResult& r, const string& message)
+        : kind(k), transaction(t), result(r), text(message) {}
+    
+    static LibraryEvent of(EventKind kind) {
+        return LibraryEvent(kind, Transaction(0, Symbol(), Symbol(), 0, 0, 0.0, false),
+                            CirculationResult::success(CirculationStatus::Issued), string());
+    }
+    
+    static LibraryEvent receipt(EventKind kind, const Transaction& transaction) {
+        LibraryEvent event = of(kind);
+        event.transaction = transaction;
+        return event;
+    }
+    
+    static LibraryEvent failure(EventKind kind, const CirculationResult& result) {
+        LibraryEvent event = of(kind);
+        event.result = result;
+        return event;
+    }
+    
+    static LibraryEvent notice(const string& text) {
+        LibraryEvent event = of(EventKind::Notice);
+        event.text = text;
+        return event;
+    }
+};
+
+// Asynchronous console output. Callers hand over events and return at once; a
+// single writer thread (started on first use) formats queued events into large
+// buffers and writes them in batches. Events emitted together stay together.
+// In headless mode events are dropped without being formatted.
+class OutputSink {
+    public:
+        enum class Mode { Console, Headless };
+    
+    private:
+        static const size_t BUFFER_LIMIT = 64 * 1024;
+    
+        atomic<Mode> mode;
+        mutex lock;
+        condition_variable wake;    // writer: events queued or stopping
+        condition_variable drained; // flush(): queue written out
+        vector<LibraryEvent> pending;
+        bool writing;
+        bool stopping;
+        thread writer;
+        TimestampFormatter dates;   // writer thread only
+    
+        static bool toStderr(EventKind kind) {
+            return kind == EventKind::Failed || kind == EventKind::HoldRejected;
+        }
+    
+        void render(const LibraryEvent& event, string& out) {
+            switch (event.kind) {
+                case EventKind::Issued:
+                    out += "Book issued successfully!\n";
+                    appendTransactionRow(out, event.transaction, dates);
+                    break;
+                case EventKind::Returned:
+                    out += "Book returned successfully!\n";
+                    appendTransactionRow(out, event.transaction, dates);
+                    break;
+                case EventKind::Reserved:
+                    out += "Book is not available. Adding to reservation queue.\n";
+                    break;
+                case EventKind::HoldProcessing:
+                    out += "This book has a reservation. Processing...\n";
+                    break;
+                case EventKind::HoldRejected: {
+                    string reason = event.result.message();
+                    out += "Error: " + reason + "\n";
+                    out += "Could not process reservation: " + reason + "\n";
+                    break;
+                }
+                case EventKind::Failed:
+                    out += "Error: " + event.result.message() + "\n";
+                    break;
+                case EventKind::Notice:
+                    out += event.text;
+                    break;
+            }
+        }
+    
+        void writeBatch(const vector<LibraryEvent>& batch) {
+            string buffer;
+            bool bufferIsErr = false;
+            for (const LibraryEvent& event : batch) {
+                bool isErr = toStderr(event.kind);
+                if (!buffer.empty() && (isErr != bufferIsErr || buffer.size() >= BUFFER_LIMIT)) {
+                    (bufferIsErr ? cerr : cout).write(buffer.data(), buffer.size());
+                    buffer.clear();
+                }
+                bufferIsErr = isErr;
+                render(event, buffer);
+            }
+            if (!buffer.empty()) {
+                (bufferIsErr ? cerr : cout).write(buffer.data(), buffer.size());
+            }
+            cout.flush();
+        }
+    
+        void run() {
+            vector<LibraryEvent> batch;
+            unique_lock<mutex> guard(lock);
+            while (true) {
+                wake.wait(guard, [this] { return !pending.empty() || stopping; });
+                if (pending.empty()) {
+                    break; // stopping
+                }
+                batch.swap(pending);
+                writing = true;
+                guard.unlock();
+                writeBatch(batch);
+                batch.clear();
+                guard.lock();
+                writing = false;
+                if (pending.empty()) {
+                    drained.notify_all();
+                }
+            }
+        }
+    
+    public:
+        OutputSink() : mode(Mode::Console), writing(false), stopping(false) {}
+    
+        ~OutputSink() {
+            {
+                lock_guard<mutex> guard(lock);
+                stopping = true;
+            }
+            wake.notify_one();
+            if (writer.joinable()) {
+                writer.join();
+            }
+        }
+    
+        OutputSink(const OutputSink&) = delete;
+        OutputSink& operator=(const OutputSink&) = delete;
+    
+        void setMode(Mode m) { mode = m; }
+        Mode getMode() const { return mode; }
+    
+        void emit(vector<LibraryEvent>& events) {
+            if (events.empty() || mode == Mode::Headless) {
+                return;
+            }
+            {
+                lock_guard<mutex> guard(lock);
+                if (!writer.joinable()) {
+                    writer = thread(&OutputSink::run, this);
+                }
+                for (LibraryEvent& event : events) {
+                    pending.push_back(move(event));
+                }
+            }
+            events.clear();
+            wake.notify_one();
+        }
+    
+        void emit(LibraryEvent event) {
+            vector<LibraryEvent> events(1, move(event));
+            emit(events);
+        }
+    
+        // Wait until everything emitted so far has been written
+        void flush() {
+            unique_lock<mutex> guard(lock);
+            drained.wait(guard, [this] { return pending.empty() && !writing; });
+        }
+    };
+
+inline int highestBit(uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+    return 63 - __builtin_clzll(value);
+#else
+    int bit = 0;
+    while (value >>= 1) {
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+// Log-linear latency histogram in the style of HdrHistogram: values are
+// nanoseconds, split into eight linear sub-buckets per power of two, so every
+// reported value is within 12.5% of the recorded one. This is the merged,
+// read-side form; LibraryMetrics records into per-thread bucket arrays.
+class LatencyHistogram {
+    public:
+        static const int SUB_BITS = 3;
+        static const size_t SUB_BUCKETS = size_t(1) << SUB_BITS;
+        static const int MAX_BIT = 34; // about 17 s; slower calls share the last bucket
+        static const size_t BUCKETS = (MAX_BIT - SUB_BITS + 2) * SUB_BUCKETS;
+    
+        static size_t bucketOf(uint64_t ns) {
+            if (ns < SUB_BUCKETS) {
+                return static_cast<size_t>(ns);
+            }
+            int bit = highestBit(ns);
+            if (bit > MAX_BIT) {
+                return BUCKETS - 1;
+            }
+            return (bit - SUB_BITS + 1) * SUB_BUCKETS + static_cast<size_t>((ns >> (bit - SUB_BITS)) & (SUB_BUCKETS - 1));
+        }
+    
+        // Largest value that falls into a bucket
+        static uint64_t highestValueIn(size_t bucket) {
+            if (bucket < SUB_BUCKETS) {
+                return bucket;
+            }
+            int shift = static_cast<int>(bucket / SUB_BUCKETS) - 1;
+            uint64_t lowest = static_cast<uint64_t>(SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+            return lowest + (uint64_t(1) << shift) - 1;
+        }
+    
+    private:
+        vector<uint64_t> counts;
+        uint64_t samples;
+        uint64_t totalNs;
+    
+    public:
+        LatencyHistogram() : counts(BUCKETS, 0), samples(0), totalNs(0) {}
+    
+        void add(size_t bucket, uint64_t count) {
+            counts[bucket] += count;
+            samples += count;
+        }
+    
+        void addTotal(uint64_t ns) { totalNs += ns; }
+    
+        uint64_t getSamples() const { return samples; }
+        uint64_t getTotalNs() const { return totalNs; }
+    
+        // Value at quantile q (0..1), or 0 without samples
+        uint64_t percentile(double q) const {
+            if (samples == 0) {
+                return 0;
+            }
+            uint64_t rank = static_cast<uint64_t>(q * samples + 0.999999);
+            rank = min(max<uint64_t>(rank, 1), samples);
+            uint64_t seen = 0;
+            for (size_t bucket = 0; bucket < BUCKETS; ++bucket) {
+                seen += counts[bucket];
+                if (seen >= rank) {
+                    return highestValueIn(bucket);
+                }
+            }
+            return highestValueIn(BUCKETS - 1);
+        }
+    
+        uint64_t maxValue() const {
+            for (size_t bucket = BUCKETS; bucket > 0; --bucket) {
+                if (counts[bucket - 1] != 0) {
+                    return highestValueIn(bucket - 1);
+                }
+            }
+            return 0;
+        }
+    };
+
+// Instrumented hot paths; each has a call counter and a latency histogram
+enum class MetricOp : uint8_t { FindBook, FindMember, Issue, Return };
+
+// Counters and latency histograms for the public hot paths. Each thread records
+// into its own shard with plain load/store pairs instead of atomic
+// read-modify-write instructions. A thread gives its shard back when it exits
+// and the next new thread takes it over, counts included; while more than
+// SHARDS - 1 threads are recording, the rest share the last shard, which uses
+// fetch_add. read() merges all shards. Calls and
+// outcomes are always counted, but only every LATENCY_SAMPLE_PERIOD-th call of
+// an operation on a thread is timed: a clock read costs about as much as a
+// hash lookup, so timing every call would dominate the overhead.
+class LibraryMetrics {
+    public:
+        static const size_t OPS = 4;
+        static const size_t STATUSES = 7; // CirculationStatus values
+    
+        // Merged counters at the time of the read
+        struct Snapshot {
+            uint64_t calls[OPS];
+            uint64_t misses[OPS];             // lookups that found nothing
+            uint64_t outcomes[2][STATUSES];   // [CirculationOp][CirculationStatus], batch items included
+            uint64_t holdsServed;
+            uint64_t holdsRejected;
+            LatencyHistogram latency[OPS];    // sampled calls only
+    
+            Snapshot() : holdsServed(0), holdsRejected(0) {
+                fill(calls, calls + OPS, 0);
+                fill(misses, misses + OPS, 0);
+                fill(&outcomes[0][0], &outcomes[0][0] + 2 * STATUSES, 0);
+            }
+        };
+    
+        static const uint32_t LATENCY_SAMPLE_PERIOD = 64;
+    
+    private:
+        static const size_t SHARDS = 32;
+    
+        struct Shard {
+            atomic<uint64_t> calls[OPS];
+            atomic<uint64_t> misses[OPS];
+            atomic<uint64_t> outcomes[2][STATUSES];
+            atomic<uint64_t> holdsServed;
+            atomic<uint64_t> holdsRejected;
+            atomic<uint64_t> latencyNs[OPS];
+            atomic<uint64_t> latency[OPS][LatencyHistogram::BUCKETS];
+            char padding[64]; // keeps the next shard's counters off this cache line
+        };
+    
+        unique_ptr<Shard[]> shards;
+        atomic<bool> enabled;
+    
+        // Private shards not held by a running thread (process-wide, like the
+        // thread-local lease below)
+        class SlotPool {
+            private:
+                mutex lock;
+                vector<uint32_t> released;
+                uint32_t next;
+    
+            public:
+                SlotPool() : next(0) {}
+    
+                uint32_t claim() {
+                    lock_guard<mutex> guard(lock);
+                    if (!released.empty()) {
+                        uint32_t slot = released.back();
+                        released.pop_back();
+                        return slot;
+                    }
+                    return next < SHARDS - 1 ? next++ : static_cast<uint32_t>(SHARDS - 1);
+                }
+    
+                void release(uint32_t slot) {
+                    if (slot != SHARDS - 1) {
+                        lock_guard<mutex> guard(lock);
+                        released.push_back(slot);
+                    }
+                }
+            };
+    
+        static SlotPool& slotPool() {
+            static SlotPool pool;
+            return pool;
+        }
+    
+        // A thread's claim on a slot, returned to the pool when the thread exits
+        struct SlotLease {
+            uint32_t slot;
+            SlotLease() : slot(slotPool().claim()) {}
+            ~SlotLease() { slotPool().release(slot); }
+        };
+    
+        // Shard of the calling thread, claimed on its first record
+        static size_t threadSlot() {
+            static thread_local SlotLease lease;
+            return lease.slot;
+        }
+    
+        static void bump(atomic<uint64_t>& counter, size_t slot, uint64_t by = 1) {
+            if (slot == SHARDS - 1) {
+                counter.fetch_add(by, memory_order_relaxed);
+            } else {
+                counter.store(counter.load(memory_order_relaxed) + by, memory_order_relaxed);
+            }
+        }
+    
+        static bool sampleThisCall(MetricOp op) {
+            static thread_local uint32_t ticks[OPS];
+            return ticks[static_cast<size_t>(op)]++ % LATENCY_SAMPLE_PERIOD == 0;
+        }
+    
+    public:
+        LibraryMetrics() : shards(new Shard[SHARDS]()), enabled(true) {}
+    
+        void setEnabled(bool on) { enabled = on; }
+        bool isEnabled() const { return enabled.load(memory_order_relaxed); }
+    
+        // One call of an operation: counted on construction, timed until
+        // destruction if sampled. Misses and outcomes are recorded through the
+        // scope, which has already looked up the thread's shard.
+        class Scope {
+            private:
+                Shard* shard; // null while recording is off
+                size_t slot;
+                size_t index;
+                bool timed;
+                chrono::steady_clock::time_point started;
+    
+            public:
+                Scope(LibraryMetrics& metrics, MetricOp op)
+                    : shard(nullptr), slot(0), index(static_cast<size_t>(op)), timed(false) {
+                    if (!metrics.isEnabled()) {
+                        return;
+                    }
+                    slot = threadSlot();
+                    shard = &metrics.shards[slot];
+                    bump(shard->calls[index], slot);
+                    timed = sampleThisCall(op);
+                    if (timed) {
+                        started = chrono::steady_clock::now();
+                    }
+                }
+    
+                ~Scope() {
+                    if (timed) {
+                        uint64_t ns = static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(
+                                          chrono::steady_clock::now() - started).count());
+                        bump(shard->latency[index][LatencyHistogram::bucketOf(ns)], slot);
+                        bump(shard->latencyNs[index], slot, ns);
+                    }
+                }
+    
+                Scope(const Scope&) = delete;
+                Scope& operator=(const Scope&) = delete;
+    
+                // A lookup that found nothing
+                void miss() {
+                    if (shard) {
+                        bump(shard->misses[index], slot);
+                    }
+                }
+    
+                // Result of an issue or return scope
+                void outcome(CirculationStatus status) {
+                    if (shard) {
+                        size_t op = index - static_cast<size_t>(MetricOp::Issue);
+                        bump(shard->outcomes[op][static_cast<size_t>(status)], slot);
+                    }
+                }
+        };
+    
+        // Outcome of a batch item (batches are not timed per item)
+        void countOutcome(CirculationOp op, CirculationStatus status) {
+            if (isEnabled()) {
+                size_t slot = threadSlot();
+                bump(shards[slot].outcomes[static_cast<size_t>(op)][static_cast<size_t>(status)], slot);
+            }
+        }
+    
+        void countHold(bool served) {
+            if (isEnabled()) {
+                size_t slot = threadSlot();
+                bump(served ? shards[slot].holdsServed : shards[slot].holdsRejected, slot);
+            }
+        }
+    
+        Snapshot read() const {
+            Snapshot merged;
+            for (size_t s = 0; s < SHARDS; ++s) {
+                const Shard& shard = shards[s];
+                for (size_t op = 0; op < OPS; ++op) {
+                    merged.calls[op] += shard.calls[op].load(memory_order_relaxed);
+                    merged.misses[op] += shard.misses[op].load(memory_order_relaxed);
+                    merged.latency[op].addTotal(shard.latencyNs[op].load(memory_order_relaxed));
+                    for (size_t bucket = 0; bucket < LatencyHistogram::BUCKETS; ++bucket) {
+                        uint64_t count = shard.latency[op][bucket].load(memory_order_relaxed);
+                        if (count != 0) {
+                            merged.latency[op].add(bucket, count);
+                        }
+                    }
+                }
+                for (size_t op = 0; op < 2; ++op) {
+                    for (size_t status = 0; status < STATUSES; ++status) {
+                        merged.outcomes[op][status] += shard.outcomes[op][status].load(memory_order_relaxed);
+                    }
+                }
+                merged.holdsServed += shard.holdsServed.load(memory_order_relaxed);
+                merged.holdsRejected += shard.holdsRejected.load(memory_order_relaxed);
+            }
+            return merged;
+        }
+    
+        static const char* labelOf(MetricOp op) {
+            switch (op) {
+                case MetricOp::FindBook: return "find_book";
+                case MetricOp::FindMember: return "find_member";
+                case MetricOp::Issue: return "issue";
+                case MetricOp::Return: break;
+            }
+            return "return";
+        }
+    
+        static const char* labelOf(CirculationStatus status) {
+            switch (status) {
+                case CirculationStatus::Issued: return "issued";
+                case CirculationStatus::Returned: return "returned";
+                case CirculationStatus::Reserved: return "reserved";
+                case CirculationStatus::InvalidMember: return "invalid_member";
+                case CirculationStatus::BookNotFound: return "book_not_found";
+                case CirculationStatus::LimitReached: return "limit_reached";
+                case CirculationStatus::NoActiveLoan: break;
+            }
+            return "no_active_loan";
+        }
+    
+        // Whether an operation can end with a status (issues are never "returned")
+        static bool possibleOutcome(CirculationOp op, CirculationStatus status) {
+            switch (status) {
+                case CirculationStatus::Issued:
+                case CirculationStatus::Reserved:
+                case CirculationStatus::LimitReached:
+                    return op == CirculationOp::Issue;
+                case CirculationStatus::Returned:
+                case CirculationStatus::NoActiveLoan:
+                    return op == CirculationOp::Return;
+                default:
+                    return true;
+            }
+        }
+    };
+
+// Generations for copy-on-write read views. Opening a view freezes the current
+// generation and starts a new one; state that writers replace afterwards is
+// retired under the generation it was replaced in and freed once no open view
+// is older than that, i.e. epoch-based reclamation with one epoch per view.
+// Writers pin the generation they publish in (see Pin), so opening a view only
+// waits for writers still publishing in the generation it freezes, and
+// nothing a pinned writer may still hold is freed.
+class ViewEpochs {
+    private:
+        struct Retired {
+            uint64_t generation; // needed by views opened before this one
+            void* object;
+            void (*destroy)(void*);
+        };
+    
+        atomic<uint64_t> generation;
+        unique_ptr<atomic<uint64_t>[]> writers; // per slot: generation being published in, 0 if idle
+        size_t writerSlots;
+        mutex opening; // views are opened one at a time
+        mutex lock;
+        map<uint64_t, size_t> open; // generation -> views still open
+        vector<Retired> retired;
+    
+        // Oldest generation any writer is publishing in, UINT64_MAX if none
+        uint64_t oldestWriter() const {
+            uint64_t oldest = UINT64_MAX;
+            for (size_t i = 0; i < writerSlots; ++i) {
+                uint64_t pinned = writers[i].load();
+                if (pinned != 0 && pinned < oldest) {
+                    oldest = pinned;
+                }
+            }
+            return oldest;
+        }
+    
+    public:
+        explicit ViewEpochs(size_t slots) : generation(1), writers(new atomic<uint64_t>[slots]), writerSlots(slots) {
+            for (size_t i = 0; i < slots; ++i) {
+                writers[i].store(0, memory_order_relaxed);
+            }
+        }
+    
+        ~ViewEpochs() {
+            for (const Retired& entry : retired) {
+                entry.destroy(entry.object);
+            }
+        }
+    
+        ViewEpochs(const ViewEpochs&) = delete;
+        ViewEpochs& operator=(const ViewEpochs&) = delete;
+    
+        // Announces the generation a writer publishes in for as long as it is in
+        // scope. Each slot belongs to a lock the writer holds, so no two writers
+        // share one. The generation is re-read after announcing it: an opening
+        // view either sees the announcement and waits, or the writer sees the
+        // new generation and publishes in that instead.
+        class Pin {
+            private:
+                atomic<uint64_t>& slot;
+                uint64_t pinned;
+    
+            public:
+                Pin(ViewEpochs& epochs, size_t index)
+                    : slot(epochs.writers[index % epochs.writerSlots]), pinned(epochs.generation.load()) {
+                    for (;;) {
+                        slot.store(pinned);
+                        uint64_t now = epochs.generation.load();
+                        if (now == pinned) {
+                            break;
+                        }
+                        pinned = now;
+                    }
+                }
+    
+                ~Pin() { slot.store(0, memory_order_release); }
+    
+                Pin(const Pin&) = delete;
+                Pin& operator=(const Pin&) = delete;
+    
+                uint64_t generation() const { return pinned; }
+            };
+    
+        // Setup operations: state stamped with this generation is private to writers
+        uint64_t current() const { return generation.load(memory_order_acquire); }
+    
+        // Wait until no writer is still publishing in a generation before 'next'
+        void waitForWritersBefore(uint64_t next) const {
+            while (oldestWriter() < next) {
+                this_thread::yield();
+            }
+        }
+    
+        // Open a view of the state as it is now. Writers that pinned the frozen
+        // generation are let finish; later ones already publish in the next.
+        uint64_t openView() {
+            lock_guard<mutex> serial(opening);
+            uint64_t frozen;
+            {
+                lock_guard<mutex> guard(lock);
+                frozen = generation.load();
+                open[frozen]++;
+                generation.store(frozen + 1);
+            }
+            waitForWritersBefore(frozen + 1);
+            reclaim();
+            return frozen;
+        }
+    
+        void closeView(uint64_t frozen) {
+            {
+                lock_guard<mutex> guard(lock);
+                auto found = open.find(frozen);
+                if (found != open.end() && --found->second == 0) {
+                    open.erase(found);
+                }
+            }
+            reclaim();
+        }
+    
+        // Free everything no open view and no pinned writer can reach. A writer
+        // pinned in a generation up to the one an object was retired in may
+        // have loaded it before it was replaced.
+        void reclaim() {
+            vector<Retired> unreachable;
+            {
+                lock_guard<mutex> guard(lock);
+                uint64_t oldest = open.empty() ? generation.load() : open.begin()->first;
+                uint64_t writing = oldestWriter();
+                size_t kept = 0;
+                for (size_t i = 0; i < retired.size(); ++i) {
+                    if (retired[i].generation <= oldest && retired[i].generation < writing) {
+                        unreachable.push_back(retired[i]);
+                    } else {
+                        retired[kept++] = retired[i];
+                    }
+                }
+                retired.resize(kept);
+            }
+            for (const Retired& entry : unreachable) {
+                entry.destroy(entry.object);
+            }
+        }
+    
+        size_t retiredCount() {
+            lock_guard<mutex> guard(lock);
+            return retired.size();
+        }
+    
+        // Whether an open view may still see state stamped with 'stamped'
+        bool visibleToViews(uint64_t stamped) {
+            lock_guard<mutex> guard(lock);
+            return !open.empty() && open.rbegin()->first >= stamped;
+        }
+    
+        template<typename T>
+        void retire(T* object) {
+            lock_guard<mutex> guard(lock);
+            Retired entry = { generation.load(), object,
+                              [](void* p) { delete static_cast<T*>(p); } };
+            retired.push_back(entry);
+        }
+    };
+
+// Array of T in fixed-size pages behind a page table, with copy-on-write for
+// read views. A writer stores in place into pages stamped with the generation
+// it pinned; a page or table an open view may still see is copied first (once
+// writers of older generations are done with it) and the original retired to
+// the ViewEpochs. A view holds the newest table of its generation, and nothing
+// reachable from it changes afterwards, so it is read without locks.
+// Concurrent set() calls on different indexes are safe; reserve() is a setup
+// operation.
+template<typename T, size_t PAGE_BITS = 10>
+class VersionedArray {
+    private:
+        static const size_t PAGE = size_t(1) << PAGE_BITS;
+    
+        struct Page {
+            atomic<uint64_t> generation;
+            atomic<T> values[PAGE];
+            explicit Page(uint64_t g) : generation(g) {
+                for (auto& value : values) {
+                    value.store(T(), memory_order_relaxed);
+                }
+            }
+        };
+    
+        struct Table {
+            atomic<uint64_t> generation;
+            size_t pageCount;
+            unique_ptr<atomic<Page*>[]> pages;
+            const Table* older; // the table this one replaced; kept while a view of it is open
+            Table(uint64_t g, size_t count, const Table* o = nullptr)
+                : generation(g), pageCount(count), pages(new atomic<Page*>[count]), older(o) {}
+        };
+    
+        ViewEpochs& epochs;
+        atomic<Table*> live;
+        mutex copyLock; // slow path: copying a page or the table
+    
+        // The live page holding 'index', made private to the current generation
+        Page* privatePage(size_t index, uint64_t current) {
+            lock_guard<mutex> guard(copyLock);
+            Table* table = live.load(memory_order_acquire);
+            uint64_t tableGeneration = table->generation.load(memory_order_relaxed);
+            if (tableGeneration != current) {
+                if (epochs.visibleToViews(tableGeneration)) {
+                    Table* copy = new Table(current, table->pageCount, table);
+                    for (size_t i = 0; i < table->pageCount; ++i) {
+                        copy->pages[i].store(table->pages[i].load(memory_order_relaxed), memory_order_relaxed);
+                    }
+                    live.store(copy, memory_order_release);
+                    epochs.retire(table);
+                    table = copy;
+                } else {
+                    table->generation.store(current, memory_order_relaxed);
+                }
+            }
+            atomic<Page*>& slot = table->pages[index >> PAGE_BITS];
+            Page* page = slot.load(memory_order_acquire);
+            uint64_t pageGeneration = page->generation.load(memory_order_relaxed);
+            if (pageGeneration != current) {
+                if (epochs.visibleToViews(pageGeneration)) {
+                    Page* copy = new Page(current);
+                    for (size_t i = 0; i < PAGE; ++i) {
+                        copy->values[i].store(page->values[i].load(memory_order_relaxed), memory_order_relaxed);
+                    }
+                    slot.store(copy, memory_order_release);
+                    epochs.retire(page);
+                    page = copy;
+                } else {
+                    page->generation.store(current, memory_order_release);
+                }
+            }
+            return page;
+        }
+    
+    public:
+        explicit VersionedArray(ViewEpochs& e) : epochs(e), live(new Table(e.current(), 0)) {}
+    
+        ~VersionedArray() {
+            Table* table = live.load();
+            for (size_t i = 0; i < table->pageCount; ++i) {
+                delete table->pages[i].load();
+            }
+            delete table;
+        }
+    
+        VersionedArray(const VersionedArray&) = delete;
+        VersionedArray& operator=(const VersionedArray&) = delete;
+    
+        // Make room for indexes below 'count' (new entries are T()), doubling the
+        // page table as needed; must not overlap with set()
+        void reserve(size_t count) {
+            Table* table = live.load(memory_order_acquire);
+            size_t needed = (count + PAGE - 1) >> PAGE_BITS;
+            if (needed <= table->pageCount) {
+                return;
+            }
+            size_t pageCount = max<size_t>(table->pageCount * 2, 1);
+            while (pageCount < needed) {
+                pageCount *= 2;
+            }
+            uint64_t current = epochs.current();
+            Table* grown = new Table(current, pageCount, table);
+            for (size_t i = 0; i < pageCount; ++i) {
+                grown->pages[i].store(i < table->pageCount ? table->pages[i].load(memory_order_relaxed) : new Page(current),
+                                      memory_order_relaxed);
+            }
+            live.store(grown, memory_order_release);
+            epochs.retire(table);
+        }
+    
+        // Store under the generation the caller pinned (see ViewEpochs::Pin)
+        void set(size_t index, T value, uint64_t generation) {
+            Page* page = live.load(memory_order_acquire)->pages[index >> PAGE_BITS].load(memory_order_acquire);
+            if (page->generation.load(memory_order_acquire) != generation) {
+                epochs.waitForWritersBefore(generation);
+                page = privatePage(index, generation);
+            }
+            page->values[index & (PAGE - 1)].store(value, memory_order_relaxed);
+        }
+    
+        // The array as it is now; valid while the view's generation stays open
+        class View {
+            private:
+                const Table* table;
+    
+            public:
+                View() : table(nullptr) {}
+                explicit View(const Table* t) : table(t) {}
+    
+                T operator[](size_t index) const {
+                    return table->pages[index >> PAGE_BITS].load(memory_order_relaxed)
+                        ->values[index & (PAGE - 1)].load(memory_order_relaxed);
+                }
+            };
+    
+        // The array as of a view's generation, taken while that view is open.
+        // Writers of later generations replace tables rather than change them,
+        // so this is the newest table not stamped after 'generation'.
+        View view(uint64_t generation) const {
+            const Table* table = live.load(memory_order_acquire);
+            while (table->generation.load(memory_order_acquire) > generation) {
+                table = table->older;
+            }
+            return View(table);
+        }
+    };
+
+// Book objects by catalog ordinal. A book loaded from a snapshot has no object
+// until it is first used (see Library::bookAt), so the slots are atomic; like
+// the other catalog containers the table only grows during setup.
+class BookSlots {
+    private:
+        unique_ptr<atomic<Book*>[]> slots;
+        size_t count;
+        size_t capacity;
+    
+    public:
+        BookSlots() : count(0), capacity(0) {}
+    
+        void reserve(size_t needed) {
+            if (needed <= capacity) {
+                return;
+            }
+            unique_ptr<atomic<Book*>[]> grown(new atomic<Book*>[needed]);
+            for (size_t i = 0; i < needed; ++i) {
+                grown[i].store(i < count ? slots[i].load(memory_order_relaxed) : nullptr, memory_order_relaxed);
+            }
+            slots = move(grown);
+            capacity = needed;
+        }
+    
+        void push_back(Book* book) {
+            if (count == capacity) {
+                reserve(max<size_t>(16, capacity * 2));
+            }
+            slots[count++].store(book, memory_order_release);
+        }
+    
+        // Extend to 'newCount' slots; the new ones are empty
+        void resize(size_t newCount) {
+            reserve(newCount);
+            count = newCount;
+        }
+    
+        size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+        Book* get(size_t ordinal) const { return slots[ordinal].load(memory_order_acquire); }
+        void set(size_t ordinal, Book* book) { slots[ordinal].store(book, memory_order_release); }
+    };
+
+// Circulation (issueBook, returnBook, reservations and the reports) may be
+// called from many threads. Each book and member ID maps to one of
+// LOCK_STRIPES mutexes; an operation holds at most one book stripe and one
+// member stripe, always acquired in that order. Structural changes (adding
+// books or members, sorting, loading state) are setup operations and must not
+// run concurrently with circulation.
+class Library {
+    private:
+        static const size_t LOCK_STRIPES = 64;
+    
+        // Entity storage; the containers below hold non-owning pointers into it.
+        // Books loaded from a snapshot are created on first use, from const
+        // readers too (see bookAt), under materializeLock.
+        mutable ObjectPool<Book> bookPool;
+        mutable ObjectPool<EBook> ebookPool;
+        mutable ObjectPool<Journal> journalPool;
+        mutable mutex materializeLock;
+    
+        // Every book in registration order. Positions here ("ordinals") never
+        // change, so the ID index, the ID order, the search postings and the
+        // catalog columns all refer to books by ordinal. The columns hold every
+        // book's fields; after a snapshot load they are served from the mapped
+        // file, which also indexes the loaded IDs, and bookIndex only holds
+        // books added since.
+        mutable BookSlots catalog;
+        HashIndex<Symbol, uint32_t, SymbolHash> bookIndex; // bookId -> ordinal
+        CatalogColumns columns;
+    
+        // The ID order and the search postings are built on first use, not as
+        // books are registered, so a load or an import never pays for them up
+        // front; each read catches up on the books added since the last one
+        // (see orderedIds and searchPostings).
+        mutable OrderedIdIndex idOrder;
+        mutable CatalogSearchIndex searchIndex;
+        mutable atomic<size_t> idOrderedBooks;
+        mutable atomic<size_t> searchIndexedBooks;
+        mutable mutex lazyIndexLock;
+    
+        // Set by sortBooksByID: list books in ID order instead of registration order
+        bool listById;
+        MemberStore members;
+        vector<Librarian*> staff;
+    
+        // Every loan: open and recent ones live, earlier months sealed into
+        // compressed segments, spilled to files named after this prefix if set
+        TransactionHistory history;
+        string historySpillPrefix;
+    
+        // Open loans and hold queues are sharded by book stripe, so each shard is
+        // guarded by the matching book lock
+        HashIndex<Symbol, Transaction*, SymbolHash> activeLoans[LOCK_STRIPES]; // bookId -> open transaction
+    
+        // Lock-free ring of the latest issue/return events for the dashboard
+        RecentTransactionLog<1024> recentTransactions;
+    
+        // Per-title hold queues for book reservations
+        HashIndex<Symbol, HoldQueue, SymbolHash> bookReservations[LOCK_STRIPES]; // bookId -> waiting members
+    
+        // Lock order: book stripe, member stripe, then the leaf locks below
+        mutable mutex bookLocks[LOCK_STRIPES];
+        mutable mutex memberLocks[LOCK_STRIPES];
+        mutable mutex historyLock; // history
+    
+        // Open loans by due date for the overdue report; has its own leaf lock
+        DueDateIndex dueDates;
+    
+        static size_t stripeOf(Symbol id) { return id.getValue() % LOCK_STRIPES; }
+    
+        mutex& lockFor(const Book& book) const { return bookLocks[stripeOf(book.getBookSymbol())]; }
+        mutex& lockFor(const Member& member) const { return memberLocks[stripeOf(member.getMemberSymbol())]; }
+    
+        // Stop all circulation, e.g. to write a consistent snapshot
+        void lockAll() const {
+            for (auto& lock : bookLocks) lock.lock();
+            for (auto& lock : memberLocks) lock.lock();
+            historyLock.lock();
+        }
+    
+        void unlockAll() const {
+            historyLock.unlock();
+            for (auto& lock : memberLocks) lock.unlock();
+            for (auto& lock : bookLocks) lock.unlock();
+        }
+    
+        struct CirculationPause {
+            const Library& library;
+            explicit CirculationPause(const Library& l) : library(l) { library.lockAll(); }
+            ~CirculationPause() { library.unlockAll(); }
+        };
+    
+        template<typename T>
+        T& registerBook(T* book) {
+            uint32_t ordinal = static_cast<uint32_t>(catalog.size());
+            catalog.push_back(book);
+    
+            // Keep the first book registered under an ID, as the linear search did
+            if (columns.findMappedId(book->getBookId().data(), book->getBookId().size()) == CatalogColumns::NO_ROW) {
+                bookIndex.insert(book->getBookSymbol(), ordinal);
+            }
+            indexBook(ordinal);
+            return *book;
+        }
+    
+        // Add a catalog entry to the columns and the versioned loan state
+        void indexBook(uint32_t ordinal) {
+            const Book& book = *catalog.get(ordinal);
+            bookLoans.reserve(ordinal + 1);
+            uint32_t row = columns.append(book.getBookId(), book.getTitle(), book.getAuthor(), book.getCategory(),
+                                          book.getAvailability(), book.getKind());
+            switch (book.getKind()) {
+                case BookKind::EBook: {
+                    const EBook& ebook = static_cast<const EBook&>(book);
+                    columns.appendEBook(row, ebook.getFormat(), ebook.getFileSize());
+                    break;
+                }
+                case BookKind::Journal: {
+                    const Journal& journal = static_cast<const Journal&>(book);
+                    columns.appendJournal(row, journal.getVolume(), journal.getIssue(), journal.getPublishDate());
+                    break;
+                }
+                case BookKind::Book:
+                    break;
+            }
+        }
+    
+        // The book at an ordinal, created from the catalog columns the first
+        // time a book loaded from a snapshot is used
+        Book* bookAt(uint32_t ordinal) const {
+            Book* book = catalog.get(ordinal);
+            return book ? book : materializeBook(ordinal);
+        }
+    
+        Book* materializeBook(uint32_t ordinal) const {
+            lock_guard<mutex> guard(materializeLock);
+            Book* book = catalog.get(ordinal);
+            if (book) {
+                return book;
+            }
+            string id = columns.getIds().str(ordinal);
+            string title = columns.getTitles().str(ordinal);
+            string author = columns.getAuthors().str(ordinal);
+            const string& category = columns.getCategoryNames()[columns.categoryOf(ordinal)];
+            switch (columns.kindOf(ordinal)) {
+                case BookKind::EBook:
+                    book = ebookPool.create(id, title, author, category, columns.formatOf(ordinal),
+                                            columns.fileSizeOf(ordinal));
+                    break;
+                case BookKind::Journal:
+                    book = journalPool.create(id, title, author, category, columns.volumeOf(ordinal),
+                                              columns.issueOf(ordinal), columns.publishDateOf(ordinal));
+                    break;
+                case BookKind::Book:
+                    book = bookPool.create(id, title, author, category);
+                    break;
+            }
+            book->setAvailability(columns.isAvailable(ordinal));
+            catalog.set(ordinal, book);
+            return book;
+        }
+    
+        // Ordinal of the first book registered under an ID, or NO_BOOK
+        static const uint32_t NO_BOOK = CatalogColumns::NO_ROW;
+    
+        uint32_t ordinalOf(Symbol bookId) const {
+            if (columns.getMappedRows() != 0) {
+                const string& id = bookId.str();
+                uint32_t row = columns.findMappedId(id.data(), id.size());
+                if (row != CatalogColumns::NO_ROW) {
+                    return row;
+                }
+            }
+            const uint32_t* ordinal = bookIndex.find(bookId);
+            return ordinal ? *ordinal : NO_BOOK;
+        }
+    
+        uint32_t ordinalOf(const string& bookId) const {
+            uint32_t row = columns.findMappedId(bookId.data(), bookId.size());
+            if (row != CatalogColumns::NO_ROW) {
+                return row;
+            }
+            Symbol symbol = symbols().find(bookId);
+            const uint32_t* ordinal = symbol.isValid() ? bookIndex.find(symbol) : nullptr;
+            return ordinal ? *ordinal : NO_BOOK;
+        }
+    
+        const OrderedIdIndex& orderedIds() const {
+            if (idOrderedBooks.load(memory_order_acquire) != catalog.size()) {
+                lock_guard<mutex> guard(lazyIndexLock);
+                size_t ordinal = idOrderedBooks.load(memory_order_relaxed);
+                if (ordinal == 0) {
+                    idOrder.reserve(catalog.size());
+                }
+                const StringColumn& ids = columns.getIds();
+                for (; ordinal < catalog.size(); ++ordinal) {
+                    idOrder.add(ids.data(ordinal), ids.length(ordinal));
+                }
+                idOrderedBooks.store(ordinal, memory_order_release);
+            }
+            return idOrder;
+        }
+    
+        const CatalogSearchIndex& searchPostings() const {
+            if (searchIndexedBooks.load(memory_order_acquire) != catalog.size()) {
+                lock_guard<mutex> guard(lazyIndexLock);
+                size_t ordinal = searchIndexedBooks.load(memory_order_relaxed);
+                const StringColumn& titles = columns.getTitles();
+                const StringColumn& authors = columns.getAuthors();
+                for (; ordinal < catalog.size(); ++ordinal) {
+                    uint32_t at = static_cast<uint32_t>(ordinal);
+                    const string& category = columns.getCategoryNames()[columns.categoryOf(at)];
+                    searchIndex.add(at, titles.data(at), titles.length(at));
+                    searchIndex.add(at, authors.data(at), authors.length(at));
+                    searchIndex.add(at, category.data(), category.size());
+                }
+                searchIndexedBooks.store(ordinal, memory_order_release);
+            }
+            return searchIndex;
+        }
+    
+        // Bulk import rows. Books: id,title,author,category, optionally followed by
+        // "ebook",format,sizeMB or "journal",volume,issue,publishDate.
+        // Members: id,name,contact, optionally maxBooks.
+        struct BookRow {
+            BookKind kind;
+            string id, title, author, category, format, publishDate;
+            int first, second; // EBook: size in MB; Journal: volume and issue
+        };
+    
+        struct MemberRow {
+            string id, name, contact;
+            int maxBooks;
+        };
+    
+        static bool parseBookRow(const vector<string>& fields, BookRow& row, string& error) {
+            if (fields.size() < 4 || fields[0].empty() || fields[1].empty()) {
+                error = "expected at least id, title, author and category";
+                return false;
+            }
+            row.kind = BookKind::Book;
+            row.id = fields[0];
+            row.title = fields[1];
+            row.author = fields[2];
+            row.category = fields[3];
+            row.first = row.second = 0;
+            if (fields.size() == 4 || (fields.size() == 5 && fields[4].empty())) {
+                return true;
+            }
+            if (fields[4] == "ebook" && fields.size() == 7) {
+                row.kind = BookKind::EBook;
+                row.format = fields[5];
+                if (DelimitedParser::parseInt(fields[6], row.first)) {
+                    return true;
+                }
+                error = "invalid e-book file size '" + fields[6] + "'";
+                return false;
+            }
+            if (fields[4] == "journal" && fields.size() == 8) {
+                row.kind = BookKind::Journal;
+                row.publishDate = fields[7];
+                if (DelimitedParser::parseInt(fields[5], row.first) && DelimitedParser::parseInt(fields[6], row.second)) {
+                    return true;
+                }
+                error = "invalid journal volume or issue";
+                return false;
+            }
+            error = "unknown material type '" + fields[4] + "' or wrong column count";
+            return false;
+        }
+    
+        static bool parseMemberRow(const vector<string>& fields, MemberRow& row, string& error) {
+            if (fields.size() < 3 || fields.size() > 4 || fields[0].empty() || fields[1].empty()) {
+                error = "expected id, name, contact and an optional book limit";
+                return false;
+            }
+            row.id = fields[0];
+            row.name = fields[1];
+            row.contact = fields[2];
+            row.maxBooks = 3;
+            if (fields.size() == 4 && !fields[3].empty()
+                && (!DelimitedParser::parseInt(fields[3], row.maxBooks) || row.maxBooks == 0)) {
+                error = "invalid book limit '" + fields[3] + "'";
+                return false;
+            }
+            return true;
+        }
+    
+        static const size_t IMPORT_ERRORS_SHOWN = 10;
+    
+        // Add a parsed window's row counts to the report, keeping only the
+        // first few rejected rows for printing
+        template<typename Record>
+        static void countImportWindow(ImportReport& report, vector<DelimitedParser::Error>& errors,
+                                      const DelimitedParser::Result<Record>& parsed) {
+            report.rows += parsed.rows;
+            report.invalid += parsed.errors.size();
+            for (size_t i = 0; i < parsed.errors.size() && errors.size() < IMPORT_ERRORS_SHOWN; ++i) {
+                errors.push_back(parsed.errors[i]);
+            }
+        }
+    
+        // Print the import summary and the first few rejected rows
+        static void printImportReport(const string& what, const ImportReport& report,
+                                      const vector<DelimitedParser::Error>& errors) {
+            for (const DelimitedParser::Error& error : errors) {
+                cerr << "Line " << error.line << ": " << error.message << "\n";
+            }
+            if (report.invalid > errors.size()) {
+                cerr << "... and " << report.invalid - errors.size() << " more invalid row(s).\n";
+            }
+            double rate = report.seconds > 0 ? report.rows / report.seconds : 0.0;
+            cout << "Imported " << report.imported << " of " << report.rows << " " << what << " row(s) ("
+                 << report.duplicates << " duplicate, " << report.invalid << " invalid) in "
+                 << report.seconds << " s, " << static_cast<size_t>(rate) << " rows/s.\n";
+        }
+    
+        // Update a book and its availability bit together; the book's stripe lock is held
+        void setAvailability(uint32_t ordinal, bool available) {
+            bookAt(ordinal)->setAvailability(available);
+            columns.setAvailable(ordinal, available);
+        }
+    
+        // Record who holds a book (number 0: back on the shelf) and the member's
+        // loan count in the versioned state read views see; the book's and the
+        // member's stripe locks are held, and the book's stripe is the writer's
+        // pin slot, so a view sees both stores or neither
+        void publishLoan(uint32_t ordinal, MemberStore::Handle handle, uint32_t number) {
+            ViewEpochs::Pin pin(viewEpochs, stripeOf(bookAt(ordinal)->getBookSymbol()));
+            bookLoans.set(ordinal, number == 0 ? 0 : uint64_t(number) << 32 | (uint64_t(handle) + 1), pin.generation());
+            memberLoanCounts.set(handle, static_cast<uint32_t>(members.get(handle).getIssuedBooksCount()), pin.generation());
+        }
+    
+        // Refill the versioned state from the open loans, after loading
+        void rebuildVersionedState() {
+            bookLoans.reserve(catalog.size());
+            memberLoanCounts.reserve(members.size());
+            ViewEpochs::Pin pin(viewEpochs, 0);
+            uint64_t generation = pin.generation();
+            for (MemberStore::Handle handle = 0; handle < members.size(); ++handle) {
+                memberLoanCounts.set(handle, static_cast<uint32_t>(members.get(handle).getIssuedBooksCount()), generation);
+            }
+            for (auto& shard : activeLoans) {
+                shard.forEach([this, generation](Symbol bookId, Transaction* loan) {
+                    uint32_t ordinal = ordinalOf(bookId);
+                    const MemberStore::Handle* handle = members.findHandle(loan->getMemberSymbol());
+                    if (ordinal != NO_BOOK && handle) {
+                        bookLoans.set(ordinal, uint64_t(loan->getTransactionNumber()) << 32 | (uint64_t(*handle) + 1),
+                                      generation);
+                    }
+                });
+            }
+        }
+    
+        atomic<uint32_t> lastTransactionId;
+    
+        // Durability: changes are journaled; the snapshot remembers the last LSN it covers
+        TransactionJournal journal;
+        uint64_t appliedLsn;
+    
+        // Receipts and errors from circulation are rendered by a writer thread
+        OutputSink output;
+    
+        // Hot-path counters and latency histograms (see displayMetrics)
+        LibraryMetrics metrics;
+    
+        // Circulation state as read views see it, copied on write while views
+        // are open (see openReadView): per book ordinal, the open loan's
+        // transaction number << 32 | borrower handle + 1, or 0 on the shelf;
+        // per member handle, the number of books on loan
+        mutable ViewEpochs viewEpochs;
+        VersionedArray<uint64_t> bookLoans;
+        VersionedArray<uint32_t> memberLoanCounts;
+    
+        // Circulation analytics: worker threads started on first use, and the
+        // category of every book symbol, rebuilt when books have been added and
+        // extended as symbols are interned.
+        // analyticsLock lets one analysis run at a time.
+        mutable mutex analyticsLock;
+        mutable unique_ptr<WorkerPool> analyticsPool;
+        size_t analyticsThreads; // 0: one per hardware thread
+        mutable vector<uint32_t> categoryBySymbol;
+        mutable size_t categorizedBooks;
+    
+        // Uninstrumented lookups for internal callers; the public findBook and
+        // findMember wrap them
+        Book* lookupBook(const std::string& bookId) {
+            uint32_t ordinal = ordinalOf(bookId);
+            return ordinal == NO_BOOK ? nullptr : bookAt(ordinal);
+        }
+    
+        const MemberStore::Handle* lookupMember(const std::string& memberId) const {
+            Symbol symbol = symbols().find(memberId);
+            return symbol.isValid() ? members.findHandle(symbol) : nullptr;
+        }
+    
+        // Append a change to the journal while its locks are held, so records for
+        // the same book or member are logged in the order they were applied.
+        // Returns the LSN to wait for (0 without a journal).
+        uint64_t logChange(JournalOp op, time_t timestamp, uint32_t transactionNumber,
+                           Symbol memberId, Symbol bookId) {
+            if (!journal.isOpen()) {
+                return 0;
+            }
+            return journal.append(op, timestamp, transactionNumber, memberId.str(), bookId.str());
+        }
+    
+        // Wait for a logged change to reach disk; called after releasing locks so
+        // concurrent operations share a group commit
+        void waitDurable(uint64_t lsn) {
+            if (lsn != 0) {
+                journal.commit(lsn);
+            }
+        }
+    
+        // State transitions shared by the live operations and journal replay.
+        // Callers hold the book's and the member's stripe locks.
+        Transaction* recordIssue(MemberStore::Handle handle, Book& book, time_t issued, uint32_t number) {
+            Member& member = members.get(handle);
+            Symbol bookSymbol = book.getBookSymbol();
+            uint32_t ordinal = ordinalOf(bookSymbol);
+            member.issueBook(bookSymbol);
+            setAvailability(ordinal, false);
+            publishLoan(ordinal, handle, number);
+    
+            uint32_t seen = lastTransactionId.load();
+            while (number > seen && !lastTransactionId.compare_exchange_weak(seen, number)) {}
+    
+            Transaction* transaction;
+            {
+                lock_guard<mutex> guard(historyLock);
+                transaction = history.create(number, member.getMemberSymbol(), bookSymbol,
+                                             issued, 0, 0.0, false, book.getKind());
+            }
+            activeLoans[stripeOf(bookSymbol)].insert(bookSymbol, transaction);
+            dueDates.add(*transaction);
+    
+            // Add to recent transactions
+            recentTransactions.push(*transaction);
+            return transaction;
+        }
+    
+        void recordReturn(MemberStore::Handle handle, Book& book, Transaction* transaction, time_t returned) {
+            Member& member = members.get(handle);
+            uint32_t ordinal = ordinalOf(book.getBookSymbol());
+            member.returnBook(book.getBookSymbol());
+            setAvailability(ordinal, true);
+            publishLoan(ordinal, handle, 0);
+            transaction->returnBook(returned);
+            activeLoans[stripeOf(book.getBookSymbol())].erase(book.getBookSymbol());
+            dueDates.remove(*transaction);
+    
+            // Add to recent transactions
+            recentTransactions.push(*transaction);
+        }
+    
+        // Callers hold the book's stripe lock
+        void recordHold(Symbol bookId, MemberStore::Handle member) {
+            HashIndex<Symbol, HoldQueue, SymbolHash>& shard = bookReservations[stripeOf(bookId)];
+            HoldQueue* holds = shard.find(bookId);
+            if (!holds) {
+                shard.insert(bookId, HoldQueue());
+                holds = shard.find(bookId);
+            }
+            holds->push(member);
+        }
+    
+        // Remove and return the first holder of a title (the queue must not be empty)
+        MemberStore::Handle takeHold(Symbol bookId) {
+            HashIndex<Symbol, HoldQueue, SymbolHash>& shard = bookReservations[stripeOf(bookId)];
+            HoldQueue* holds = shard.find(bookId);
+            MemberStore::Handle member = holds->pop();
+            if (holds->empty()) {
+                shard.erase(bookId);
+            }
+            return member;
+        }
+    
+        bool hasHolds(Symbol bookId) const {
+            return bookReservations[stripeOf(bookId)].find(bookId) != nullptr;
+        }
+    
+        // Number of titles with a hold queue and of members waiting in them
+        void countReservations(size_t& queues, size_t& waiting) const {
+            queues = waiting = 0;
+            for (size_t stripe = 0; stripe < LOCK_STRIPES; ++stripe) {
+                lock_guard<mutex> guard(bookLocks[stripe]);
+                bookReservations[stripe].forEach([&queues, &waiting](Symbol, const HoldQueue& queue) {
+                    queues++;
+                    waiting += queue.size();
+                });
+            }
+        }
+    
+        // Prometheus text exposition of the metrics and the catalog gauges
+        void writePrometheus(ostream& out) const {
+            static const char* const CIRCULATION_OPS[] = { "issue", "return" };
+            LibraryMetrics::Snapshot snapshot = metrics.read();
+    
+            out << "# HELP smartlib_calls_total Calls of the instrumented operations.\n"
+                << "# TYPE smartlib_calls_total counter\n";
+            for (size_t op = 0; op < LibraryMetrics::OPS; ++op) {
+                out << "smartlib_calls_total{op=\"" << LibraryMetrics::labelOf(static_cast<MetricOp>(op)) << "\"} "
+                    << snapshot.calls[op] << "\n";
+            }
+            out << "# HELP smartlib_lookup_misses_total Lookups by ID that found nothing.\n"
+                << "# TYPE smartlib_lookup_misses_total counter\n";
+            for (MetricOp op : { MetricOp::FindBook, MetricOp::FindMember }) {
+                out << "smartlib_lookup_misses_total{op=\"" << LibraryMetrics::labelOf(op) << "\"} "
+                    << snapshot.misses[static_cast<size_t>(op)] << "\n";
+            }
+            out << "# HELP smartlib_circulation_total Issue and return outcomes, batch items included.\n"
+                << "# TYPE smartlib_circulation_total counter\n";
+            for (size_t op = 0; op < 2; ++op) {
+                for (size_t status = 0; status < LibraryMetrics::STATUSES; ++status) {
+                    if (LibraryMetrics::possibleOutcome(static_cast<CirculationOp>(op), static_cast<CirculationStatus>(status))) {
+                        out << "smartlib_circulation_total{op=\"" << CIRCULATION_OPS[op] << "\",status=\""
+                            << LibraryMetrics::labelOf(static_cast<CirculationStatus>(status)) << "\"} "
+                            << snapshot.outcomes[op][status] << "\n";
+                    }
+                }
+            }
+            out << "# HELP smartlib_holds_total Reservations handed to a holder (served) or dropped (rejected).\n"
+                << "# TYPE smartlib_holds_total counter\n"
+                << "smartlib_holds_total{result=\"served\"} " << snapshot.holdsServed << "\n"
+                << "smartlib_holds_total{result=\"rejected\"} " << snapshot.holdsRejected << "\n";
+    
+            out << "# HELP smartlib_latency_seconds Latency of sampled calls (every "
+                << LibraryMetrics::LATENCY_SAMPLE_PERIOD << "th per thread).\n"
+                << "# TYPE smartlib_latency_seconds summary\n";
+            for (size_t op = 0; op < LibraryMetrics::OPS; ++op) {
+                const char* label = LibraryMetrics::labelOf(static_cast<MetricOp>(op));
+                const LatencyHistogram& latency = snapshot.latency[op];
+                for (double q : { 0.5, 0.9, 0.99, 0.999 }) {
+                    out << "smartlib_latency_seconds{op=\"" << label << "\",quantile=\"" << q << "\"} "
+                        << latency.percentile(q) / 1e9 << "\n";
+                }
+                out << "smartlib_latency_seconds_sum{op=\"" << label << "\"} " << latency.getTotalNs() / 1e9 << "\n"
+                    << "smartlib_latency_seconds_count{op=\"" << label << "\"} " << latency.getSamples() << "\n";
+            }
+    
+            size_t queues, waiting;
+            countReservations(queues, waiting);
+            out << "# HELP smartlib_books Books in the catalog.\n# TYPE smartlib_books gauge\n"
+                << "smartlib_books " << columns.size() << "\n"
+                << "# HELP smartlib_books_on_loan Books currently issued.\n# TYPE smartlib_books_on_loan gauge\n"
+                << "smartlib_books_on_loan " << columns.size() - columns.countAvailable() << "\n"
+                << "# HELP smartlib_members Registered members.\n# TYPE smartlib_members gauge\n"
+                << "smartlib_members " << members.size() << "\n"
+                << "# HELP smartlib_reservation_queues Titles with members waiting.\n# TYPE smartlib_reservation_queues gauge\n"
+                << "smartlib_reservation_queues " << queues << "\n"
+                << "# HELP smartlib_reservations_waiting Members waiting in hold queues.\n"
+                << "# TYPE smartlib_reservations_waiting gauge\n"
+                << "smartlib_reservations_waiting " << waiting << "\n";
+    
+            lock_guard<mutex> guard(historyLock);
+            out << "# HELP smartlib_history_loans Loans in the history, live or sealed into monthly segments.\n"
+                << "# TYPE smartlib_history_loans gauge\n"
+                << "smartlib_history_loans{state=\"live\"} " << history.getLive().size() << "\n"
+                << "smartlib_history_loans{state=\"sealed\"} " << history.sealedLoans() << "\n"
+                << "# HELP smartlib_history_sealed_bytes Memory held by sealed history segments.\n"
+                << "# TYPE smartlib_history_sealed_bytes gauge\n"
+                << "smartlib_history_sealed_bytes " << history.sealedMemoryBytes() << "\n";
+        }
+    
+        void replay(const TransactionJournal::Record& record) {
+            Symbol memberId = symbols().intern(record.memberId);
+            Symbol bookId = symbols().intern(record.bookId);
+            const MemberStore::Handle* handle = members.findHandle(memberId);
+            Book* book = findBook(bookId);
+            if (record.op != JournalOp::ReserveServed && (!handle || !book)) {
+                throw LibraryException("Journal record " + to_string(record.lsn) + " refers to an unknown member or book.");
+            }
+            switch (record.op) {
+                case JournalOp::Issue:
+                    recordIssue(*handle, *book, static_cast<time_t>(record.timestamp),
+                                record.transactionNumber);
+                    break;
+                case JournalOp::Return: {
+                    Transaction** loan = activeLoans[stripeOf(bookId)].find(bookId);
+                    if (!loan) {
+                        throw LibraryException("Journal record " + to_string(record.lsn) + " returns a book that is not on loan.");
+                    }
+                    recordReturn(*handle, *book, *loan, static_cast<time_t>(record.timestamp));
+                    break;
+                }
+                case JournalOp::Reserve:
+                    recordHold(bookId, *handle);
+                    break;
+                case JournalOp::ReserveServed:
+                    if (hasHolds(bookId)) {
+                        takeHold(bookId);
+                    }
+                    break;
+            }
+            appliedLsn = record.lsn;
+        }
+    
+        // Issue or return with the IDs already resolved. Take the stripe locks,
+        // apply and journal the change, and report the LSN to wait for. Receipt
+        // events are appended to 'events' if given; nothing is printed here.
+        CirculationResult applyIssue(MemberStore::Handle handle, Book& book, vector<LibraryEvent>* events, uint64_t& lsn) {
+            Member& member = members.get(handle);
+            Symbol bookSymbol = book.getBookSymbol();
+            lock_guard<mutex> bookGuard(lockFor(book));
+            lock_guard<mutex> memberGuard(lockFor(member));
+    
+            // Check if book is available
+            if (!book.getAvailability()) {
+                recordHold(bookSymbol, handle);
+                lsn = logChange(JournalOp::Reserve, time(nullptr), 0, member.getMemberSymbol(), bookSymbol);
+                if (events) {
+                    events->push_back(LibraryEvent::of(EventKind::Reserved));
+                }
+                return CirculationResult::success(CirculationStatus::Reserved);
+            }
+            if (member.atIssueLimit()) {
+                return CirculationResult::failure(CirculationStatus::LimitReached, member.getMemberId());
+            }
+    
+            // Issue book and create transaction
+            Transaction* transaction = recordIssue(handle, book, time(nullptr), generateTransactionId());
+            lsn = logChange(JournalOp::Issue, transaction->getIssueDate(), transaction->getTransactionNumber(),
+                            member.getMemberSymbol(), bookSymbol);
+            if (events) {
+                events->push_back(LibraryEvent::receipt(EventKind::Issued, *transaction));
+            }
+            return CirculationResult::success(CirculationStatus::Issued, transaction->getTransactionNumber());
+        }
+    
+        // Reservations the return makes servable are handed out before the book
+        // lock is released; their events always go to holdEvents
+        CirculationResult applyReturn(MemberStore::Handle handle, Book& book, vector<LibraryEvent>* events,
+                                      vector<LibraryEvent>& holdEvents, uint64_t& lsn) {
+            Member& member = members.get(handle);
+            Symbol bookSymbol = book.getBookSymbol();
+            lock_guard<mutex> bookGuard(lockFor(book));
+            CirculationResult result = CirculationResult::failure(CirculationStatus::NoActiveLoan);
+            {
+                lock_guard<mutex> memberGuard(lockFor(member));
+    
+                // Find the open loan; a copy has at most one borrower at a time
+                Transaction** loan = activeLoans[stripeOf(bookSymbol)].find(bookSymbol);
+                if (!loan || (*loan)->getMemberSymbol() != member.getMemberSymbol()) {
+                    return result;
+                }
+                Transaction* transaction = *loan;
+    
+                // Process return
+                recordReturn(handle, book, transaction, time(nullptr));
+                lsn = logChange(JournalOp::Return, transaction->getReturnDate(), transaction->getTransactionNumber(),
+                                member.getMemberSymbol(), bookSymbol);
+                result = CirculationResult::success(CirculationStatus::Returned, transaction->getTransactionNumber());
+                if (events) {
+                    events->push_back(LibraryEvent::receipt(EventKind::Returned, *transaction));
+                }
+            }
+    
+            // Check for reservations while the book is still locked
+            serveHoldsLocked(book, holdEvents, lsn);
+            return result;
+        }
+    
+        // Hand a just-available book to the first holder who can take it. Holders
+        // that cannot be served (e.g. at their issue limit) are dropped. The caller
+        // holds the book's stripe lock and no member lock; events are collected so
+        // they can be emitted once the changes are durable.
+        bool serveHoldsLocked(Book& book, vector<LibraryEvent>& events, uint64_t& lsn) {
+            Symbol bookId = book.getBookSymbol();
+            while (book.getAvailability() && hasHolds(bookId)) {
+                MemberStore::Handle holderHandle = takeHold(bookId);
+                Member& holder = members.get(holderHandle);
+                lsn = logChange(JournalOp::ReserveServed, time(nullptr), 0, holder.getMemberSymbol(), bookId);
+                events.push_back(LibraryEvent::of(EventKind::HoldProcessing));
+    
+                lock_guard<mutex> memberGuard(lockFor(holder));
+                bool canTake = !holder.atIssueLimit();
+                metrics.countHold(canTake);
+                if (!canTake) {
+                    events.push_back(LibraryEvent::failure(EventKind::HoldRejected,
+                        CirculationResult::failure(CirculationStatus::LimitReached, holder.getMemberId())));
+                    continue;
+                }
+                Transaction* transaction = recordIssue(holderHandle, book, time(nullptr), generateTransactionId());
+                lsn = logChange(JournalOp::Issue, transaction->getIssueDate(), transaction->getTransactionNumber(),
+                                holder.getMemberSymbol(), bookId);
+                events.push_back(LibraryEvent::receipt(EventKind::Issued, *transaction));
+                return true;
+            }
+            return false;
+        }
+    
+        // Generate unique transaction number (displayed as "T<number>")
+        uint32_t generateTransactionId() {
+            return lastTransactionId.fetch_add(1) + 1;
+        }
+    
+        static const uint32_t SNAPSHOT_MAGIC = 0x534D4C53; // "SLMS"
+        static const uint32_t SNAPSHOT_VERSION = 4; // v2 adds the journal LSN, v3 sealed history, v4 catalog columns
+    
+        // Visit the ordinals of the books in listing order (see sortBooksByID)
+        template<typename F>
+        void forEachListed(F f) const {
+            if (!listById) {
+                for (uint32_t ordinal = 0; ordinal < catalog.size(); ++ordinal) {
+                    f(ordinal);
+                }
+                return;
+            }
+            for (uint32_t ordinal : orderedIds().inOrder()) {
+                f(ordinal);
+            }
+        }
+    
+        // Seal loans returned before the month of 'before' and spill the sealed
+        // segments if a spill prefix is set; the caller has paused circulation
+        size_t sealClosedLoans(time_t before) {
+            size_t sealedCount = history.seal(before);
+            if (!historySpillPrefix.empty()) {
+                history.spill(historySpillPrefix);
+            }
+            return sealedCount;
+        }
+    
+        // Collect one member's or one book's loans, oldest first. The caller
+        // holds that member's or book's stripe lock, which guards the live loans
+        // it can see; sealed segments are immutable and decoded after the
+        // history lock is released.
+        vector<Transaction> collectHistory(Symbol id,
+                                           void (TransactionHistory::*collectLive)(Symbol, vector<Transaction>&) const,
+                                           void (HistorySegment::*collectSealed)(Symbol, vector<Transaction>&) const) const {
+            vector<Transaction> found;
+            vector<shared_ptr<const HistorySegment>> segments;
+            {
+                lock_guard<mutex> guard(historyLock);
+                (history.*collectLive)(id, found);
+                segments = history.getSealed();
+            }
+            for (const auto& segment : segments) {
+                ((*segment).*collectSealed)(id, found);
+            }
+            sort(found.begin(), found.end(), [](const Transaction& a, const Transaction& b) {
+                return a.getTransactionNumber() < b.getTransactionNumber();
+            });
+            return found;
+        }
+    
+        static void displayHistory(const string& heading, const vector<Transaction>& loans) {
+            cout << "\n===== " << heading << " (" << loans.size() << ") =====\n";
+            if (loans.empty()) {
+                cout << "No loans recorded.\n";
+                return;
+            }
+            cout << "| Txn\t| Member\t| Book ID\t| Issued\t| Returned\t| Fine\t|\n";
+            TimestampFormatter dates;
+            string rows;
+            for (const Transaction& loan : loans) {
+                appendTransactionRow(rows, loan, dates);
+            }
+            cout << rows;
+        }
+    
+        // Encode the full state; the caller has paused circulation. Books are
+        // written in listing order, which becomes the registration order on load.
+        void writeSnapshot(const string& path) const {
+            SnapshotWriter out;
+            out.putU32(SNAPSHOT_MAGIC);
+            out.putU32(SNAPSHOT_VERSION);
+            out.putU64(journal.isOpen() ? journal.lastLsn() : appliedLsn);
+            out.putU32(lastTransactionId.load());
+    
+            vector<uint32_t> order;
+            order.reserve(catalog.size());
+            forEachListed([&order](uint32_t ordinal) { order.push_back(ordinal); });
+            columns.write(out, order);
+    
+            out.putU32(static_cast<uint32_t>(members.size()));
+            for (const auto& member : members) {
+                out.putString(member.getMemberId());
+                out.putString(member.getName());
+                out.putString(member.getContactInfo());
+                out.putU32(static_cast<uint32_t>(member.getMaxBooksAllowed()));
+                out.putU32(static_cast<uint32_t>(member.getIssuedBooks().size()));
+                for (Symbol bookId : member.getIssuedBooks()) {
+                    out.putString(bookId.str());
+                }
+            }
+    
+            out.putU32(static_cast<uint32_t>(history.getLive().size()));
+            for (const Transaction* t : history.getLive()) {
+                out.putU32(t->getTransactionNumber());
+                out.putString(t->getMemberId());
+                out.putString(t->getBookId());
+                out.putI64(static_cast<int64_t>(t->getIssueDate()));
+                out.putI64(static_cast<int64_t>(t->getReturnDate()));
+                out.putF64(t->getFine());
+                out.putU8(t->getReturnStatus() ? 1 : 0);
+            }
+    
+            // Sealed history: spilled segments by file name, the rest inline
+            out.putU32(static_cast<uint32_t>(history.getSealed().size()));
+            for (const auto& segment : history.getSealed()) {
+                out.putU8(segment->isSpilled() ? 1 : 0);
+                if (segment->isSpilled()) {
+                    out.putString(segment->getSpillPath());
+                } else {
+                    segment->write(out);
+                }
+            }
+    
+            SnapshotWriter holds;
+            uint32_t queueCount = 0;
+            for (const auto& shard : bookReservations) {
+                shard.forEach([this, &holds, &queueCount](Symbol bookId, const HoldQueue& queue) {
+                    holds.putString(bookId.str());
+                    holds.putU32(static_cast<uint32_t>(queue.size()));
+                    for (size_t i = 0; i < queue.size(); ++i) {
+                        holds.putString(members.get(queue.at(i)).getMemberId());
+                    }
+                    queueCount++;
+                });
+            }
+            out.putU32(queueCount);
+    
+            if (!replaceFile(path, out.data(), holds.data())) {
+                throw LibraryException("Could not write snapshot to " + path + ".");
+            }
+        }
+    
+        // Books of a version 1-3 snapshot, one record each
+        void readBookRecords(SnapshotReader& in) {
+            uint32_t bookCount = in.getU32();
+            bookIndex.reserve(bookCount);
+            catalog.reserve(bookCount);
+            for (uint32_t i = 0; i < bookCount; ++i) {
+                BookKind kind = static_cast<BookKind>(in.getU8());
+                string id = in.getString();
+                string title = in.getString();
+                string author = in.getString();
+                string category = in.getString();
+                bool available = in.getU8() != 0;
+                if (kind == BookKind::EBook) {
+                    string format = in.getString();
+                    int size = static_cast<int>(in.getU32());
+                    addEBook(id, title, author, category, format, size);
+                } else if (kind == BookKind::Journal) {
+                    int volume = static_cast<int>(in.getU32());
+                    int issue = static_cast<int>(in.getU32());
+                    string date = in.getString();
+                    addJournal(id, title, author, category, volume, issue, date);
+                } else {
+                    addBook(id, title, author, category);
+                }
+                setAvailability(static_cast<uint32_t>(catalog.size() - 1), available);
+            }
+        }
+    
+    public:
+        Library()
+            : idOrderedBooks(0), searchIndexedBooks(0), listById(false), lastTransactionId(1000), appliedLsn(0),
+              viewEpochs(LOCK_STRIPES), bookLoans(viewEpochs), memberLoanCounts(viewEpochs), analyticsThreads(0),
+              categorizedBooks(0) {}
+    
+        // Destructor to clean up memory (books and transactions are released with their pools)
+        ~Library() {
+            for (auto staff : staff) delete staff;
+        }
+    
+        // Book management
+        Book& addBook(const string& id, const string& title, const string& author, const string& category) {
+            return registerBook(bookPool.create(id, title, author, category));
+        }
+    
+        EBook& addEBook(const string& id, const string& title, const string& author,
+                        const string& category, const string& format, int fileSizeMB) {
+            return registerBook(ebookPool.create(id, title, author, category, format, fileSizeMB));
+        }
+    
+        Journal& addJournal(const string& id, const string& title, const string& author,
+                            const string& category, int volume, int issue, const string& publishDate) {
+            return registerBook(journalPool.create(id, title, author, category, volume, issue, publishDate));
+        }
+    
+        Book* findBook(Symbol bookId) {
+            uint32_t ordinal = ordinalOf(bookId);
+            return ordinal == NO_BOOK ? nullptr : bookAt(ordinal);
+        }
+    
+        Book* findBook(const std::string& bookId) {
+            LibraryMetrics::Scope timing(metrics, MetricOp::FindBook);
+            Book* book = lookupBook(bookId);
+            if (!book) {
+                timing.miss();
+            }
+            return book;
+        }
+    
+        // Consistent, read-only view of circulation: which books are on loan, to
+        // whom and under which transaction, and how many books each member has,
+        // all as of one instant. Opening one starts a new generation and waits
+        // only for issues and returns still publishing in the old one; neither
+        // opening nor closing takes a circulation lock. Afterwards writers copy
+        // the pages they change, so the view is read without locks while issues
+        // and returns go on. Book and
+        // member details come from the live objects, whose IDs, titles and names
+        // do not change. Close views promptly (they pin the copied pages), and
+        // do not add books or members or destroy the library while one is open.
+        class ReadView {
+            private:
+                const Library* library;
+                uint64_t generation;
+                VersionedArray<uint64_t>::View loans;
+                VersionedArray<uint32_t>::View memberLoans;
+                size_t books;
+                size_t memberTotal;
+    
+                friend class Library;
+                ReadView(const Library& l, uint64_t g)
+                    : library(&l), generation(g), loans(l.bookLoans.view(g)), memberLoans(l.memberLoanCounts.view(g)),
+                      books(l.catalog.size()), memberTotal(l.members.size()) {}
+    
+            public:
+                ReadView(ReadView&& other)
+                    : library(other.library), generation(other.generation), loans(other.loans),
+                      memberLoans(other.memberLoans), books(other.books), memberTotal(other.memberTotal) {
+                    other.library = nullptr;
+                }
+    
+                ReadView(const ReadView&) = delete;
+                ReadView& operator=(const ReadView&) = delete;
+    
+                ~ReadView() {
+                    if (library) {
+                        library->viewEpochs.closeView(generation);
+                    }
+                }
+    
+                size_t bookCount() const { return books; }
+                size_t memberCount() const { return memberTotal; }
+    
+                // Books by catalog ordinal (registration order)
+                const Book& book(uint32_t ordinal) const { return *library->bookAt(ordinal); }
+                bool isAvailable(uint32_t ordinal) const { return loans[ordinal] == 0; }
+    
+                // Transaction number of the book's open loan, 0 if none
+                uint32_t loanNumber(uint32_t ordinal) const { return static_cast<uint32_t>(loans[ordinal] >> 32); }
+    
+                const Member* borrower(uint32_t ordinal) const {
+                    uint32_t handle = static_cast<uint32_t>(loans[ordinal]);
+                    return handle == 0 ? nullptr : &library->members.get(handle - 1);
+                }
+    
+                // Members by handle (registration order)
+                const Member& member(MemberStore::Handle handle) const { return library->members.get(handle); }
+                int issuedCount(MemberStore::Handle handle) const { return static_cast<int>(memberLoans[handle]); }
+            };
+    
+        ReadView openReadView() const { return ReadView(*this, viewEpochs.openView()); }
+    
+        // Copies retired by writers and not yet freed (they wait for older views)
+        size_t pendingViewCopies() const { return viewEpochs.retiredCount(); }
+    
+        void displayAllBooks() const {
+            ReadView view = openReadView();
+            cout << "\n=========================================================================================================\n";
+            cout << "|\t\t\t\t\tLIBRARY BOOKS (" << view.bookCount() << ")\t\t\t\t\t|\n";
+            cout << "=========================================================================================================\n";
+            cout << "| Book ID\t| Title\t\t\t\t\t| Author\t\t\t| Status\t|\n";
+            cout << "---------------------------------------------------------------------------------------------------------\n";
+            forEachListed([&view](uint32_t ordinal) {
+                const Book& book = view.book(ordinal);
+                cout << "| " << book.getBookId() << "\t| " << book.getTitle() << "\t| " 
+                     << book.getAuthor() << "\t| " 
+                     << (view.isAvailable(ordinal) ? "Available" : "Issued") << "\t|\n";
+            });
+            cout << "=========================================================================================================\n";
+        }
+    
+        // Books whose title, author or category contain every word of the query;
+        // a word also matches longer words it begins ("prog" finds "Programming")
+        vector<Book*> searchBooks(const string& query) const {
+            vector<Book*> found;
+            for (uint32_t ordinal : searchPostings().query(query)) {
+                found.push_back(bookAt(ordinal));
+            }
+            return found;
+        }
+    
+        // Books with IDs from 'fromId' to 'toId' inclusive, in ID order. Numbers
+        // in IDs compare by value: B100..B199 does not include B1000.
+        vector<Book*> findBooksInRange(const string& fromId, const string& toId) const {
+            vector<Book*> found;
+            for (uint32_t ordinal : orderedIds().range(fromId, toId)) {
+                found.push_back(bookAt(ordinal));
+            }
+            return found;
+        }
+    
+        void displayBooksInRange(const string& fromId, const string& toId) const {
+            vector<Book*> found = findBooksInRange(fromId, toId);
+            cout << "\n===== BOOKS " << fromId << " TO " << toId << " (" << found.size() << ") =====\n";
+            if (found.empty()) {
+                cout << "No books in this ID range.\n";
+                return;
+            }
+            cout << "| Book ID\t| Title\t\t\t\t\t| Author\t\t\t| Status\t|\n";
+            for (const auto& book : found) {
+                cout << "| " << book->getBookId() << "\t| " << book->getTitle() << "\t| "
+                     << book->getAuthor() << "\t| "
+                     << (book->getAvailability() ? "Available" : "Issued") << "\t|\n";
+            }
+        }
+    
+        // Subtype queries scan the dense side tables in the catalog columns
+        vector<EBook*> findEBooksLargerThan(int sizeMB) const {
+            vector<EBook*> found;
+            for (uint32_t ordinal : columns.ebooksLargerThan(sizeMB)) {
+                found.push_back(static_cast<EBook*>(bookAt(ordinal)));
+            }
+            return found;
+        }
+    
+        vector<Journal*> findJournalsByVolume(int volume) const {
+            vector<Journal*> found;
+            for (uint32_t ordinal : columns.journalsOfVolume(volume)) {
+                found.push_back(static_cast<Journal*>(bookAt(ordinal)));
+            }
+            return found;
+        }
+    
+        void displayBookDetails(const string& bookId) {
+            Book* book = findBook(bookId);
+            if (!book) {
+                throw BookNotFoundException(bookId);
+            }
+            cout << "\n===== BOOK DETAILS =====\n";
+            book->displayDetails();
+        }
+    
+        // Loan history of a member or a book, oldest first. Sealed months are
+        // skipped unless their dictionary contains the ID.
+        vector<Transaction> getMemberHistory(const string& memberId) const {
+            const MemberStore::Handle* handle = lookupMember(memberId);
+            if (!handle) {
+                throw InvalidMemberException(memberId);
+            }
+            Symbol memberSymbol = members.get(*handle).getMemberSymbol();
+            lock_guard<mutex> guard(lockFor(members.get(*handle)));
+            return collectHistory(memberSymbol, &TransactionHistory::collectMember, &HistorySegment::collectMember);
+        }
+    
+        vector<Transaction> getBookHistory(const string& bookId) const {
+            uint32_t ordinal = ordinalOf(bookId);
+            if (ordinal == NO_BOOK) {
+                throw BookNotFoundException(bookId);
+            }
+            Symbol bookSymbol = bookAt(ordinal)->getBookSymbol();
+            lock_guard<mutex> guard(bookLocks[stripeOf(bookSymbol)]);
+            return collectHistory(bookSymbol, &TransactionHistory::collectBook, &HistorySegment::collectBook);
+        }
+    
+        void displayMemberHistory(const string& memberId) const {
+            displayHistory("LOAN HISTORY OF " + memberId, getMemberHistory(memberId));
+        }
+    
+        void displayBookHistory(const string& bookId) const {
+            displayHistory("LOAN HISTORY OF " + bookId, getBookHistory(bookId));
+        }
+    
+        // Seal loans returned before the month of 'before' (default: now) into
+        // compressed monthly segments. Checkpoints and snapshot loads do this
+        // too. Returns the number of loans sealed.
+        size_t sealHistory(time_t before = time(nullptr)) {
+            CirculationPause pause(*this);
+            return sealClosedLoans(before);
+        }
+    
+        // Spill sealed segments to files '<prefix>-YYYY-MM-T<first>.seg' and read
+        // them back through mmap. Snapshots then refer to those files, so they
+        // must be kept alongside the snapshot; a checkpoint deletes the ones its
+        // snapshot no longer refers to.
+        void setHistorySpill(const string& prefix) {
+            CirculationPause pause(*this);
+            historySpillPrefix = prefix;
+            if (!prefix.empty()) {
+                history.spill(prefix);
+            }
+        }
+    
+        struct HistoryStats {
+            size_t liveLoans;
+            size_t sealedLoans;
+            size_t segments;
+            size_t liveBytes;   // Transaction objects and their list entries
+            size_t sealedBytes; // sealed segments held in memory
+        };
+    
+        HistoryStats readHistoryStats() const {
+            lock_guard<mutex> guard(historyLock);
+            HistoryStats stats;
+            stats.liveLoans = history.getLive().size();
+            stats.sealedLoans = history.sealedLoans();
+            stats.segments = history.getSealed().size();
+            stats.liveBytes = stats.liveLoans * TransactionHistory::liveBytesPerLoan();
+            stats.sealedBytes = history.sealedMemoryBytes();
+            return stats;
+        }
+    
+        // Group commits (one write and fsync each) the journal has made so far
+        uint64_t readJournalSyncs() const {
+            return journal.syncCount();
+        }
+    
+        struct CatalogStats {
+            size_t books;
+            size_t available; // from the availability bitset, read without locks
+            size_t members;
+        };
+    
+        CatalogStats readCatalogStats() const {
+            CatalogStats stats;
+            stats.books = columns.size();
+            stats.available = columns.countAvailable();
+            stats.members = members.size();
+            return stats;
+        }
+    
+        // Threads for analyzeCirculation; 0 (the default) uses one per hardware thread
+        void setAnalyticsThreads(size_t threads) {
+            lock_guard<mutex> guard(analyticsLock);
+            analyticsThreads = threads;
+            analyticsPool.reset();
+        }
+    
+        // Loan totals, fines, the 'topN' most borrowed titles and most active
+        // members, and circulation per category over every loan issued up to
+        // 'asOf' (default: now), live and sealed. A loan returned after 'asOf'
+        // counts as open then, with the fine it had accrued by then. Circulation
+        // is paused only while the live loans are copied; sealed segments are
+        // scanned in place by the analytics threads.
+        AnalyticsReport analyzeCirculation(time_t asOf = time(nullptr), size_t topN = 10) const {
+            lock_guard<mutex> guard(analyticsLock);
+            if (!analyticsPool) {
+                size_t threads = analyticsThreads ? analyticsThreads : max(1u, thread::hardware_concurrency());
+                analyticsPool.reset(new WorkerPool(threads));
+            }
+            // Books loaded from a snapshot get a symbol when first used, so
+            // symbols interned since the last run are categorized as well
+            if (categorizedBooks != catalog.size()) {
+                categoryBySymbol.clear();
+                categorizedBooks = catalog.size();
+            }
+            for (size_t symbol = categoryBySymbol.size(), interned = symbols().size(); symbol < interned; ++symbol) {
+                uint32_t ordinal = ordinalOf(Symbol(static_cast<uint32_t>(symbol)));
+                categoryBySymbol.push_back(ordinal == NO_BOOK ? CirculationAnalytics::NO_CATEGORY
+                                                              : columns.categoryOf(ordinal));
+            }
+    
+            vector<LoanFacts> live;
+            vector<shared_ptr<const HistorySegment>> sealed;
+            size_t symbolCount;
+            {
+                CirculationPause pause(*this);
+                const vector<Transaction*>& loans = history.getLive();
+                live.resize(loans.size());
+                for (size_t i = 0; i < loans.size(); ++i) {
+                    const Transaction& loan = *loans[i];
+                    LoanFacts& facts = live[i];
+                    facts.memberId = loan.getMemberSymbol();
+                    facts.bookId = loan.getBookSymbol();
+                    facts.issued = loan.getIssueDate();
+                    facts.returned = loan.getReturnStatus() ? loan.getReturnDate() : 0;
+                    facts.finePaise = llround(loan.getFine() * 100.0);
+                    facts.kind = loan.getKind();
+                }
+                sealed = history.getSealed();
+                symbolCount = symbols().size();
+            }
+            return CirculationAnalytics::run(*analyticsPool, live, sealed, categoryBySymbol, columns.getCategoryNames(),
+                                             symbolCount, asOf, topN);
+        }
+    
+        void displayAnalytics(time_t asOf = time(nullptr), size_t topN = 10) const {
+            AnalyticsReport report = analyzeCirculation(asOf, topN);
+            cout << "\n===== CIRCULATION ANALYTICS (as of " << formatTimestamp(report.asOf) << ") =====\n";
+            cout << "Loans: " << report.loans << " (" << report.openLoans << " open, "
+                 << report.overdueLoans << " overdue)\n";
+            cout << "Fines charged: Rs. " << report.finesCharged << ", outstanding: Rs. "
+                 << report.finesOutstanding << "\n";
+            cout << "Active members: " << report.activeMembers << " (" << report.membersWithFines
+                 << " with fines)\n";
+            if (report.loans == 0) {
+                cout << "No loans recorded.\n";
+                return;
+            }
+    
+            cout << "Most borrowed titles:\n";
+            cout << "| Book ID\t| Title\t| Loans\t|\n";
+            for (const AnalyticsReport::Ranked& title : report.topTitles) {
+                uint32_t ordinal = ordinalOf(title.id);
+                cout << "| " << title.id.str() << "\t| " << (ordinal != NO_BOOK ? bookAt(ordinal)->getTitle() : "")
+                     << "\t| " << title.loans << "\t|\n";
+            }
+            cout << "Most active members:\n";
+            cout << "| Member\t| Name\t| Loans\t| Fines\t|\n";
+            for (const AnalyticsReport::Ranked& member : report.topMembers) {
+                const MemberStore::Handle* handle = members.findHandle(member.id);
+                cout << "| " << member.id.str() << "\t| " << (handle ? members.get(*handle).getName() : "")
+                     << "\t| " << member.loans << "\t| Rs. " << member.fines << "\t|\n";
+            }
+            cout << "Circulation by category:\n";
+            cout << "| Category\t| Loans\t| Open\t| Fines\t|\n";
+            for (const AnalyticsReport::CategoryCirculation& category : report.categories) {
+                if (category.loans != 0) {
+                    cout << "| " << category.category << "\t| " << category.loans << "\t| " << category.openLoans
+                         << "\t| Rs. " << category.fines << "\t|\n";
+                }
+            }
+            cout << "Computed in " << report.seconds * 1000.0 << " ms on " << report.threads << " thread(s).\n";
+        }
+    
+        void displaySearchResults(const string& query) const {
+            vector<Book*> found = searchBooks(query);
+            cout << "\n===== SEARCH RESULTS (" << found.size() << ") =====\n";
+            if (found.empty()) {
+                cout << "No books match \"" << query << "\".\n";
+                return;
+            }
+            cout << "| Book ID\t| Title\t\t\t\t\t| Author\t\t\t| Status\t|\n";
+            for (const auto& book : found) {
+                cout << "| " << book->getBookId() << "\t| " << book->getTitle() << "\t| "
+                     << book->getAuthor() << "\t| "
+                     << (book->getAvailability() ? "Available" : "Issued") << "\t|\n";
+            }
+        }
+    
+        // Bulk imports from CSV/TSV (see BookRow/MemberRow for the columns). The
+        // file is streamed: each window is parsed in parallel and its records
+        // applied before the next is read. Records whose ID already exists are
+        // skipped. Like the other structural changes these must not run
+        // concurrently with circulation, and they are not journaled: checkpoint
+        // afterwards.
+        ImportReport importBooks(const string& path) {
+            auto started = chrono::steady_clock::now();
+            ImportReport report;
+            vector<DelimitedParser::Error> errors;
+            uint32_t firstNew = static_cast<uint32_t>(catalog.size());
+            bool opened = DelimitedParser::stream<BookRow>(path, "id", parseBookRow,
+                [&](DelimitedParser::Result<BookRow>& parsed, size_t fileBytes) {
+                    countImportWindow(report, errors, parsed);
+                    // Size the containers once, from the first window's rows per byte
+                    if (parsed.bytes != 0 && catalog.size() == firstNew) {
+                        size_t expected = catalog.size()
+                                          + static_cast<size_t>(static_cast<double>(parsed.rows) * fileBytes / parsed.bytes);
+                        bookIndex.reserve(expected);
+                        catalog.reserve(expected);
+                    }
+                    // Create the books and fill the ID index
+                    for (auto& chunk : parsed.chunks) {
+                        for (const BookRow& row : chunk) {
+                            uint32_t ordinal = static_cast<uint32_t>(catalog.size());
+                            if (columns.findMappedId(row.id.data(), row.id.size()) != CatalogColumns::NO_ROW
+                                || !bookIndex.insert(symbols().intern(row.id), ordinal)) {
+                                report.duplicates++;
+                                continue;
+                            }
+                            Book* book;
+                            if (row.kind == BookKind::EBook) {
+                                book = ebookPool.create(row.id, row.title, row.author, row.category, row.format, row.first);
+                            } else if (row.kind == BookKind::Journal) {
+                                book = journalPool.create(row.id, row.title, row.author, row.category,
+                                                          row.first, row.second, row.publishDate);
+                            } else {
+                                book = bookPool.create(row.id, row.title, row.author, row.category);
+                            }
+                            catalog.push_back(book);
+                        }
+                        vector<BookRow>().swap(chunk);
+                    }
+                });
+            if (!opened) {
+                throw LibraryException("Could not open " + path + ".");
+            }
+    
+            // Secondary indexes in one pass over the new books
+            for (uint32_t ordinal = firstNew; ordinal < catalog.size(); ++ordinal) {
+                indexBook(ordinal);
+            }
+            report.imported = catalog.size() - firstNew;
+            report.seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+            printImportReport("book", report, errors);
+            return report;
+        }
+    
+        ImportReport importMembers(const string& path) {
+            auto started = chrono::steady_clock::now();
+            ImportReport report;
+            vector<DelimitedParser::Error> errors;
+            bool opened = DelimitedParser::stream<MemberRow>(path, "id", parseMemberRow,
+                [&](DelimitedParser::Result<MemberRow>& parsed, size_t) {
+                    countImportWindow(report, errors, parsed);
+                    members.reserve(members.size() + parsed.rows);
+                    for (auto& chunk : parsed.chunks) {
+                        for (const MemberRow& row : chunk) {
+                            if (members.findHandle(symbols().intern(row.id))) {
+                                report.duplicates++;
+                                continue;
+                            }
+                            members.add(Member(row.id, row.name, row.contact, row.maxBooks));
+                            report.imported++;
+                        }
+                        vector<MemberRow>().swap(chunk);
+                    }
+                    memberLoanCounts.reserve(members.size());
+                });
+            if (!opened) {
+                throw LibraryException("Could not open " + path + ".");
+            }
+            report.seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+            printImportReport("member", report, errors);
+            return report;
+        }
+    
+        // Member management
+        // The library owns member records; callers get a non-owning reference
+        Member& addMember(const Member& member) {
+            Member& added = members.add(member);
+            memberLoanCounts.reserve(members.size());
+            return added;
+        }
+    
+        Member* findMember(const std::string& memberId) {
+            LibraryMetrics::Scope timing(metrics, MetricOp::FindMember);
+            const MemberStore::Handle* handle = lookupMember(memberId);
+            if (!handle) {
+                timing.miss();
+                return nullptr;
+            }
+            return &members.get(*handle);
+        }
+    
+        void displayAllMembers() const {
+            ReadView view = openReadView();
+            cout << "\n=========================================================================================================\n";
+            cout << "|\t\t\t\t\tLIBRARY MEMBERS (" << view.memberCount() << ")\t\t\t\t\t|\n";
+            cout << "=========================================================================================================\n";
+            cout << "| Member ID\t| Name\t\t\t\t| Contact Info\t\t\t| Books Issued\t|\n";
+            cout << "---------------------------------------------------------------------------------------------------------\n";
+            for (MemberStore::Handle handle = 0; handle < view.memberCount(); ++handle) {
+                const Member& member = view.member(handle);
+                cout << "| " << member.getMemberId() << "\t| " << member.getName() << "\t| " 
+                     << member.getContactInfo() << "\t| " 
+                     << view.issuedCount(handle) << "/" << member.getMaxBooksAllowed() << "\t|\n";
+            }
+            cout << "=========================================================================================================\n";
+        }
+    
+        // Staff management
+        void addStaff(Librarian* librarian) {
+            staff.push_back(librarian);
+        }
+    
+        // Transaction operations
+        // Non-throwing issue: returns the outcome instead of throwing, and appends
+        // the receipt event to 'events' if given. Returns once the change is durable.
+        CirculationResult tryIssueBook(const std::string& memberId, const std::string& bookId,
+                                       vector<LibraryEvent>* events = nullptr) {
+            LibraryMetrics::Scope timing(metrics, MetricOp::Issue);
+            const MemberStore::Handle* handle = lookupMember(memberId);
+            if (!handle) {
+                timing.outcome(CirculationStatus::InvalidMember);
+                return CirculationResult::failure(CirculationStatus::InvalidMember, memberId);
+            }
+            Book* book = lookupBook(bookId);
+            if (!book) {
+                timing.outcome(CirculationStatus::BookNotFound);
+                return CirculationResult::failure(CirculationStatus::BookNotFound, bookId);
+            }
+            uint64_t lsn = 0;
+            CirculationResult result = applyIssue(*handle, *book, events, lsn);
+            waitDurable(lsn);
+            timing.outcome(result.getStatus());
+            return result;
+        }
+    
+        // Non-throwing return; events for reservations it serves are appended to
+        // 'events' as well, or emitted to the output sink without it
+        CirculationResult tryReturnBook(const std::string& memberId, const std::string& bookId,
+                                        vector<LibraryEvent>* events = nullptr) {
+            LibraryMetrics::Scope timing(metrics, MetricOp::Return);
+            const MemberStore::Handle* handle = lookupMember(memberId);
+            if (!handle) {
+                timing.outcome(CirculationStatus::InvalidMember);
+                return CirculationResult::failure(CirculationStatus::InvalidMember, memberId);
+            }
+            Book* book = lookupBook(bookId);
+            if (!book) {
+                timing.outcome(CirculationStatus::BookNotFound);
+                return CirculationResult::failure(CirculationStatus::BookNotFound, bookId);
+            }
+            vector<LibraryEvent> holdEvents;
+            uint64_t lsn = 0;
+            CirculationResult result = applyReturn(*handle, *book, events, holdEvents, lsn);
+            waitDurable(lsn);
+            if (events) {
+                events->insert(events->end(), holdEvents.begin(), holdEvents.end());
+            } else {
+                output.emit(holdEvents);
+            }
+            timing.outcome(result.getStatus());
+            return result;
+        }
+    
+        // Throwing interface over tryIssueBook/tryReturnBook: emits the receipt,
+        // or reports the error and throws the matching LibraryException
+        void issueBook(const std::string& memberId, const std::string& bookId) {
+            vector<LibraryEvent> events;
+            CirculationResult result = tryIssueBook(memberId, bookId, &events);
+            if (!result) {
+                output.emit(LibraryEvent::failure(EventKind::Failed, result));
+                result.throwIfError();
+            }
+            output.emit(events);
+        }
+    
+        void returnBook(const std::string& memberId, const std::string& bookId) {
+            vector<LibraryEvent> events;
+            CirculationResult result = tryReturnBook(memberId, bookId, &events);
+            if (!result) {
+                output.emit(LibraryEvent::failure(EventKind::Failed, result));
+                result.throwIfError();
+            }
+            output.emit(events);
+        }
+    
+        // Console output of circulation calls. Headless mode drops all events
+        // (servers, benchmarks); flushOutput waits until queued events are written.
+        void setOutputMode(OutputSink::Mode mode) { output.setMode(mode); }
+    
+        void flushOutput() { output.flush(); }
+    
+        // Hot-path metrics: call counts, lookup misses, circulation outcomes and
+        // sampled latency histograms for findBook, findMember and issue/return.
+        // Recording is on by default and can be switched off at any time.
+        void setMetricsEnabled(bool enabled) { metrics.setEnabled(enabled); }
+    
+        LibraryMetrics::Snapshot readMetrics() const { return metrics.read(); }
+    
+        void displayMetrics() const {
+            LibraryMetrics::Snapshot snapshot = metrics.read();
+            size_t queues, waiting;
+            countReservations(queues, waiting);
+    
+            cout << "\n===== LIBRARY METRICS =====\n";
+            cout << "Books: " << columns.size() << " (" << columns.size() - columns.countAvailable()
+                 << " on loan), members: " << members.size() << ", reservation queues: " << queues
+                 << " (" << waiting << " waiting)\n";
+            cout << "| Operation\t| Calls\t| Misses\t| p50 ns\t| p99 ns\t| p999 ns\t| max ns\t|\n";
+            for (size_t op = 0; op < LibraryMetrics::OPS; ++op) {
+                const LatencyHistogram& latency = snapshot.latency[op];
+                bool lookup = op == static_cast<size_t>(MetricOp::FindBook) || op == static_cast<size_t>(MetricOp::FindMember);
+                cout << "| " << LibraryMetrics::labelOf(static_cast<MetricOp>(op)) << "\t| " << snapshot.calls[op]
+                     << "\t| " << (lookup ? to_string(snapshot.misses[op]) : "-")
+                     << "\t| " << latency.percentile(0.5) << "\t| " << latency.percentile(0.99)
+                     << "\t| " << latency.percentile(0.999) << "\t| " << latency.maxValue() << "\t|\n";
+            }
+    
+            const char* const headings[] = { "Issue outcomes:", "Return outcomes:" };
+            for (size_t op = 0; op < 2; ++op) {
+                cout << headings[op];
+                for (size_t status = 0; status < LibraryMetrics::STATUSES; ++status) {
+                    if (LibraryMetrics::possibleOutcome(static_cast<CirculationOp>(op), static_cast<CirculationStatus>(status))) {
+                        cout << " " << LibraryMetrics::labelOf(static_cast<CirculationStatus>(status)) << "="
+                             << snapshot.outcomes[op][status];
+                    }
+                }
+                cout << "\n";
+            }
+            cout << "Holds served: " << snapshot.holdsServed << ", rejected: " << snapshot.holdsRejected << "\n";
+            cout << "Latency is sampled on every " << LibraryMetrics::LATENCY_SAMPLE_PERIOD
+                 << "th call per thread and operation.\n";
+        }
+    
+        // Write the metrics in Prometheus text format, e.g. for a node exporter
+        // textfile collector. The file is replaced atomically.
+        void writeMetrics(const string& path) const {
+            ostringstream text;
+            writePrometheus(text);
+            string tempPath = path + ".tmp";
+            {
+                ofstream file(tempPath.c_str(), ios::trunc);
+                file << text.str();
+                file.flush();
+                if (!file) {
+                    throw LibraryException("Could not write metrics to " + tempPath + ".");
+                }
+            }
+#ifdef _WIN32
+            remove(path.c_str());
+#endif
+            if (rename(tempPath.c_str(), path.c_str()) != 0) {
+                throw LibraryException("Could not move metrics into place at " + path + ".");
+            }
+        }
+    
+        // Apply a batch of issues and returns, e.g. a book-drop scan or a kiosk
+        // sync. Items are applied in batch order, so the results match calling
+        // issueBook/returnBook one by one, but nothing is thrown or printed per
+        // item: all IDs are resolved in one validation pass up front, and the
+        // whole batch waits for a single journal commit at the end. Receipts for
+        // reservations served by the returns are emitted once, afterwards.
+        vector<CirculationStatus> processBatch(const vector<CirculationRequest>& requests) {
+            struct Resolved {
+                const MemberStore::Handle* member;
+                Book* book;
+            };
+    
+            // Validation pass: resolve every ID before touching any state
+            vector<CirculationStatus> results(requests.size());
+            vector<Resolved> resolved(requests.size());
+            for (size_t i = 0; i < requests.size(); ++i) {
+                resolved[i].member = lookupMember(requests[i].memberId);
+                resolved[i].book = lookupBook(requests[i].bookId);
+                if (!resolved[i].member) {
+                    results[i] = CirculationStatus::InvalidMember;
+                } else if (!resolved[i].book) {
+                    results[i] = CirculationStatus::BookNotFound;
+                }
+            }
+    
+            vector<LibraryEvent> holdEvents;
+            uint64_t lastLsn = 0;
+            for (size_t i = 0; i < requests.size(); ++i) {
+                if (!resolved[i].member || !resolved[i].book) {
+                    continue;
+                }
+                uint64_t lsn = 0;
+                if (requests[i].op == CirculationOp::Issue) {
+                    results[i] = applyIssue(*resolved[i].member, *resolved[i].book, nullptr, lsn).getStatus();
+                } else {
+                    results[i] = applyReturn(*resolved[i].member, *resolved[i].book, nullptr,
+                                             holdEvents, lsn).getStatus();
+                }
+                lastLsn = max(lastLsn, lsn);
+            }
+    
+            waitDurable(lastLsn);
+            output.emit(holdEvents);
+            for (size_t i = 0; i < requests.size(); ++i) {
+                metrics.countOutcome(requests[i].op, results[i]);
+            }
+            return results;
+        }
+    
+        // Issue an available book to the first holder who can take it
+        bool serveNextHold(Symbol bookId) {
+            Book* book = findBook(bookId);
+            if (!book) {
+                return false;
+            }
+            vector<LibraryEvent> events;
+            uint64_t lsn = 0;
+            bool served;
+            {
+                lock_guard<mutex> bookGuard(lockFor(*book));
+                served = serveHoldsLocked(*book, events, lsn);
+            }
+            waitDurable(lsn);
+            output.emit(events);
+            return served;
+        }
+    
+        // Batch pass over all hold queues, e.g. after a run of bulk returns
+        int processPendingReservations() {
+            vector<Symbol> ready;
+            for (size_t stripe = 0; stripe < LOCK_STRIPES; ++stripe) {
+                lock_guard<mutex> guard(bookLocks[stripe]);
+                bookReservations[stripe].forEach([this, &ready](Symbol bookId, const HoldQueue&) {
+                    Book* book = findBook(bookId);
+                    if (book && book->getAvailability()) {
+                        ready.push_back(bookId);
+                    }
+                });
+            }
+    
+            int served = 0;
+            for (const auto& bookId : ready) {
+                if (serveNextHold(bookId)) {
+                    served++;
+                }
+            }
+            output.emit(LibraryEvent::notice(to_string(served) + " reservation(s) processed.\n"));
+            return served;
+        }
+    
+        // Generate reports
+        // Only loans whose due date has passed are visited. Each candidate is checked
+        // against the open loans under its book lock, since it may have been
+        // returned after the due-date index was read.
+        void generateOverdueReport() const {
+            cout << "\n===== OVERDUE BOOKS REPORT =====\n";
+            time_t now = time(nullptr);
+    
+            ostringstream rows;
+            int overdue = 0;
+            double totalFines = 0.0;
+            for (const DueDateIndex::Entry& entry : dueDates.dueBefore(now)) {
+                lock_guard<mutex> guard(bookLocks[stripeOf(entry.bookId)]);
+                Transaction* const* loan = activeLoans[stripeOf(entry.bookId)].find(entry.bookId);
+                if (!loan || (*loan)->getTransactionNumber() != entry.transactionNumber) {
+                    continue;
+                }
+                const Transaction& transaction = **loan;
+                uint32_t ordinal = ordinalOf(entry.bookId);
+                int daysOverdue = static_cast<int>(difftime(now, entry.dueDate) / Transaction::SECONDS_PER_DAY);
+                double fine = Transaction::fineFor(transaction.getIssueDate(), now, transaction.getKind());
+    
+                rows << "| " << transaction.getTransactionId() << "\t| " << transaction.getMemberId()
+                     << "\t| " << transaction.getBookId() << "\t| " << (ordinal != NO_BOOK ? bookAt(ordinal)->getTitle() : "")
+                     << "\t| " << formatTimestamp(entry.dueDate) << "\t| " << daysOverdue
+                     << "\t| Rs. " << fine << "\t|\n";
+                overdue++;
+                totalFines += fine;
+            }
+    
+            if (overdue == 0) {
+                cout << "No overdue books.\n";
+                return;
+            }
+            cout << "| Txn\t| Member\t| Book ID\t| Title\t| Due Date\t| Days Overdue\t| Fine so far\t|\n";
+            cout << rows.str();
+            cout << "Total overdue: " << overdue << ", projected fines: Rs. " << totalFines << "\n";
+        }
+    
+        // Reads the catalog columns (in registration order) and a read view, never
+        // the Book objects; the rows and totals all describe the same instant
+        void generateBookStatusReport() const {
+            ReadView view = openReadView();
+            std::cout << "\n===== BOOK STATUS REPORT =====\n";
+    
+            std::cout << "Book ID\tTitle\tStatus\n";
+            std::cout << "--------------------------\n";
+    
+            for (uint32_t row = 0; row < view.bookCount(); ++row) {
+                columns.writeId(std::cout, row);
+                std::cout << "\t";
+                columns.writeTitle(std::cout, row);
+                std::cout << "\t" << (view.isAvailable(row) ? "Available" : "Issued") << "\n";
+            }
+            printStatusSummary(view);
+        }
+    
+        // Totals only: one pass over the view with the category and kind codes
+        void printStatusSummary(const ReadView& view) const {
+            static const char* const KIND_NAMES[CatalogColumns::KINDS] = { "Books", "E-Books", "Journals" };
+            const vector<string>& names = columns.getCategoryNames();
+            vector<size_t> byCategory(names.size(), 0), availableByCategory(names.size(), 0);
+            size_t byKind[CatalogColumns::KINDS] = {}, availableByKind[CatalogColumns::KINDS] = {};
+            size_t total = view.bookCount();
+            size_t available = 0;
+            for (uint32_t row = 0; row < total; ++row) {
+                size_t isAvailable = view.isAvailable(row);
+                uint32_t code = columns.categoryOf(row);
+                size_t kind = static_cast<size_t>(columns.kindOf(row));
+                available += isAvailable;
+                byCategory[code]++;
+                availableByCategory[code] += isAvailable;
+                byKind[kind]++;
+                availableByKind[kind] += isAvailable;
+            }
+    
+            std::cout << "--------------------------\n";
+            std::cout << "Total Books: " << total << "\n";
+            std::cout << "Available: " << available << "\n";
+            std::cout << "Issued: " << total - available << "\n";
+    
+            std::cout << "By category (available/total):\n";
+            for (size_t code = 0; code < names.size(); ++code) {
+                std::cout << "  " << names[code] << ": " << availableByCategory[code] << "/" << byCategory[code] << "\n";
+            }
+    
+            std::cout << "By type (available/total):\n";
+            for (size_t kind = 0; kind < CatalogColumns::KINDS; ++kind) {
+                std::cout << "  " << KIND_NAMES[kind] << ": " << availableByKind[kind] << "/" << byKind[kind] << "\n";
+            }
+        }
+    
+        void displayRecentTransactions(int count = 5) const {
+            std::cout << "\n===== RECENT TRANSACTIONS =====\n";
+    
+            // Copies of the latest events, most recent first
+            std::vector<Transaction> recentOnes = recentTransactions.latest(count);
+            if (recentOnes.empty()) {
+                std::cout << "No recent transactions.\n";
+                return;
+            }
+    
+            for (const auto& transaction : recentOnes) {
+                transaction.displayDetails();
+                std::cout << "------------------------\n";
+            }
+        }
+    
+        // Snapshot persistence: books (with subtype fields), members and their issued
+        // books, transactions and hold queues. The file is written to a temporary
+        // path, synced and renamed into place, so a crash or power loss never
+        // leaves a partial snapshot.
+        // Circulation is paused while the state is encoded.
+        void saveSnapshot(const string& path) const {
+            CirculationPause pause(*this);
+            writeSnapshot(path);
+        }
+    
+        // Load a snapshot into an empty library. The file is mapped and decoded in
+        // place: the catalog columns are served from the mapping, with Book
+        // objects created as books are first used and the ID order and search
+        // index built on the first query that needs them; member and loan IDs
+        // are interned straight from the mapping, and inline history segments
+        // keep pointing into it rather than being copied out (the mapping lives
+        // as long as they do; snapshots are only ever replaced by rename, so it
+        // never changes underneath them). Returns false if there is no file.
+        bool loadSnapshot(const string& path) {
+            shared_ptr<MappedFile> image = MappedFile::open(path);
+            if (!image) {
+                return false;
+            }
+            if (!catalog.empty() || members.size() != 0 || !history.empty()) {
+                throw LibraryException("Snapshots can only be loaded into an empty library.");
+            }
+    
+            SnapshotReader in(image->data(), image->size());
+            if (in.getU32() != SNAPSHOT_MAGIC) {
+                throw LibraryException(path + " is not a library snapshot.");
+            }
+            uint32_t version = in.getU32();
+            if (version < 1 || version > SNAPSHOT_VERSION) {
+                throw LibraryException("Unsupported snapshot version in " + path + ".");
+            }
+            appliedLsn = version >= 2 ? in.getU64() : 0;
+            lastTransactionId.store(in.getU32());
+    
+            if (version >= 4) {
+                size_t bookCount = columns.attach(in, image);
+                catalog.resize(bookCount);
+                bookLoans.reserve(bookCount);
+            } else {
+                readBookRecords(in);
+            }
+    
+            uint32_t memberCount = in.getU32();
+            for (uint32_t i = 0; i < memberCount; ++i) {
+                string id = in.getString();
+                string name = in.getString();
+                string contact = in.getString();
+                int maxBooks = static_cast<int>(in.getU32());
+                Member& member = addMember(Member(id, name, contact, maxBooks));
+                uint32_t issuedCount = in.getU32();
+                for (uint32_t j = 0; j < issuedCount; ++j) {
+                    member.issueBook(in.getSymbol());
+                }
+            }
+    
+            uint32_t transactionCount = in.getU32();
+            history.reserve(transactionCount);
+            for (uint32_t i = 0; i < transactionCount; ++i) {
+                uint32_t number = in.getU32();
+                Symbol memberId = in.getSymbol();
+                Symbol bookId = in.getSymbol();
+                time_t issued = static_cast<time_t>(in.getI64());
+                time_t returned = static_cast<time_t>(in.getI64());
+                double fine = in.getF64();
+                bool isReturned = in.getU8() != 0;
+                // The loan policy follows the book's kind; books are loaded first
+                uint32_t ordinal = ordinalOf(bookId);
+                BookKind kind = ordinal != NO_BOOK ? columns.kindOf(ordinal) : BookKind::Book;
+                Transaction* transaction = history.create(number, memberId, bookId, issued, returned,
+                                                          fine, isReturned, kind);
+                recentTransactions.push(*transaction);
+                if (!isReturned) {
+                    activeLoans[stripeOf(bookId)].insert(bookId, transaction);
+                    dueDates.add(*transaction);
+                }
+            }
+            if (version >= 3) {
+                uint32_t segmentCount = in.getU32();
+                for (uint32_t i = 0; i < segmentCount; ++i) {
+                    if (in.getU8() != 0) {
+                        history.addSealed(HistorySegment::open(in.getString()));
+                    } else {
+                        history.addSealed(HistorySegment::read(in, image));
+                    }
+                }
+            }
+    
+            uint32_t queueCount = in.getU32();
+            for (uint32_t i = 0; i < queueCount; ++i) {
+                Symbol bookId = in.getSymbol();
+                HoldQueue queue;
+                uint32_t holdCount = in.getU32();
+                for (uint32_t j = 0; j < holdCount; ++j) {
+                    const MemberStore::Handle* handle = members.findHandle(in.getSymbol());
+                    if (!handle) {
+                        throw LibraryException("Snapshot reservation refers to an unknown member.");
+                    }
+                    queue.push(*handle);
+                }
+                bookReservations[stripeOf(bookId)].insert(bookId, queue);
+            }
+    
+            if (!in.atEnd()) {
+                throw LibraryException("Snapshot has trailing data.");
+            }
+            rebuildVersionedState();
+            sealClosedLoans(time(nullptr));
+            return true;
+        }
+    
+        // Replay journal records newer than the loaded snapshot, then keep the
+        // journal open so every later change is logged. Returns the number of
+        // records replayed. A torn record at the tail (from a crash mid-write)
+        // is cut off before appending resumes.
+        size_t openJournal(const string& path) {
+            size_t validBytes = 0;
+            vector<TransactionJournal::Record> records = TransactionJournal::readAll(path, validBytes);
+            size_t replayed = 0;
+            uint64_t lastLsn = appliedLsn;
+            for (const auto& record : records) {
+                if (record.lsn > appliedLsn) {
+                    replay(record);
+                    replayed++;
+                }
+                lastLsn = max(lastLsn, record.lsn);
+            }
+    
+            ifstream existing(path.c_str(), ios::binary | ios::ate);
+            if (existing && static_cast<size_t>(existing.tellg()) > validBytes) {
+                existing.close();
+                if (!truncateFile(path, validBytes)) {
+                    throw LibraryException("Could not cut the torn tail off journal " + path + ".");
+                }
+            }
+    
+            journal.open(path, lastLsn);
+            return replayed;
+        }
+    
+        // Compact the journal: write a snapshot covering every logged change, then
+        // empty the journal. The snapshot is synced and renamed into place (and
+        // the rename synced) before the journal is touched, and records at or
+        // below the snapshot's LSN are skipped on replay, so a crash at any point
+        // leaves a snapshot and journal that together hold every change.
+        // Spill files under the history spill prefix that the new snapshot
+        // does not refer to are deleted last.
+        void checkpoint(const string& snapshotPath) {
+            CirculationPause pause(*this);
+            sealClosedLoans(time(nullptr));
+            writeSnapshot(snapshotPath);
+            if (journal.isOpen()) {
+                journal.truncate();
+            }
+            if (!historySpillPrefix.empty()) {
+                history.removeStaleSpills(historySpillPrefix);
+            }
+        }
+    
+        // Sort books by ID. The ID order is maintained as books are added, so
+        // this only switches listings (and snapshots) over to it.
+        void sortBooksByID() {
+            listById = true;
+            std::cout << "Books sorted by ID.\n";
+        }
+    };
+
+#endif // SMART_LIBRARY_H
@@ -0,0 +1,1001 @@
+// Benchmarks and load generator for the library engine. Builds a synthetic
+// catalog and membership, drives Zipf-distributed issue/return traffic and
+// times the core calls and reports. Results print as a table and can also be
+// written as CSV or JSON (one row per benchmark) to track regressions between
+// commits; --label tags every row, e.g. with a commit hash.
+//
+//   g++ -std=c++11 -O2 -pthread Smart_Library_Benchmark.cpp -o SmartLibraryBenchmark
+//   ./SmartLibraryBenchmark --books 1000000 --ops 500000 --csv results.csv --label $(git rev-parse --short HEAD)
+#include "Smart_Library.h"
+#include <cmath>
+#include <random>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+struct BenchmarkOptions {
+    size_t books;
+    size_t members;
+    size_t ops;
+    size_t reportRuns;
+    size_t threads;
+    size_t analyticsLoans;
+    size_t overdueLoans;
+    double zipfExponent;
+    bool metrics;
+    string journalPath;
+    string csvPath;
+    string jsonPath;
+    string label;
+    BenchmarkOptions()
+        : books(100000), members(10000), ops(200000), reportRuns(20), threads(4), analyticsLoans(4000000), overdueLoans(1000000),
+          zipfExponent(1.0), metrics(true) {}
+};
+
+struct BenchmarkResult {
+    string name;
+    size_t ops;
+    double seconds;
+    double p50, p99, p999, max; // nanoseconds per call
+    double allocationsPerOp;    // footprint benchmarks only
+    double residentBytesPerOp;
+};
+
+// Global allocations made by the current thread; per thread, so counting adds
+// no contention to the concurrent benchmarks. (Kept out of line: GCC otherwise
+// pairs the inlined free() with the caller's new and warns.)
+static thread_local size_t threadAllocations = 0;
+
+#ifdef __GNUC__
+#define OUT_OF_LINE __attribute__((noinline))
+#else
+#define OUT_OF_LINE
+#endif
+
+OUT_OF_LINE void* operator new(size_t size) {
+    threadAllocations++;
+    void* memory = malloc(size ? size : 1);
+    if (!memory) {
+        throw bad_alloc();
+    }
+    return memory;
+}
+
+OUT_OF_LINE void operator delete(void* memory) noexcept {
+    free(memory);
+}
+
+// Resident set size, where the platform reports it (0 otherwise)
+static size_t residentBytes() {
+    size_t resident = 0;
+#ifdef __linux__
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm) {
+        unsigned long pages = 0, residentPages = 0;
+        if (fscanf(statm, "%lu %lu", &pages, &residentPages) == 2) {
+            resident = residentPages * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        }
+        fclose(statm);
+    }
+#endif
+    return resident;
+}
+
+// Samples ranks 0..n-1 with P(rank k) proportional to 1 / (k + 1)^s
+class ZipfGenerator {
+    private:
+        vector<double> cdf;
+    
+    public:
+        ZipfGenerator(size_t n, double s) : cdf(n) {
+            double sum = 0.0;
+            for (size_t k = 0; k < n; ++k) {
+                sum += 1.0 / pow(static_cast<double>(k + 1), s);
+                cdf[k] = sum;
+            }
+            for (double& value : cdf) {
+                value /= sum;
+            }
+        }
+    
+        template<typename Rng>
+        size_t operator()(Rng& rng) {
+            double u = uniform_real_distribution<double>(0.0, 1.0)(rng);
+            size_t rank = lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+            return min(rank, cdf.size() - 1);
+        }
+    };
+
+// Collects per-call latencies for one benchmark
+class LatencyRecorder {
+    private:
+        vector<uint64_t> samples;
+        chrono::steady_clock::time_point started;
+        chrono::steady_clock::time_point callStarted;
+    
+    public:
+        explicit LatencyRecorder(size_t expected) {
+            samples.reserve(expected);
+            started = chrono::steady_clock::now();
+        }
+    
+        void begin() { callStarted = chrono::steady_clock::now(); }
+    
+        void end() {
+            samples.push_back(static_cast<uint64_t>(
+                chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - callStarted).count()));
+        }
+    
+        // Account for 'count' calls that took 'nanos' together (e.g. one batch)
+        void addPerCall(uint64_t nanos, size_t count) {
+            for (size_t i = 0; i < count; ++i) {
+                samples.push_back(nanos / count);
+            }
+        }
+    
+        BenchmarkResult finish(const string& name) {
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+            BenchmarkResult result = { name, samples.size(), seconds, 0, 0, 0, 0, 0, 0 };
+            if (!samples.empty()) {
+                sort(samples.begin(), samples.end());
+                auto at = [this](double q) {
+                    return static_cast<double>(samples[min(samples.size() - 1, static_cast<size_t>(q * samples.size()))]);
+                };
+                result.p50 = at(0.50);
+                result.p99 = at(0.99);
+                result.p999 = at(0.999);
+                result.max = static_cast<double>(samples.back());
+            }
+            return result;
+        }
+    };
+
+// Discards anything written to it; reports are sent here while being timed
+class NullBuffer : public streambuf {
+    protected:
+        int overflow(int c) override { return c; }
+        streamsize xsputn(const char*, streamsize n) override { return n; }
+};
+
+class QuietConsole {
+    private:
+        NullBuffer sink;
+        streambuf* savedOut;
+    
+    public:
+        QuietConsole() : savedOut(cout.rdbuf(&sink)) {}
+        ~QuietConsole() { cout.rdbuf(savedOut); }
+    };
+
+static string bookIdFor(size_t i) { return "B" + to_string(i); }
+static string memberIdFor(size_t i) { return "M" + to_string(i); }
+
+static const char* const WORDS[] = {
+    "data", "systems", "modern", "history", "introduction", "advanced", "theory", "practice",
+    "design", "programming", "networks", "science", "art", "guide", "principles", "analysis"
+};
+static const size_t WORD_COUNT = sizeof(WORDS) / sizeof(WORDS[0]);
+
+static string titleFor(size_t i) {
+    return string(WORDS[i % WORD_COUNT]) + " " + WORDS[(i / WORD_COUNT) % WORD_COUNT] + " " + to_string(i % 997);
+}
+
+static void populate(Library& library, const BenchmarkOptions& options) {
+    for (size_t i = 0; i < options.books; ++i) {
+        library.addBook(bookIdFor(i), titleFor(i), "Author " + to_string(i % 5000), "Category " + to_string(i % 40));
+    }
+    for (size_t i = 0; i < options.members; ++i) {
+        library.addMember(Member(memberIdFor(i), "Member " + to_string(i), "member" + to_string(i) + "@example.com", 5));
+    }
+}
+
+// Issue/return traffic for one client: members are picked uniformly, books by
+// Zipf rank within the client's share of the catalog. Only available books are
+// issued, so no reservations build up.
+class TrafficModel {
+    private:
+        size_t memberBase, memberCount;
+        size_t bookBase, bookStride;
+        ZipfGenerator zipf;
+        vector<uint8_t> memberLoans;
+        vector<bool> bookOut;
+        vector<pair<size_t, size_t>> openLoans; // (member, book)
+    
+    public:
+        TrafficModel(size_t mBase, size_t mCount, size_t bBase, size_t bStride, size_t bCount, double s)
+            : memberBase(mBase), memberCount(mCount), bookBase(bBase), bookStride(bStride), zipf(bCount, s),
+              memberLoans(mCount, 0), bookOut(bCount, false) {}
+    
+        // Pick the next operation; returns false for a return of (member, book)
+        template<typename Rng>
+        bool next(Rng& rng, string& memberId, string& bookId) {
+            bool wantIssue = openLoans.empty() || (rng() & 1);
+            if (wantIssue) {
+                size_t member = rng() % memberCount;
+                if (memberLoans[member] < 5) {
+                    for (int attempt = 0; attempt < 16; ++attempt) {
+                        size_t book = zipf(rng);
+                        if (!bookOut[book]) {
+                            memberLoans[member]++;
+                            bookOut[book] = true;
+                            openLoans.push_back(make_pair(member, book));
+                            memberId = memberIdFor(memberBase + member);
+                            bookId = bookIdFor(bookBase + book * bookStride);
+                            return true;
+                        }
+                    }
+                }
+            }
+            size_t index = rng() % openLoans.size();
+            pair<size_t, size_t> loan = openLoans[index];
+            openLoans[index] = openLoans.back();
+            openLoans.pop_back();
+            memberLoans[loan.first]--;
+            bookOut[loan.second] = false;
+            memberId = memberIdFor(memberBase + loan.first);
+            bookId = bookIdFor(bookBase + loan.second * bookStride);
+            return false;
+        }
+    
+        // Return every open loan (untimed), so the next phase starts clean
+        void drain(Library& library) {
+            for (const auto& loan : openLoans) {
+                library.tryReturnBook(memberIdFor(memberBase + loan.first), bookIdFor(bookBase + loan.second * bookStride));
+                memberLoans[loan.first]--;
+                bookOut[loan.second] = false;
+            }
+            openLoans.clear();
+        }
+    };
+
+// Allocations and resident memory for 'count' objects made by 'create', and
+// the time it took. Freed heap pages are handed back first where the allocator
+// allows, so reused memory still shows up as newly resident.
+template<typename Create>
+static BenchmarkResult measureFootprint(const string& name, size_t count, Create create) {
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+    size_t allocationsBefore = threadAllocations;
+    size_t residentBefore = residentBytes();
+    auto started = chrono::steady_clock::now();
+    create();
+    BenchmarkResult result = { name, count, chrono::duration<double>(chrono::steady_clock::now() - started).count(),
+                               0, 0, 0, 0, 0, 0 };
+    result.allocationsPerOp = static_cast<double>(threadAllocations - allocationsBefore) / count;
+    result.residentBytesPerOp = (static_cast<double>(residentBytes()) - residentBefore) / count;
+    return result;
+}
+
+// --books books and as many transactions, made through the object pools and
+// with one new per object. Runs first, on a fresh heap; the IDs are interned
+// beforehand so the symbol table's growth is not counted.
+static void runFootprint(const BenchmarkOptions& options, vector<BenchmarkResult>& results) {
+    size_t count = options.books;
+    vector<string> ids(count);
+    vector<Symbol> bookSymbols(count);
+    for (size_t i = 0; i < count; ++i) {
+        ids[i] = bookIdFor(i);
+        bookSymbols[i] = symbols().intern(ids[i]);
+    }
+    const string title = "Title", author = "Author", category = "Category"; // short enough to stay inline
+    vector<Book*> books(count);
+    vector<Transaction*> loans(count);
+    {
+        ObjectPool<Book> bookPool;
+        results.push_back(measureFootprint("books_pooled", count, [&]() {
+            for (size_t i = 0; i < count; ++i) {
+                books[i] = bookPool.create(ids[i], title, author, category);
+            }
+        }));
+    }
+    results.push_back(measureFootprint("books_new", count, [&]() {
+        for (size_t i = 0; i < count; ++i) {
+            books[i] = new Book(ids[i], title, author, category);
+        }
+    }));
+    for (Book* book : books) {
+        delete book;
+    }
+    Symbol member = symbols().intern(memberIdFor(0));
+    {
+        ObjectPool<Transaction> loanPool;
+        results.push_back(measureFootprint("transactions_pooled", count, [&]() {
+            for (size_t i = 0; i < count; ++i) {
+                loans[i] = loanPool.create(static_cast<uint32_t>(i + 1), member, bookSymbols[i]);
+            }
+        }));
+    }
+    results.push_back(measureFootprint("transactions_new", count, [&]() {
+        for (size_t i = 0; i < count; ++i) {
+            loans[i] = new Transaction(static_cast<uint32_t>(i + 1), member, bookSymbols[i]);
+        }
+    }));
+    for (Transaction* loan : loans) {
+        delete loan;
+    }
+    for (size_t i = results.size() - 4; i < results.size(); ++i) {
+        printf("footprint: %-20s %.2f allocations and %.0f resident bytes per object\n", results[i].name.c_str(),
+               results[i].allocationsPerOp, results[i].residentBytesPerOp);
+    }
+}
+
+static void runLookups(Library& library, const BenchmarkOptions& options, vector<BenchmarkResult>& results) {
+    mt19937_64 rng(1);
+    ZipfGenerator zipf(options.books, options.zipfExponent);
+    vector<string> bookIds, memberIds;
+    for (size_t i = 0; i < options.ops; ++i) {
+        bookIds.push_back(bookIdFor(zipf(rng)));
+        memberIds.push_back(memberIdFor(rng() % options.members));
+    }
+    size_t found = 0;
+    LatencyRecorder books(options.ops);
+    for (const string& id : bookIds) {
+        books.begin();
+        found += library.findBook(id) != nullptr;
+        books.end();
+    }
+    results.push_back(books.finish("findBook"));
+    LatencyRecorder members(options.ops);
+    for (const string& id : memberIds) {
+        members.begin();
+        found += library.findMember(id) != nullptr;
+        members.end();
+    }
+    results.push_back(members.finish("findMember"));
+    if (found != 2 * options.ops) {
+        cerr << "warning: " << 2 * options.ops - found << " lookups missed\n";
+    }
+}
+
+static void runCirculation(Library& library, const BenchmarkOptions& options, vector<BenchmarkResult>& results) {
+    mt19937_64 rng(2);
+    TrafficModel traffic(0, options.members, 0, 1, options.books, options.zipfExponent);
+    LatencyRecorder issues(options.ops / 2 + 1), returns(options.ops / 2 + 1);
+    string memberId, bookId;
+    for (size_t i = 0; i < options.ops; ++i) {
+        bool issue = traffic.next(rng, memberId, bookId);
+        LatencyRecorder& recorder = issue ? issues : returns;
+        recorder.begin();
+        if (issue) {
+            library.issueBook(memberId, bookId);
+        } else {
+            library.returnBook(memberId, bookId);
+        }
+        recorder.end();
+    }
+    results.push_back(issues.finish("issueBook"));
+    results.push_back(returns.finish("returnBook"));
+    traffic.drain(library);
+}
+
+// Rejected scans: the throwing wrapper against the status-returning call
+static void runErrorPath(Library& library, const BenchmarkOptions& options, vector<BenchmarkResult>& results) {
+    size_t ops = min<size_t>(options.ops, 100000);
+    LatencyRecorder throwing(ops);
+    for (size_t i = 0; i < ops; ++i) {
+        throwing.begin();
+        try {
+            library.issueBook("UNKNOWN", bookIdFor(i % options.books));
+        } catch (const LibraryException&) {
+        }
+        throwing.end();
+    }
+    results.push_back(throwing.finish("issueBook_invalidMember"));
+    LatencyRecorder statusCode(ops);
+    for (size_t i = 0; i < ops; ++i) {
+        statusCode.begin();
+        library.tryIssueBook("UNKNOWN", bookIdFor(i % options.books));
+        statusCode.end();
+    }
+    results.push_back(statusCode.finish("tryIssueBook_invalidMember"));
+}
+
+static void runBatches(Library& library, const BenchmarkOptions& options, vector<BenchmarkResult>& results) {
+    const size_t BATCH_SIZE = 1000;
+    mt19937_64 rng(3);
+    TrafficModel traffic(0, options.members, 0, 1, options.books, options.zipfExponent);
+    LatencyRecorder recorder(options.ops);
+    vector<CirculationRequest> batch;
+    size_t failed = 0;
+    for (size_t done = 0; done < options.ops; done += batch.size()) {
+        batch.clear();
+        for (size_t i = 0; i < BATCH_SIZE; ++i) {
+            CirculationRequest request;
+            request.op = traffic.next(rng, request.memberId, request.bookId) ? CirculationOp::Issue : CirculationOp::Return;
+            batch.push_back(request);
+        }
+        auto started = chrono::steady_clock::now();
+        vector<CirculationStatus> statuses = library.processBatch(batch);
+        recorder.addPerCall(static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(
+                                chrono::steady_clock::now() - started).count()), batch.size());
+        for (CirculationStatus status : statuses) {
+            failed += status != CirculationStatus::Issued && status != CirculationStatus::Returned;
+        }
+    }
+    results.push_back(recorder.finish("processBatch_per_item"));
+    traffic.drain(library);
+    if (failed != 0) {
+        cerr << "warning: " << failed << " batch items failed\n";
+    }
+}
+
+static void runSearch(Library& library, const BenchmarkOptions& options, vector<BenchmarkResult>& results) {
+    mt19937_64 rng(4);
+    size_t ops = min<size_t>(options.ops, 20000);
+    vector<string> queries;
+    for (size_t i = 0; i < ops; ++i) {
+        string query = WORDS[rng() % WORD_COUNT];
+        if (rng() % 2) {
+            query = query.substr(0, 3); // prefix query
+        }
+        if (rng() % 2) {
+            query += string(" ") + WORDS[rng() % WORD_COUNT];
+        }
+        queries.push_back(query);
+    }
+    library.searchBooks("warm"); // first query sorts the word list
+    LatencyRecorder recorder(ops);
+    size_t hits = 0;
+    for (const string& query : queries) {
+        recorder.begin();
+        hits += library.searchBooks(query).size();
+        recorder.end();
+    }
+    results.push_back(recorder.finish("searchBooks"));
+}
+
+static void runReports(Library& library, const BenchmarkOptions& options, vector<BenchmarkResult>& results) {
+    QuietConsole quiet;
+    LatencyRecorder status(options.reportRuns), overdue(options.reportRuns), recent(options.reportRuns);
+    for (size_t i = 0; i < options.reportRuns; ++i) {
+        status.begin();
+        library.generateBookStatusReport();
+        status.end();
+        overdue.begin();
+        library.generateOverdueReport();
+        overdue.end();
+        recent.begin();
+        library.displayRecentTransactions(20);
+        recent.end();
+    }
+    results.push_back(status.finish("generateBookStatusReport"));
+    results.push_back(overdue.finish("generateOverdueReport"));
+    results.push_back(recent.finish("displayRecentTransactions"));
+}
+
+// The first ordered read merges every ID added so far into the ID order; after
+// that, range queries are binary searches and listings need no sort
+static void runOrdered(Library& library, const BenchmarkOptions& options, vector<BenchmarkResult>& results) {
+    auto started = chrono::steady_clock::now();
+    library.findBooksInRange(bookIdFor(0), bookIdFor(0));
+    BenchmarkResult build = { "idOrder_build", options.books,
+                              chrono::duration<double>(chrono::steady_clock::now() - started).count(), 0, 0, 0, 0, 0, 0 };
+    results.push_back(build);
+
+    mt19937_64 rng(5);
+    size_t ops = min<size_t>(options.ops, 20000);
+    LatencyRecorder ranges(ops);
+    size_t found = 0;
+    for (size_t i = 0; i < ops; ++i) {
+        size_t first = rng() % (options.books - 100);
+        ranges.begin();
+        found += library.findBooksInRange(bookIdFor(first), bookIdFor(first + 99)).size();
+        ranges.end();
+    }
+    results.push_back(ranges.finish("findBooksInRange_100"));
+    if (found != 100 * ops) {
+        cerr << "warning: range queries returned " << found << " books, expected " << 100 * ops << "\n";
+    }
+
+    QuietConsole quiet;
+    library.sortBooksByID();
+    LatencyRecorder listing(options.reportRuns);
+    for (size_t i = 0; i < options.reportRuns; ++i) {
+        listing.begin();
+        library.displayAllBooks();
+        listing.end();
+    }
+    results.push_back(listing.finish("displayAllBooks_by_id"));
+}
+
+// Issue/return traffic on 'threads' threads, each on its own members and its
+// own share of the books, so the threads contend only on lock stripes, the
+// journal and the allocator; returns the wall time and fills one latency list
+// per thread
+static double driveTraffic(Library& library, const BenchmarkOptions& options, size_t threads,
+                           vector<vector<uint64_t>>& latencies) {
+    latencies.assign(threads, vector<uint64_t>());
+    auto started = chrono::steady_clock::now();
+    vector<thread> pool;
+    for (size_t t = 0; t < threads; ++t) {
+        pool.push_back(thread([&, t]() {
+            mt19937_64 rng(100 + t);
+            size_t membersEach = options.members / threads;
+            size_t booksEach = options.books / threads;
+            TrafficModel traffic(t * membersEach, membersEach, t, threads, booksEach, options.zipfExponent);
+            string memberId, bookId;
+            latencies[t].reserve(options.ops / threads);
+            for (size_t i = 0; i < options.ops / threads; ++i) {
+                bool issue = traffic.next(rng, memberId, bookId);
+                auto callStarted = chrono::steady_clock::now();
+                if (issue) {
+                    library.tryIssueBook(memberId, bookId);
+                } else {
+                    library.tryReturnBook(memberId, bookId);
+                }
+                latencies[t].push_back(static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(
+                    chrono::steady_clock::now() - callStarted).count()));
+            }
+            traffic.drain(library);
+        }));
+    }
+    for (auto& worker : pool) {
+        worker.join();
+    }
+    return chrono::duration<double>(chrono::steady_clock::now() - started).count();
+}
+
+static BenchmarkResult mergeLatencies(const string& name, const vector<vector<uint64_t>>& latencies, double seconds) {
+    LatencyRecorder merged(0);
+    for (const auto& samples : latencies) {
+        for (uint64_t nanos : samples) {
+            merged.addPerCall(nanos, 1);
+        }
+    }
+    BenchmarkResult result = merged.finish(name);
+    result.seconds = seconds;
+    return result;
+}
+
+// Circulation at 1, 2, 4, ... threads up to 32 (or --threads, if larger), each
+// thread count running the same --ops in total
+static void runConcurrent(Library& library, const BenchmarkOptions& options, vector<BenchmarkResult>& results) {
+    size_t widest = min(max<size_t>(options.threads, 32), options.members);
+    vector<size_t> threadCounts;
+    for (size_t threads = 1; threads < widest; threads *= 2) {
+        threadCounts.push_back(threads);
+    }
+    threadCounts.push_back(widest);
+
+    double baseline = 0.0;
+    for (size_t threads : threadCounts) {
+        vector<vector<uint64_t>> latencies;
+        double seconds = driveTraffic(library, options, threads, latencies);
+        BenchmarkResult result = mergeLatencies("circulation_" + to_string(threads) + "_threads", latencies, seconds);
+        if (threads == 1) {
+            baseline = result.ops / seconds;
+        }
+        printf("circulation: %zu thread(s): %.0f ops/s, %.2fx one thread\n", threads, result.ops / seconds,
+               baseline > 0 ? result.ops / seconds / baseline : 0.0);
+        results.push_back(result);
+    }
+}
+
+// Writer throughput alone and with a long report running alongside. The report
+// thread keeps opening read views and walking every book and member in them,
+// and checks each view is consistent: the books on loan must match the sum of
+// the members' loan counts, which a scan of the live state mid-write would not.
+static void runReadViews(Library& library, const BenchmarkOptions& options, vector<BenchmarkResult>& results) {
+    size_t threads = max<size_t>(1, min(options.threads, options.members));
+    vector<vector<uint64_t>> latencies;
+    double seconds = driveTraffic(library, options, threads, latencies);
+    results.push_back(mergeLatencies("writers_alone", latencies, seconds));
+
+    atomic<bool> writing(true);
+    size_t inconsistent = 0;
+    vector<uint64_t> opens, scans;
+    thread reporter([&]() {
+        while (writing.load()) {
+            auto opened = chrono::steady_clock::now();
+            Library::ReadView view = library.openReadView();
+            auto scanning = chrono::steady_clock::now();
+            size_t onLoan = 0, memberLoans = 0;
+            for (uint32_t ordinal = 0; ordinal < view.bookCount(); ++ordinal) {
+                onLoan += !view.isAvailable(ordinal) && view.borrower(ordinal) && view.loanNumber(ordinal);
+            }
+            for (MemberStore::Handle handle = 0; handle < view.memberCount(); ++handle) {
+                memberLoans += static_cast<size_t>(view.issuedCount(handle));
+            }
+            inconsistent += onLoan != memberLoans;
+            auto done = chrono::steady_clock::now();
+            opens.push_back(static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(scanning - opened).count()));
+            scans.push_back(static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(done - scanning).count()));
+        }
+    });
+    seconds = driveTraffic(library, options, threads, latencies);
+    writing = false;
+    reporter.join();
+    results.push_back(mergeLatencies("writers_with_report", latencies, seconds));
+    results.push_back(mergeLatencies("openReadView", vector<vector<uint64_t>>(1, opens), seconds));
+    results.push_back(mergeLatencies("readview_report_scan", vector<vector<uint64_t>>(1, scans), seconds));
+    printf("read views: %zu report(s) alongside the writers, %zu inconsistent, %zu copies awaiting reclamation\n",
+           scans.size(), inconsistent, library.pendingViewCopies());
+    if (inconsistent != 0) {
+        cerr << "warning: " << inconsistent << " read view(s) were inconsistent\n";
+    }
+}
+
+// Seals every returned loan so far (as if the month had ended), then queries
+// member and book history from the sealed segments
+static void runHistory(Library& library, const BenchmarkOptions& options, vector<BenchmarkResult>& results) {
+    Library::HistoryStats live = library.readHistoryStats();
+    auto started = chrono::steady_clock::now();
+    size_t sealed = library.sealHistory(time(nullptr) + 62 * Transaction::SECONDS_PER_DAY);
+    BenchmarkResult seal = { "sealHistory_loans", sealed,
+                             chrono::duration<double>(chrono::steady_clock::now() - started).count(), 0, 0, 0, 0, 0, 0 };
+    results.push_back(seal);
+    Library::HistoryStats after = library.readHistoryStats();
+    if (after.sealedLoans != 0) {
+        printf("history: %zu loans sealed into %zu segment(s), %.1f bytes/loan sealed vs %zu bytes/loan live\n",
+               after.sealedLoans, after.segments, static_cast<double>(after.sealedBytes) / after.sealedLoans,
+               live.liveLoans ? live.liveBytes / live.liveLoans : TransactionHistory::liveBytesPerLoan());
+    }
+
+    mt19937_64 rng(9);
+    size_t ops = min<size_t>(options.ops, 2000);
+    LatencyRecorder byMember(ops), byBook(ops);
+    for (size_t i = 0; i < ops; ++i) {
+        string memberId = memberIdFor(rng() % options.members);
+        string bookId = bookIdFor(rng() % options.books);
+        byMember.begin();
+        library.getMemberHistory(memberId);
+        byMember.end();
+        byBook.begin();
+        library.getBookHistory(bookId);
+        byBook.end();
+    }
+    results.push_back(byMember.finish("getMemberHistory"));
+    results.push_back(byBook.finish("getBookHistory"));
+}
+
+// Saves the whole library, then times a cold start: a fresh library loading
+// that snapshot. Where the platform allows, the file is first dropped from the
+// page cache so the load has to fault it in from disk.
+static void runSnapshot(Library& library, const BenchmarkOptions& options, vector<BenchmarkResult>& results) {
+    const char* path = "benchmark.snapshot";
+    size_t records = options.books + options.members;
+    auto started = chrono::steady_clock::now();
+    library.saveSnapshot(path);
+    BenchmarkResult save = { "saveSnapshot_records", records,
+                             chrono::duration<double>(chrono::steady_clock::now() - started).count(), 0, 0, 0, 0, 0, 0 };
+    results.push_back(save);
+#if defined(POSIX_FADV_DONTNEED)
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+#endif
+    size_t bytes = 0;
+    {
+        ifstream file(path, ios::binary | ios::ate);
+        bytes = file ? static_cast<size_t>(file.tellg()) : 0;
+    }
+
+    started = chrono::steady_clock::now();
+    {
+        Library restored;
+        restored.setOutputMode(OutputSink::Mode::Headless);
+        restored.loadSnapshot(path);
+        BenchmarkResult load = { "loadSnapshot_cold_start", records,
+                                 chrono::duration<double>(chrono::steady_clock::now() - started).count(), 0, 0, 0, 0, 0, 0 };
+        results.push_back(load);
+    }
+    printf("snapshot: %.1f MB, saved in %.0f ms, loaded from cold in %.0f ms\n", bytes / 1048576.0,
+           save.seconds * 1000, results.back().seconds * 1000);
+    remove(path);
+}
+
+// Circulation analytics at 1, 2, 4, ... threads up to the hardware thread
+// count (or --threads, if larger): first over the library's own history, then over --analytics-loans
+// synthetic loans (Zipf-distributed books, a year of issue dates, 5% still
+// open) fed straight to CirculationAnalytics, which shows how the scan scales
+static void runAnalytics(Library& library, const BenchmarkOptions& options, vector<BenchmarkResult>& results) {
+    size_t widest = max<size_t>(options.threads, thread::hardware_concurrency());
+    vector<size_t> threadCounts;
+    for (size_t threads = 1; threads < widest; threads *= 2) {
+        threadCounts.push_back(threads);
+    }
+    threadCounts.push_back(widest);
+
+    time_t now = time(nullptr);
+    for (size_t threads : threadCounts) {
+        library.setAnalyticsThreads(threads);
+        library.analyzeCirculation(now); // start the pool and categorize the catalog
+        LatencyRecorder runs(options.reportRuns);
+        for (size_t i = 0; i < options.reportRuns; ++i) {
+            runs.begin();
+            library.analyzeCirculation(now);
+            runs.end();
+        }
+        results.push_back(runs.finish("analyzeCirculation_" + to_string(threads) + "_threads"));
+    }
+    library.setAnalyticsThreads(0);
+
+    vector<uint32_t> categoryBySymbol(symbols().size(), CirculationAnalytics::NO_CATEGORY);
+    vector<Symbol> books(options.books), members(options.members);
+    vector<string> categoryNames;
+    for (size_t i = 0; i < 40; ++i) {
+        categoryNames.push_back("Category " + to_string(i));
+    }
+    for (size_t i = 0; i < options.books; ++i) {
+        books[i] = symbols().intern(bookIdFor(i));
+        categoryBySymbol[books[i].getValue()] = static_cast<uint32_t>(i % 40);
+    }
+    for (size_t i = 0; i < options.members; ++i) {
+        members[i] = symbols().intern(memberIdFor(i));
+    }
+    vector<LoanFacts> loans(options.analyticsLoans);
+    {
+        ZipfGenerator zipf(options.books, options.zipfExponent);
+        mt19937_64 rng(23);
+        time_t start = now - 365 * Transaction::SECONDS_PER_DAY;
+        for (size_t i = 0; i < loans.size(); ++i) {
+            LoanFacts& loan = loans[i];
+            loan.bookId = books[zipf(rng)];
+            loan.memberId = members[rng() % options.members];
+            loan.kind = BookKind::Book;
+            loan.issued = start + static_cast<time_t>(rng() % (365 * Transaction::SECONDS_PER_DAY));
+            if (rng() % 20 == 0) {
+                loan.returned = 0;
+                loan.finePaise = 0;
+            } else {
+                loan.returned = min(now, loan.issued + static_cast<time_t>(rng() % (30 * Transaction::SECONDS_PER_DAY)));
+                loan.finePaise = llround(Transaction::fineFor(loan.issued, loan.returned, loan.kind) * 100.0);
+            }
+        }
+    }
+    vector<shared_ptr<const HistorySegment>> sealed;
+    double baseline = 0.0;
+    for (size_t threads : threadCounts) {
+        WorkerPool pool(threads);
+        LatencyRecorder runs(options.reportRuns);
+        AnalyticsReport report;
+        for (size_t i = 0; i < max<size_t>(1, options.reportRuns / 4); ++i) {
+            runs.begin();
+            report = CirculationAnalytics::run(pool, loans, sealed, categoryBySymbol, categoryNames,
+                                               symbols().size(), now, 10);
+            runs.end();
+        }
+        BenchmarkResult result = runs.finish("analytics_" + to_string(threads) + "_threads");
+        if (threads == 1) {
+            baseline = result.p50;
+        }
+        printf("analytics: %zu loans on %zu thread(s): %.1f ms, %.0f M loans/s, speedup %.2fx\n",
+               loans.size(), threads, result.p50 / 1e6, loans.size() / result.p50 * 1e3,
+               result.p50 > 0 ? baseline / result.p50 : 0.0);
+        if (report.loans != loans.size()) {
+            cerr << "warning: analytics counted " << report.loans << " of " << loans.size() << " loans\n";
+        }
+        results.push_back(result);
+    }
+}
+
+// A separate catalog with books, e-books and journals in equal shares; the
+// subtype queries scan only the e-book or journal side table
+static void runSubtypes(const BenchmarkOptions& options, vector<BenchmarkResult>& results) {
+    Library mixed;
+    mixed.setOutputMode(OutputSink::Mode::Headless);
+    for (size_t i = 0; i < options.books; ++i) {
+        string id = bookIdFor(i);
+        string author = "Author " + to_string(i % 5000);
+        string category = "Category " + to_string(i % 40);
+        if (i % 3 == 0) {
+            mixed.addBook(id, titleFor(i), author, category);
+        } else if (i % 3 == 1) {
+            mixed.addEBook(id, titleFor(i), author, category, "PDF", static_cast<int>(i % 100));
+        } else {
+            mixed.addJournal(id, titleFor(i), author, category, static_cast<int>(i % 60), 1, "2024");
+        }
+    }
+    LatencyRecorder large(options.reportRuns), volume(options.reportRuns);
+    size_t found = 0;
+    for (size_t i = 0; i < options.reportRuns; ++i) {
+        large.begin();
+        found += mixed.findEBooksLargerThan(89).size();
+        large.end();
+        volume.begin();
+        found += mixed.findJournalsByVolume(static_cast<int>(i % 60)).size();
+        volume.end();
+    }
+    results.push_back(large.finish("findEBooksLargerThan"));
+    results.push_back(volume.finish("findJournalsByVolume"));
+    if (found == 0 && options.books >= 3) {
+        cerr << "warning: subtype queries found no books\n";
+    }
+}
+
+static void runImport(const BenchmarkOptions& options, vector<BenchmarkResult>& results) {
+    const char* path = "benchmark_import.csv";
+    {
+        ofstream file(path);
+        file << "id,title,author,category\n";
+        for (size_t i = 0; i < options.books; ++i) {
+            file << bookIdFor(i) << "," << titleFor(i) << ",Author " << i % 5000 << ",Category " << i % 40 << "\n";
+        }
+    }
+    Library fresh;
+    ImportReport report;
+    {
+        QuietConsole quiet;
+        report = fresh.importBooks(path);
+    }
+    remove(path);
+    BenchmarkResult result = { "importBooks_rows", report.rows, report.seconds, 0, 0, 0, 0, 0, 0 };
+    results.push_back(result);
+}
+
+// A separate library holding --overdue-loans open loans, replayed from a
+// journal of issues dated 1 to 60 days back, so most are past due. The main
+// library's traffic returns every loan it issues, and issues them "now".
+static void runOverdue(const BenchmarkOptions& options, vector<BenchmarkResult>& results) {
+    const char* path = "benchmark_overdue.journal";
+    size_t loans = options.overdueLoans;
+    size_t members = (loans + 4) / 5;
+    remove(path);
+    {
+        TransactionJournal journal;
+        journal.open(path, 0);
+        mt19937_64 rng(31);
+        time_t now = time(nullptr);
+        for (size_t i = 0; i < loans; ++i) {
+            time_t issued = now - static_cast<time_t>(1 + rng() % 60) * Transaction::SECONDS_PER_DAY;
+            journal.append(JournalOp::Issue, issued, static_cast<uint32_t>(i + 1), memberIdFor(i % members), bookIdFor(i));
+        }
+        journal.commit(journal.lastLsn());
+    }
+    {
+        Library library;
+        library.setOutputMode(OutputSink::Mode::Headless);
+        for (size_t i = 0; i < loans; ++i) {
+            library.addBook(bookIdFor(i), titleFor(i), "Author " + to_string(i % 5000), "Category " + to_string(i % 40));
+        }
+        for (size_t i = 0; i < members; ++i) {
+            library.addMember(Member(memberIdFor(i), "Member " + to_string(i), "member@example.com", 5));
+        }
+        auto started = chrono::steady_clock::now();
+        size_t replayed = library.openJournal(path);
+        BenchmarkResult replay = { "replay_open_loans", replayed,
+                                   chrono::duration<double>(chrono::steady_clock::now() - started).count(), 0, 0, 0, 0, 0, 0 };
+        results.push_back(replay);
+
+        QuietConsole quiet;
+        LatencyRecorder report(options.reportRuns);
+        for (size_t i = 0; i < options.reportRuns; ++i) {
+            report.begin();
+            library.generateOverdueReport();
+            report.end();
+        }
+        results.push_back(report.finish("generateOverdueReport_open"));
+    }
+    remove(path);
+}
+
+static void writeCsv(const string& path, const BenchmarkOptions& options, const vector<BenchmarkResult>& results) {
+    ofstream out(path.c_str());
+    out.setf(ios::fixed);
+    out.precision(6);
+    out << "label,benchmark,books,members,ops,seconds,ops_per_sec,p50_ns,p99_ns,p999_ns,max_ns,"
+           "allocs_per_op,rss_bytes_per_op\n";
+    for (const BenchmarkResult& r : results) {
+        out << options.label << "," << r.name << "," << options.books << "," << options.members << ","
+            << r.ops << "," << r.seconds << "," << (r.seconds > 0 ? r.ops / r.seconds : 0) << ","
+            << r.p50 << "," << r.p99 << "," << r.p999 << "," << r.max << "," << r.allocationsPerOp << ","
+            << r.residentBytesPerOp << "\n";
+    }
+}
+
+static void writeJson(const string& path, const BenchmarkOptions& options, const vector<BenchmarkResult>& results) {
+    ofstream out(path.c_str());
+    out.setf(ios::fixed);
+    out.precision(6);
+    out << "{\n  \"label\": \"" << options.label << "\",\n  \"books\": " << options.books
+        << ",\n  \"members\": " << options.members << ",\n  \"zipf\": " << options.zipfExponent
+        << ",\n  \"metrics\": " << (options.metrics ? "true" : "false")
+        << ",\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchmarkResult& r = results[i];
+        out << "    {\"benchmark\": \"" << r.name << "\", \"ops\": " << r.ops << ", \"seconds\": " << r.seconds
+            << ", \"ops_per_sec\": " << (r.seconds > 0 ? r.ops / r.seconds : 0) << ", \"p50_ns\": " << r.p50
+            << ", \"p99_ns\": " << r.p99 << ", \"p999_ns\": " << r.p999 << ", \"max_ns\": " << r.max
+            << ", \"allocs_per_op\": " << r.allocationsPerOp << ", \"rss_bytes_per_op\": " << r.residentBytesPerOp << "}"
+            << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+static void printTable(const vector<BenchmarkResult>& results) {
+    printf("%-30s %10s %12s %10s %10s %10s %10s\n", "benchmark", "ops", "ops/s", "p50 ns", "p99 ns", "p999 ns", "max ns");
+    for (const BenchmarkResult& r : results) {
+        printf("%-30s %10zu %12.0f %10.0f %10.0f %10.0f %10.0f\n", r.name.c_str(), r.ops,
+               r.seconds > 0 ? r.ops / r.seconds : 0.0, r.p50, r.p99, r.p999, r.max);
+    }
+}
+
+static void usage() {
+    cerr << "Usage: SmartLibraryBenchmark [--books N] [--members N] [--ops N] [--threads N]\n"
+            "                             [--report-runs N] [--analytics-loans N] [--overdue-loans N]\n"
+            "                             [--zipf S] [--metrics on|off]\n"
+            "                             [--journal PATH] [--csv PATH] [--json PATH] [--label TEXT]\n";
+}
+
+int main(int argc, char** argv) {
+    BenchmarkOptions options;
+    for (int i = 1; i < argc; ++i) {
+        string flag = argv[i];
+        if (i + 1 >= argc) {
+            usage();
+            return 1;
+        }
+        string value = argv[++i];
+        if (flag == "--books") options.books = strtoul(value.c_str(), nullptr, 10);
+        else if (flag == "--members") options.members = strtoul(value.c_str(), nullptr, 10);
+        else if (flag == "--ops") options.ops = strtoul(value.c_str(), nullptr, 10);
+        else if (flag == "--threads") options.threads = strtoul(value.c_str(), nullptr, 10);
+        else if (flag == "--analytics-loans") options.analyticsLoans = strtoul(value.c_str(), nullptr, 10);
+        else if (flag == "--overdue-loans") options.overdueLoans = strtoul(value.c_str(), nullptr, 10);
+        else if (flag == "--report-runs") options.reportRuns = strtoul(value.c_str(), nullptr, 10);
+        else if (flag == "--zipf") options.zipfExponent = strtod(value.c_str(), nullptr);
+        else if (flag == "--metrics") options.metrics = value != "off";
+        else if (flag == "--journal") options.journalPath = value;
+        else if (flag == "--csv") options.csvPath = value;
+        else if (flag == "--json") options.jsonPath = value;
+        else if (flag == "--label") options.label = value;
+        else {
+            usage();
+            return 1;
+        }
+    }
+    if (options.books < 100 || options.members < 10 || options.ops == 0) {
+        cerr << "Need at least 100 books, 10 members and 1 operation.\n";
+        return 1;
+    }
+
+    vector<BenchmarkResult> results;
+    runFootprint(options, results);
+    {
+        Library library;
+        library.setOutputMode(OutputSink::Mode::Headless);
+        library.setMetricsEnabled(options.metrics);
+        auto started = chrono::steady_clock::now();
+        populate(library, options);
+        BenchmarkResult setup = { "addBook_addMember", options.books + options.members,
+                                  chrono::duration<double>(chrono::steady_clock::now() - started).count(), 0, 0, 0, 0, 0, 0 };
+        results.push_back(setup);
+        if (!options.journalPath.empty()) {
+            remove(options.journalPath.c_str());
+            library.openJournal(options.journalPath);
+        }
+
+        runLookups(library, options, results);
+        runCirculation(library, options, results);
+        runErrorPath(library, options, results);
+        runBatches(library, options, results);
+        runSearch(library, options, results);
+        runConcurrent(library, options, results);
+        runReadViews(library, options, results);
+        runReports(library, options, results);
+        runOrdered(library, options, results);
+        runHistory(library, options, results);
+        runSnapshot(library, options, results);
+        runAnalytics(library, options, results);
+        if (!options.journalPath.empty()) {
+            remove(options.journalPath.c_str());
+        }
+    }
+    runSubtypes(options, results);
+    runImport(options, results);
+    if (options.overdueLoans != 0) {
+        runOverdue(options, results);
+    }
+
+    printTable(results);
+    if (!options.csvPath.empty()) {
+        writeCsv(options.csvPath, options, results);
+    }
+    if (!options.jsonPath.empty()) {
+        writeJson(options.jsonPath, options, results);
+    }
+    return 0;
+}
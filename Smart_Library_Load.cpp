@@ -0,0 +1,297 @@
+// Load generator for SmartLibraryServer. Opens --connections client
+// connections, each on its own thread, keeps up to --depth commands in flight
+// on each (pipelined), and reports requests per second and latency
+// percentiles. The server must use the synthetic catalog (B0.., M0..) with at
+// least as many books and members as given here.
+//
+//   g++ -std=c++11 -O2 -pthread Smart_Library_Load.cpp -o SmartLibraryLoad
+//   ./SmartLibraryLoad --port 7070 --connections 16 --depth 32 --seconds 10
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cctype>
+#include <cstdint>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+using namespace std;
+
+struct LoadOptions {
+    int port;
+    string unixPath;
+    size_t connections;
+    size_t depth;
+    double seconds;
+    double findRatio;
+    size_t books;
+    size_t members;
+    LoadOptions()
+        : port(7070), connections(8), depth(16), seconds(5.0), findRatio(0.5), books(100000), members(10000) {}
+};
+
+struct ClientStats {
+    uint64_t requests;
+    uint64_t errors;    // ERR replies
+    uint64_t failures;  // connection problems
+    vector<uint32_t> latencies; // microseconds
+    ClientStats() : requests(0), errors(0), failures(0) {}
+};
+
+static int connectTo(const LoadOptions& options) {
+    int fd;
+    if (!options.unixPath.empty()) {
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        struct sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, options.unixPath.c_str(), sizeof(address.sun_path) - 1);
+        if (fd >= 0 && connect(fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) < 0) {
+            close(fd);
+            return -1;
+        }
+    } else {
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_port = htons(static_cast<uint16_t>(options.port));
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (fd >= 0 && connect(fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) < 0) {
+            close(fd);
+            return -1;
+        }
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    return fd;
+}
+
+// One client connection. It owns every books-th/connections-th book and
+// member, so clients never contend for the same loan: it issues its books
+// in turn to its members in turn and returns the oldest loan once enough are
+// open. Since the server answers a connection in order, the client can track
+// its loans before the replies arrive.
+class LoadClient {
+    private:
+        const LoadOptions& options;
+        size_t index;
+        size_t ownedBooks, ownedMembers;
+        size_t nextBook, nextMember;
+        size_t maxOpen;
+        deque<pair<size_t, size_t>> openLoans; // (member, book) slots
+        mt19937_64 rng;
+        ClientStats& stats;
+    
+        string bookId(size_t slot) const { return "B" + to_string(index + slot * options.connections); }
+        string memberId(size_t slot) const { return "M" + to_string(index + slot * options.connections); }
+    
+        void nextCommand(string& out) {
+            bool find = uniform_real_distribution<double>(0.0, 1.0)(rng) < options.findRatio;
+            if (find) {
+                out += "FIND " + bookId(rng() % ownedBooks) + "\n";
+            } else if (openLoans.size() < maxOpen && (openLoans.empty() || (rng() & 1))) {
+                pair<size_t, size_t> loan(nextMember, nextBook);
+                nextMember = (nextMember + 1) % ownedMembers;
+                nextBook = (nextBook + 1) % ownedBooks;
+                openLoans.push_back(loan);
+                out += "ISSUE " + memberId(loan.first) + " " + bookId(loan.second) + "\n";
+            } else {
+                pair<size_t, size_t> loan = openLoans.front();
+                openLoans.pop_front();
+                out += "RETURN " + memberId(loan.first) + " " + bookId(loan.second) + "\n";
+            }
+        }
+    
+    public:
+        LoadClient(const LoadOptions& o, size_t i, ClientStats& s)
+            : options(o), index(i), nextBook(0), nextMember(0), rng(1000 + i), stats(s) {
+            ownedBooks = (options.books - index + options.connections - 1) / options.connections;
+            ownedMembers = (options.members - index + options.connections - 1) / options.connections;
+            // Two open loans per member at most, and fewer loans than books so
+            // the next book in turn has always been returned
+            maxOpen = min(ownedMembers * 2, min<size_t>(ownedBooks / 2, 64));
+        }
+    
+        void run(chrono::steady_clock::time_point deadline) {
+            int fd = connectTo(options);
+            if (fd < 0) {
+                perror("connect");
+                stats.failures++;
+                return;
+            }
+            deque<chrono::steady_clock::time_point> sent;
+            string out;
+            vector<char> in(64 * 1024);
+            size_t buffered = 0;
+            bool sending = true;
+            while (sending || !sent.empty()) {
+                if (sending && chrono::steady_clock::now() >= deadline) {
+                    sending = false;
+                    if (sent.empty()) {
+                        break;
+                    }
+                }
+                if (sending && sent.size() < options.depth) {
+                    out.clear();
+                    auto now = chrono::steady_clock::now();
+                    while (sent.size() < options.depth) {
+                        nextCommand(out);
+                        sent.push_back(now);
+                    }
+                    size_t written = 0;
+                    while (written < out.size()) {
+                        ssize_t n = write(fd, out.data() + written, out.size() - written);
+                        if (n <= 0) {
+                            if (n < 0 && errno == EINTR) {
+                                continue;
+                            }
+                            stats.failures++;
+                            close(fd);
+                            return;
+                        }
+                        written += static_cast<size_t>(n);
+                    }
+                }
+                ssize_t got = read(fd, in.data() + buffered, in.size() - buffered);
+                if (got <= 0) {
+                    if (got < 0 && errno == EINTR) {
+                        continue;
+                    }
+                    stats.failures++;
+                    break;
+                }
+                buffered += static_cast<size_t>(got);
+                auto now = chrono::steady_clock::now();
+                size_t start = 0;
+                for (size_t i = 0; i < buffered; ++i) {
+                    if (in[i] != '\n') {
+                        continue;
+                    }
+                    if (sent.empty()) {
+                        stats.failures++; // reply without a request
+                        close(fd);
+                        return;
+                    }
+                    if (in[start] == 'E') {
+                        stats.errors++;
+                    }
+                    stats.latencies.push_back(static_cast<uint32_t>(
+                        chrono::duration_cast<chrono::microseconds>(now - sent.front()).count()));
+                    sent.pop_front();
+                    stats.requests++;
+                    start = i + 1;
+                }
+                if (start == 0 && buffered == in.size()) {
+                    in.resize(in.size() * 2); // a reply longer than the buffer
+                }
+                memmove(in.data(), in.data() + start, buffered - start);
+                buffered -= start;
+            }
+            close(fd);
+        }
+    };
+
+// Whole-string decimal in [low, high]; false for anything else (signs,
+// trailing text, overflow)
+template<typename T>
+static bool parseNumber(const string& text, unsigned long low, unsigned long high, T& value) {
+    if (text.empty() || !isdigit(static_cast<unsigned char>(text[0]))) {
+        return false;
+    }
+    errno = 0;
+    char* end = nullptr;
+    unsigned long parsed = strtoul(text.c_str(), &end, 10);
+    if (errno != 0 || *end != '\0' || parsed < low || parsed > high) {
+        return false;
+    }
+    value = static_cast<T>(parsed);
+    return true;
+}
+
+static void usage() {
+    cerr << "Usage: SmartLibraryLoad [--port N | --unix PATH] [--connections N] [--depth N] [--seconds S]\n"
+            "                        [--find-ratio R] [--books N] [--members N]\n";
+}
+
+int main(int argc, char** argv) {
+    LoadOptions options;
+    for (int i = 1; i < argc; ++i) {
+        string flag = argv[i];
+        if (i + 1 >= argc) {
+            usage();
+            return 1;
+        }
+        string value = argv[++i];
+        bool valid = true;
+        if (flag == "--port") valid = parseNumber(value, 1, 65535, options.port);
+        else if (flag == "--unix") options.unixPath = value;
+        else if (flag == "--connections") valid = parseNumber(value, 1, 65536, options.connections);
+        else if (flag == "--depth") valid = parseNumber(value, 1, 65536, options.depth);
+        else if (flag == "--seconds") options.seconds = strtod(value.c_str(), nullptr);
+        else if (flag == "--find-ratio") options.findRatio = strtod(value.c_str(), nullptr);
+        else if (flag == "--books") valid = parseNumber(value, 0, UINT32_MAX, options.books);
+        else if (flag == "--members") valid = parseNumber(value, 0, UINT32_MAX, options.members);
+        else {
+            usage();
+            return 1;
+        }
+        if (!valid) {
+            cerr << "Invalid value for " << flag << ": " << value << "\n";
+            return 1;
+        }
+    }
+    if (options.connections == 0 || options.depth == 0 || options.books < 4 * options.connections
+        || options.members < options.connections) {
+        cerr << "Need at least 1 connection, a depth of 1, 4 books and 1 member per connection.\n";
+        return 1;
+    }
+
+    vector<ClientStats> stats(options.connections);
+    vector<thread> clients;
+    auto started = chrono::steady_clock::now();
+    auto deadline = started + chrono::microseconds(static_cast<int64_t>(options.seconds * 1e6));
+    for (size_t i = 0; i < options.connections; ++i) {
+        clients.push_back(thread([&options, &stats, i, deadline] {
+            LoadClient client(options, i, stats[i]);
+            client.run(deadline);
+        }));
+    }
+    for (auto& client : clients) {
+        client.join();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+
+    ClientStats total;
+    for (ClientStats& client : stats) {
+        total.requests += client.requests;
+        total.errors += client.errors;
+        total.failures += client.failures;
+        total.latencies.insert(total.latencies.end(), client.latencies.begin(), client.latencies.end());
+    }
+    sort(total.latencies.begin(), total.latencies.end());
+    auto at = [&total](double q) {
+        return total.latencies.empty()
+                   ? 0u
+                   : total.latencies[min(total.latencies.size() - 1, static_cast<size_t>(q * total.latencies.size()))];
+    };
+    printf("%zu connection(s), depth %zu: %llu requests in %.2f s, %.0f requests/s\n", options.connections,
+           options.depth, static_cast<unsigned long long>(total.requests), seconds, total.requests / seconds);
+    printf("latency us: p50 %u  p99 %u  p999 %u  max %u\n", at(0.50), at(0.99), at(0.999),
+           total.latencies.empty() ? 0u : total.latencies.back());
+    printf("error replies: %llu, connection failures: %llu\n", static_cast<unsigned long long>(total.errors),
+           static_cast<unsigned long long>(total.failures));
+    return total.failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,732 @@
+// Request server for the library engine: many local clients share one Library
+// over TCP (127.0.0.1) or a Unix socket. Linux only (epoll, eventfd, signalfd).
+//
+//   g++ -std=c++11 -O2 -pthread Smart_Library_Server.cpp -o SmartLibraryServer
+//   ./SmartLibraryServer --port 7070 --books 100000 --members 10000
+//   ./SmartLibraryServer --unix /tmp/smartlib.sock --snapshot library.snapshot --journal library.journal
+//
+// Line protocol: one command per line, words separated by spaces, one reply
+// line per command, in order. Clients may pipeline any number of commands.
+//
+//   ISSUE <member> <book>   -> OK ISSUED | OK RESERVED | ERR <status>
+//   RETURN <member> <book>  -> OK RETURNED | ERR <status>
+//   FIND <book>             -> OK <id>\t<title>\t<author>\t<category>\t<Available|Issued> | ERR NOT_FOUND
+//   REPORT                  -> OK books=<n> available=<n> issued=<n> members=<n> live_loans=<n> sealed_loans=<n>
+//   PING                    -> OK PONG
+//
+// One thread runs the epoll loop: it accepts connections, reads and splits
+// request lines, and writes replies. Each round of the loop collects the
+// commands read from every ready connection into one batch per worker thread;
+// a connection always goes to the same worker, so its replies come back in
+// request order. Workers apply runs of ISSUE/RETURN through processBatch (one
+// journal commit per run) and hand the replies back through an eventfd.
+#include "Smart_Library.h"
+#include <unordered_map>
+#include <climits>
+#include <csignal>
+#include <cerrno>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+struct ServerOptions {
+    int port;
+    string unixPath;
+    size_t workers;
+    size_t batchLimit;
+    size_t books;
+    size_t members;
+    string snapshotPath;
+    string journalPath;
+    ServerOptions() : port(7070), workers(4), batchLimit(256), books(100000), members(10000) {}
+};
+
+enum class CommandKind : uint8_t { Issue, Return, Find, Report, Ping, Invalid };
+
+struct Command {
+    uint64_t connection;
+    CommandKind kind;
+    string first;  // member ID, or the book ID for FIND; the error text for Invalid
+    string second; // book ID
+};
+
+struct Reply {
+    uint64_t connection;
+    string text; // without the newline
+};
+
+// Split one request line; unknown verbs and wrong argument counts become
+// Invalid commands so the reply still lines up with the request
+static Command parseCommand(uint64_t connection, const char* begin, const char* end) {
+    vector<string> words;
+    const char* p = begin;
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+            ++p;
+        }
+        const char* start = p;
+        while (p < end && *p != ' ' && *p != '\t' && *p != '\r') {
+            ++p;
+        }
+        if (p > start) {
+            words.push_back(string(start, p));
+        }
+    }
+    Command command;
+    command.connection = connection;
+    command.kind = CommandKind::Invalid;
+    if (words.empty()) {
+        command.first = "EMPTY_COMMAND";
+        return command;
+    }
+    string verb = words[0];
+    for (char& c : verb) {
+        c = static_cast<char>(toupper(static_cast<unsigned char>(c)));
+    }
+    size_t arguments = 0;
+    if (verb == "ISSUE") {
+        command.kind = CommandKind::Issue;
+        arguments = 2;
+    } else if (verb == "RETURN") {
+        command.kind = CommandKind::Return;
+        arguments = 2;
+    } else if (verb == "FIND") {
+        command.kind = CommandKind::Find;
+        arguments = 1;
+    } else if (verb == "REPORT") {
+        command.kind = CommandKind::Report;
+    } else if (verb == "PING") {
+        command.kind = CommandKind::Ping;
+    } else {
+        command.first = "UNKNOWN_COMMAND";
+        return command;
+    }
+    if (words.size() != arguments + 1) {
+        command.kind = CommandKind::Invalid;
+        command.first = "WRONG_ARGUMENTS";
+        return command;
+    }
+    if (arguments >= 1) {
+        command.first = words[1];
+    }
+    if (arguments == 2) {
+        command.second = words[2];
+    }
+    return command;
+}
+
+static const char* replyFor(CirculationStatus status) {
+    switch (status) {
+        case CirculationStatus::Issued: return "OK ISSUED";
+        case CirculationStatus::Returned: return "OK RETURNED";
+        case CirculationStatus::Reserved: return "OK RESERVED";
+        case CirculationStatus::InvalidMember: return "ERR INVALID_MEMBER";
+        case CirculationStatus::BookNotFound: return "ERR BOOK_NOT_FOUND";
+        case CirculationStatus::LimitReached: return "ERR LIMIT_REACHED";
+        case CirculationStatus::NoActiveLoan: break;
+    }
+    return "ERR NO_ACTIVE_LOAN";
+}
+
+// Worker threads, each with its own FIFO of batches. Replies are appended to a
+// shared completion list and the event loop is woken through an eventfd.
+class CommandWorkers {
+    private:
+        struct Queue {
+            mutex lock;
+            condition_variable wake;
+            deque<vector<Command>> batches;
+            bool stopping;
+            Queue() : stopping(false) {}
+        };
+    
+        Library& library;
+        vector<unique_ptr<Queue>> queues;
+        vector<thread> threads;
+        int wakeFd;
+        mutex completedLock;
+        vector<Reply> completed;
+    
+        // Apply the ISSUE/RETURN commands in [begin, end) as one processBatch
+        void applyCirculation(const vector<Command>& batch, size_t begin, size_t end, vector<Reply>& replies) {
+            vector<CirculationRequest> requests(end - begin);
+            for (size_t i = begin; i < end; ++i) {
+                CirculationRequest& request = requests[i - begin];
+                request.memberId = batch[i].first;
+                request.bookId = batch[i].second;
+                request.op = batch[i].kind == CommandKind::Issue ? CirculationOp::Issue : CirculationOp::Return;
+            }
+            vector<CirculationStatus> statuses = library.processBatch(requests);
+            for (size_t i = begin; i < end; ++i) {
+                Reply reply = { batch[i].connection, replyFor(statuses[i - begin]) };
+                replies.push_back(move(reply));
+            }
+        }
+    
+        string answer(const Command& command) {
+            switch (command.kind) {
+                case CommandKind::Find: {
+                    const Book* book = library.findBook(command.first);
+                    if (!book) {
+                        return "ERR NOT_FOUND";
+                    }
+                    return "OK " + book->getBookId() + "\t" + book->getTitle() + "\t" + book->getAuthor() + "\t"
+                           + book->getCategory() + "\t" + (book->getAvailability() ? "Available" : "Issued");
+                }
+                case CommandKind::Report: {
+                    Library::CatalogStats catalog = library.readCatalogStats();
+                    Library::HistoryStats history = library.readHistoryStats();
+                    return "OK books=" + to_string(catalog.books) + " available=" + to_string(catalog.available)
+                           + " issued=" + to_string(catalog.books - catalog.available)
+                           + " members=" + to_string(catalog.members) + " live_loans=" + to_string(history.liveLoans)
+                           + " sealed_loans=" + to_string(history.sealedLoans);
+                }
+                case CommandKind::Ping:
+                    return "OK PONG";
+                default:
+                    return "ERR " + command.first;
+            }
+        }
+    
+        void process(const vector<Command>& batch) {
+            vector<Reply> replies;
+            replies.reserve(batch.size());
+            size_t i = 0;
+            while (i < batch.size()) {
+                size_t end = i;
+                while (end < batch.size()
+                       && (batch[end].kind == CommandKind::Issue || batch[end].kind == CommandKind::Return)) {
+                    ++end;
+                }
+                if (end > i) {
+                    applyCirculation(batch, i, end, replies);
+                    i = end;
+                } else {
+                    Reply reply = { batch[i].connection, answer(batch[i]) };
+                    replies.push_back(move(reply));
+                    ++i;
+                }
+            }
+            {
+                lock_guard<mutex> guard(completedLock);
+                if (completed.empty()) {
+                    completed.swap(replies);
+                } else {
+                    completed.insert(completed.end(), make_move_iterator(replies.begin()),
+                                     make_move_iterator(replies.end()));
+                }
+            }
+            uint64_t one = 1;
+            if (write(wakeFd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+                perror("eventfd write");
+            }
+        }
+    
+        void run(size_t index) {
+            Queue& queue = *queues[index];
+            while (true) {
+                vector<Command> batch;
+                {
+                    unique_lock<mutex> guard(queue.lock);
+                    queue.wake.wait(guard, [&queue] { return !queue.batches.empty() || queue.stopping; });
+                    if (queue.batches.empty()) {
+                        return;
+                    }
+                    batch.swap(queue.batches.front());
+                    queue.batches.pop_front();
+                }
+                process(batch);
+            }
+        }
+    
+    public:
+        CommandWorkers(Library& l, size_t count, int fd) : library(l), wakeFd(fd) {
+            for (size_t i = 0; i < count; ++i) {
+                queues.push_back(unique_ptr<Queue>(new Queue()));
+            }
+            for (size_t i = 0; i < count; ++i) {
+                threads.push_back(thread(&CommandWorkers::run, this, i));
+            }
+        }
+    
+        // Finish the queued batches, then stop
+        ~CommandWorkers() {
+            for (auto& queue : queues) {
+                lock_guard<mutex> guard(queue->lock);
+                queue->stopping = true;
+            }
+            for (auto& queue : queues) {
+                queue->wake.notify_one();
+            }
+            for (auto& worker : threads) {
+                worker.join();
+            }
+        }
+    
+        size_t size() const { return queues.size(); }
+    
+        void submit(size_t worker, vector<Command>& batch) {
+            Queue& queue = *queues[worker];
+            {
+                lock_guard<mutex> guard(queue.lock);
+                queue.batches.push_back(vector<Command>());
+                queue.batches.back().swap(batch);
+            }
+            queue.wake.notify_one();
+        }
+    
+        void takeCompleted(vector<Reply>& out) {
+            lock_guard<mutex> guard(completedLock);
+            out.swap(completed);
+        }
+    };
+
+class RequestServer {
+    private:
+        static const size_t READ_CHUNK = 64 * 1024;
+        static const size_t MAX_LINE = 4096;
+        static const size_t MAX_IN_FLIGHT = 4096;      // per connection; reading pauses above this
+        static const size_t MAX_PENDING_OUTPUT = 1 << 20;
+    
+        struct Connection {
+            int fd;
+            string input;       // bytes after the last complete line
+            string output;      // replies not yet written
+            size_t inFlight;    // commands submitted, reply not yet queued
+            uint32_t interest;  // current epoll event mask
+            bool peerClosed;    // read side hit EOF; close once drained
+        };
+    
+        const ServerOptions& options;
+        int epollFd, listenFd, wakeFd, signalFd;
+        CommandWorkers workers;
+        unordered_map<uint64_t, Connection> connections;
+        uint64_t nextConnection;
+        vector<vector<Command>> pending; // per worker, for this round
+        vector<uint64_t> dirty;          // connections with new output this round
+        vector<Reply> replies;
+        uint64_t served;
+    
+        // Listener and connection IDs share the epoll data field with these
+        enum : uint64_t { LISTENER = 0, WAKE = 1, SIGNALS = 2, FIRST_CONNECTION = 3 };
+    
+        static void fail(const char* what) {
+            throw LibraryException(string(what) + ": " + strerror(errno));
+        }
+    
+        void watch(int fd, uint32_t events, uint64_t tag) {
+            struct epoll_event event;
+            event.events = events;
+            event.data.u64 = tag;
+            if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+                fail("epoll_ctl");
+            }
+        }
+    
+        int openListener() {
+            int fd;
+            if (!options.unixPath.empty()) {
+                fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+                if (fd < 0) {
+                    fail("socket");
+                }
+                struct sockaddr_un address;
+                memset(&address, 0, sizeof(address));
+                address.sun_family = AF_UNIX;
+                if (options.unixPath.size() >= sizeof(address.sun_path)) {
+                    throw LibraryException("Unix socket path too long: " + options.unixPath);
+                }
+                strcpy(address.sun_path, options.unixPath.c_str());
+                unlink(options.unixPath.c_str());
+                if (bind(fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) < 0) {
+                    fail("bind");
+                }
+            } else {
+                fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+                if (fd < 0) {
+                    fail("socket");
+                }
+                int on = 1;
+                setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+                struct sockaddr_in address;
+                memset(&address, 0, sizeof(address));
+                address.sin_family = AF_INET;
+                address.sin_port = htons(static_cast<uint16_t>(options.port));
+                address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+                if (bind(fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) < 0) {
+                    fail("bind");
+                }
+            }
+            if (listen(fd, SOMAXCONN) < 0) {
+                fail("listen");
+            }
+            return fd;
+        }
+    
+        void accept() {
+            while (true) {
+                int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (fd < 0) {
+                    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                        perror("accept");
+                    }
+                    return;
+                }
+                if (options.unixPath.empty()) {
+                    int on = 1;
+                    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+                }
+                uint64_t id = nextConnection++;
+                Connection& connection = connections[id];
+                connection.fd = fd;
+                connection.inFlight = 0;
+                connection.interest = EPOLLIN;
+                connection.peerClosed = false;
+                watch(fd, EPOLLIN, id);
+            }
+        }
+    
+        void close(uint64_t id) {
+            auto found = connections.find(id);
+            if (found != connections.end()) {
+                ::close(found->second.fd); // also removes it from the epoll set
+                connections.erase(found);
+            }
+        }
+    
+        // Read what is available and queue every complete line for this
+        // connection's worker
+        void receive(uint64_t id, Connection& connection) {
+            char chunk[READ_CHUNK];
+            while (connection.inFlight < MAX_IN_FLIGHT) {
+                ssize_t got = read(connection.fd, chunk, sizeof(chunk));
+                if (got == 0) {
+                    connection.peerClosed = true;
+                    break;
+                }
+                if (got < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                        connection.peerClosed = true;
+                        connection.output.clear();
+                    }
+                    break;
+                }
+                connection.input.append(chunk, static_cast<size_t>(got));
+                size_t start = 0;
+                size_t newline;
+                vector<Command>& batch = pending[id % workers.size()];
+                while ((newline = connection.input.find('\n', start)) != string::npos) {
+                    const char* line = connection.input.data();
+                    batch.push_back(parseCommand(id, line + start, line + newline));
+                    connection.inFlight++;
+                    start = newline + 1;
+                }
+                connection.input.erase(0, start);
+                if (connection.input.size() > MAX_LINE) {
+                    // Answered through the worker like any other command, so the
+                    // error follows the replies still in flight; then the
+                    // connection closes
+                    Command tooLong;
+                    tooLong.connection = id;
+                    tooLong.kind = CommandKind::Invalid;
+                    tooLong.first = "LINE_TOO_LONG";
+                    batch.push_back(tooLong);
+                    connection.inFlight++;
+                    connection.input.clear();
+                    connection.peerClosed = true;
+                    break;
+                }
+            }
+        }
+    
+        void markDirty(uint64_t id) {
+            dirty.push_back(id);
+        }
+    
+        // Hand this round's commands to the workers, at most batchLimit per batch
+        void dispatch() {
+            for (size_t worker = 0; worker < pending.size(); ++worker) {
+                vector<Command>& commands = pending[worker];
+                if (commands.size() <= options.batchLimit) {
+                    if (!commands.empty()) {
+                        workers.submit(worker, commands);
+                    }
+                    continue;
+                }
+                for (size_t begin = 0; begin < commands.size(); begin += options.batchLimit) {
+                    size_t end = min(commands.size(), begin + options.batchLimit);
+                    vector<Command> part(make_move_iterator(commands.begin() + begin),
+                                         make_move_iterator(commands.begin() + end));
+                    workers.submit(worker, part);
+                }
+                commands.clear();
+            }
+        }
+    
+        void collectReplies() {
+            uint64_t count;
+            if (read(wakeFd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+                perror("eventfd read");
+            }
+            replies.clear();
+            workers.takeCompleted(replies);
+            for (Reply& reply : replies) {
+                auto found = connections.find(reply.connection);
+                if (found == connections.end()) {
+                    continue; // client went away
+                }
+                Connection& connection = found->second;
+                connection.output += reply.text;
+                connection.output += '\n';
+                connection.inFlight--;
+                markDirty(reply.connection);
+            }
+            served += replies.size();
+        }
+    
+        // Write pending output, then close the connection if the client is done
+        // or adjust what epoll waits for
+        void flush(uint64_t id) {
+            auto found = connections.find(id);
+            if (found == connections.end()) {
+                return;
+            }
+            Connection& connection = found->second;
+            size_t written = 0;
+            while (written < connection.output.size()) {
+                ssize_t sent = send(connection.fd, connection.output.data() + written,
+                                    connection.output.size() - written, MSG_NOSIGNAL);
+                if (sent < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                        close(id);
+                        return;
+                    }
+                    break;
+                }
+                written += static_cast<size_t>(sent);
+            }
+            connection.output.erase(0, written);
+    
+            if (connection.peerClosed && connection.inFlight == 0 && connection.output.empty()) {
+                close(id);
+                return;
+            }
+            uint32_t interest = 0;
+            if (!connection.peerClosed && connection.inFlight < MAX_IN_FLIGHT
+                && connection.output.size() < MAX_PENDING_OUTPUT) {
+                interest |= EPOLLIN;
+            }
+            if (!connection.output.empty()) {
+                interest |= EPOLLOUT;
+            }
+            if (interest != connection.interest) {
+                struct epoll_event event;
+                event.events = interest;
+                event.data.u64 = id;
+                epoll_ctl(epollFd, EPOLL_CTL_MOD, connection.fd, &event);
+                connection.interest = interest;
+            }
+        }
+    
+    public:
+        RequestServer(Library& library, const ServerOptions& o, int signals)
+            : options(o), epollFd(epoll_create1(EPOLL_CLOEXEC)), listenFd(-1),
+              wakeFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)), signalFd(signals),
+              workers(library, max<size_t>(1, o.workers), wakeFd), nextConnection(FIRST_CONNECTION),
+              pending(max<size_t>(1, o.workers)), served(0) {
+            if (epollFd < 0 || wakeFd < 0) {
+                fail("epoll/eventfd");
+            }
+            listenFd = openListener();
+            watch(listenFd, EPOLLIN, LISTENER);
+            watch(wakeFd, EPOLLIN, WAKE);
+            watch(signalFd, EPOLLIN, SIGNALS);
+        }
+    
+        ~RequestServer() {
+            for (auto& entry : connections) {
+                ::close(entry.second.fd);
+            }
+            ::close(listenFd);
+            if (!options.unixPath.empty()) {
+                unlink(options.unixPath.c_str());
+            }
+            ::close(epollFd);
+        }
+    
+        // Serve until SIGINT or SIGTERM; returns the number of commands answered
+        uint64_t run() {
+            const int MAX_EVENTS = 256;
+            struct epoll_event events[MAX_EVENTS];
+            bool running = true;
+            while (running) {
+                int ready = epoll_wait(epollFd, events, MAX_EVENTS, -1);
+                if (ready < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    fail("epoll_wait");
+                }
+                for (int i = 0; i < ready; ++i) {
+                    uint64_t tag = events[i].data.u64;
+                    if (tag == LISTENER) {
+                        accept();
+                    } else if (tag == WAKE) {
+                        collectReplies();
+                    } else if (tag == SIGNALS) {
+                        running = false;
+                    } else {
+                        auto found = connections.find(tag);
+                        if (found == connections.end()) {
+                            continue;
+                        }
+                        if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                            receive(tag, found->second);
+                        }
+                        markDirty(tag);
+                    }
+                }
+                dispatch();
+                sort(dirty.begin(), dirty.end());
+                dirty.erase(unique(dirty.begin(), dirty.end()), dirty.end());
+                for (uint64_t id : dirty) {
+                    flush(id);
+                }
+                dirty.clear();
+            }
+            return served;
+        }
+    };
+
+static string bookIdFor(size_t i) { return "B" + to_string(i); }
+static string memberIdFor(size_t i) { return "M" + to_string(i); }
+
+// Same synthetic catalog as the benchmark, so the load tool can address it
+static void populate(Library& library, const ServerOptions& options) {
+    for (size_t i = 0; i < options.books; ++i) {
+        library.addBook(bookIdFor(i), "Title " + to_string(i), "Author " + to_string(i % 5000),
+                        "Category " + to_string(i % 40));
+    }
+    for (size_t i = 0; i < options.members; ++i) {
+        library.addMember(Member(memberIdFor(i), "Member " + to_string(i), "member" + to_string(i) + "@example.com", 5));
+    }
+}
+
+// Whole-string decimal in [low, high]; false for anything else (signs,
+// trailing text, overflow)
+template<typename T>
+static bool parseNumber(const string& text, unsigned long low, unsigned long high, T& value) {
+    if (text.empty() || !isdigit(static_cast<unsigned char>(text[0]))) {
+        return false;
+    }
+    errno = 0;
+    char* end = nullptr;
+    unsigned long parsed = strtoul(text.c_str(), &end, 10);
+    if (errno != 0 || *end != '\0' || parsed < low || parsed > high) {
+        return false;
+    }
+    value = static_cast<T>(parsed);
+    return true;
+}
+
+static void usage() {
+    cerr << "Usage: SmartLibraryServer [--port N | --unix PATH] [--workers N] [--batch N]\n"
+            "                          [--books N] [--members N] [--snapshot PATH] [--journal PATH]\n";
+}
+
+int main(int argc, char** argv) {
+    ServerOptions options;
+    for (int i = 1; i < argc; ++i) {
+        string flag = argv[i];
+        if (i + 1 >= argc) {
+            usage();
+            return 1;
+        }
+        string value = argv[++i];
+        bool valid = true;
+        if (flag == "--port") valid = parseNumber(value, 1, 65535, options.port);
+        else if (flag == "--unix") options.unixPath = value;
+        else if (flag == "--workers") valid = parseNumber(value, 1, 1024, options.workers);
+        else if (flag == "--batch") valid = parseNumber(value, 1, ULONG_MAX, options.batchLimit);
+        else if (flag == "--books") valid = parseNumber(value, 0, UINT32_MAX, options.books);
+        else if (flag == "--members") valid = parseNumber(value, 0, UINT32_MAX, options.members);
+        else if (flag == "--snapshot") options.snapshotPath = value;
+        else if (flag == "--journal") options.journalPath = value;
+        else {
+            usage();
+            return 1;
+        }
+        if (!valid) {
+            cerr << "Invalid value for " << flag << ": " << value
+                 << " (ports are 1-65535, workers 1-1024, the batch limit at least 1).\n";
+            return 1;
+        }
+    }
+
+    // Block the shutdown signals before any thread starts, so only the
+    // signalfd sees them
+    sigset_t shutdownSignals;
+    sigemptyset(&shutdownSignals);
+    sigaddset(&shutdownSignals, SIGINT);
+    sigaddset(&shutdownSignals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &shutdownSignals, nullptr);
+    int signals = signalfd(-1, &shutdownSignals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signals < 0) {
+        cerr << "Server error: signalfd: " << strerror(errno) << endl;
+        return 1;
+    }
+
+    Library library;
+    library.setOutputMode(OutputSink::Mode::Headless);
+    try {
+        bool restored = !options.snapshotPath.empty() && library.loadSnapshot(options.snapshotPath);
+        if (!restored) {
+            // Start any journal fresh on top of the generated data
+            populate(library, options);
+            if (!options.journalPath.empty()) {
+                remove(options.journalPath.c_str());
+            }
+            if (!options.snapshotPath.empty()) {
+                library.checkpoint(options.snapshotPath);
+            }
+        }
+        if (!options.journalPath.empty()) {
+            size_t replayed = library.openJournal(options.journalPath);
+            cout << "Journal " << options.journalPath << ": " << replayed << " change(s) replayed.\n";
+        }
+        Library::CatalogStats catalog = library.readCatalogStats();
+        cout << (restored ? "Restored " : "Generated ") << catalog.books << " books and " << catalog.members
+             << " members.\n";
+
+        uint64_t served;
+        {
+            RequestServer server(library, options, signals);
+            if (options.unixPath.empty()) {
+                cout << "Listening on 127.0.0.1:" << options.port;
+            } else {
+                cout << "Listening on " << options.unixPath;
+            }
+            cout << " with " << options.workers << " worker(s).\n" << flush;
+            served = server.run();
+        }
+        cout << "Shutting down after " << served << " command(s).\n";
+        if (!options.snapshotPath.empty()) {
+            library.checkpoint(options.snapshotPath);
+        }
+    } catch (const LibraryException& e) {
+        cerr << "Server error: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
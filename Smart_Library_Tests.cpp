@@ -0,0 +1,1297 @@
+// Behaviour checks for the library engine. Each test builds a small library,
+// drives it through the public interface and checks the results; a failed
+// check prints its location and makes the run exit non-zero, so this can gate
+// a build step. Scratch files are created in the current directory and
+// removed again.
+//
+//   g++ -std=c++11 -O2 -pthread Smart_Library_Tests.cpp -o SmartLibraryTests
+//   ./SmartLibraryTests            (all tests)
+//   ./SmartLibraryTests journal    (tests whose name contains "journal")
+#include "Smart_Library.h"
+
+static size_t checksRun = 0;
+static size_t checksFailed = 0;
+
+// Every global allocation in the process is counted, so tests can check how
+// often a code path reaches the allocator. (Kept out of line: GCC otherwise
+// pairs the inlined free() with the caller's new and warns.)
+static atomic<size_t> allocations(0);
+
+#ifdef __GNUC__
+#define OUT_OF_LINE __attribute__((noinline))
+#else
+#define OUT_OF_LINE
+#endif
+
+OUT_OF_LINE void* operator new(size_t size) {
+    allocations++;
+    void* memory = malloc(size ? size : 1);
+    if (!memory) {
+        throw bad_alloc();
+    }
+    return memory;
+}
+
+OUT_OF_LINE void operator delete(void* memory) noexcept {
+    free(memory);
+}
+
+#define CHECK(condition)                                                              \
+    do {                                                                              \
+        checksRun++;                                                                  \
+        if (!(condition)) {                                                           \
+            checksFailed++;                                                           \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+        }                                                                             \
+    } while (0)
+
+// Evaluates 'expression' and checks that it throws a LibraryException
+#define CHECK_THROWS(expression)                                                      \
+    do {                                                                              \
+        bool threw = false;                                                           \
+        try {                                                                         \
+            expression;                                                               \
+        } catch (const LibraryException&) {                                           \
+            threw = true;                                                             \
+        }                                                                             \
+        CHECK(threw);                                                                 \
+    } while (0)
+
+static size_t fileSize(const string& path) {
+    ifstream file(path.c_str(), ios::binary | ios::ate);
+    return file ? static_cast<size_t>(file.tellg()) : 0;
+}
+
+static bool fileExists(const string& path) {
+    return ifstream(path.c_str()).good();
+}
+
+// Resident set size, where the platform reports it (0 otherwise, and under
+// AddressSanitizer, whose redzones and shadow memory would be counted too)
+static size_t residentBytes() {
+    size_t resident = 0;
+#if defined(__linux__) && !defined(__SANITIZE_ADDRESS__)
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm) {
+        unsigned long pages = 0, residentPages = 0;
+        if (fscanf(statm, "%lu %lu", &pages, &residentPages) == 2) {
+            resident = residentPages * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        }
+        fclose(statm);
+    }
+#endif
+    return resident;
+}
+
+// A library with books B0..B<books-1> and members M0..M<members-1>
+static void populate(Library& library, size_t books, size_t members, int maxBooks = 5) {
+    library.setOutputMode(OutputSink::Mode::Headless);
+    for (size_t i = 0; i < books; ++i) {
+        library.addBook("B" + to_string(i), "Title " + to_string(i), "Author " + to_string(i % 7),
+                        "Category " + to_string(i % 3));
+    }
+    for (size_t i = 0; i < members; ++i) {
+        library.addMember(Member("M" + to_string(i), "Member " + to_string(i), "m" + to_string(i) + "@example.com",
+                                 maxBooks));
+    }
+}
+
+// Everything the callable writes to cout
+template <typename Callable>
+static string captureOutput(Callable call) {
+    ostringstream captured;
+    streambuf* saved = cout.rdbuf(captured.rdbuf());
+    call();
+    cout.rdbuf(saved);
+    return captured.str();
+}
+
+// ---- Journal and snapshot durability ----
+
+static void testJournalRoundTrip() {
+    const string path = "test_round_trip.journal";
+    remove(path.c_str());
+    {
+        TransactionJournal journal;
+        journal.open(path, 10);
+        uint64_t first = journal.append(JournalOp::Issue, 1000, 7, "M1", "B1");
+        uint64_t second = journal.append(JournalOp::Return, 2000, 7, "M1", "B1");
+        CHECK(first == 11 && second == 12);
+        journal.commit(second);
+    }
+    size_t validBytes = 0;
+    vector<TransactionJournal::Record> records = TransactionJournal::readAll(path, validBytes);
+    CHECK(records.size() == 2);
+    CHECK(validBytes == fileSize(path));
+    CHECK(records.size() == 2 && records[1].op == JournalOp::Return && records[1].lsn == 12
+          && records[1].memberId == "M1" && records[1].bookId == "B1");
+    remove(path.c_str());
+}
+
+// A crash mid-write leaves a torn record at the end; opening the journal cuts
+// it off on disk and replays everything before it
+static void testJournalTornTail() {
+    const string path = "test_torn_tail.journal";
+    remove(path.c_str());
+    {
+        Library library;
+        populate(library, 4, 2);
+        library.openJournal(path);
+        library.issueBook("M0", "B0");
+        library.issueBook("M1", "B1");
+    }
+    size_t intact = fileSize(path);
+    {
+        ofstream torn(path.c_str(), ios::binary | ios::app);
+        torn.write("\x20\x00\x00\x00garbage", 11); // claims 32 bytes, has 7
+    }
+    CHECK(fileSize(path) > intact);
+
+    Library library;
+    populate(library, 4, 2);
+    CHECK(library.openJournal(path) == 2);
+    CHECK(fileSize(path) == intact);
+    CHECK(!library.findBook("B0")->getAvailability() && !library.findBook("B1")->getAvailability());
+    remove(path.c_str());
+}
+
+// Once a write fails, the journal refuses every later append and commit
+// instead of reporting records durable that never reached the disk
+static void testJournalStickyFailure() {
+#ifdef __linux__
+    TransactionJournal journal;
+    journal.open("/dev/full", 0); // every write fails with ENOSPC
+    uint64_t lsn = journal.append(JournalOp::Issue, 1000, 1, "M1", "B1");
+    CHECK_THROWS(journal.commit(lsn));
+    CHECK_THROWS(journal.append(JournalOp::Return, 2000, 1, "M1", "B1"));
+    CHECK_THROWS(journal.commit(lsn));
+    CHECK_THROWS(journal.close());
+    CHECK(!journal.isOpen());
+#endif
+}
+
+// A checkpoint writes a complete snapshot before it empties the journal, and
+// the two together restore every change
+static void testCheckpoint() {
+    const string snapshot = "test_checkpoint.snapshot";
+    const string journalPath = "test_checkpoint.journal";
+    remove(snapshot.c_str());
+    remove(journalPath.c_str());
+    {
+        Library library;
+        populate(library, 10, 3);
+        library.openJournal(journalPath);
+        library.issueBook("M0", "B0");
+        library.issueBook("M1", "B1");
+        library.checkpoint(snapshot);
+        CHECK(fileSize(journalPath) == 0);
+        CHECK(!fileExists(snapshot + ".tmp"));
+        library.returnBook("M0", "B0");
+        library.issueBook("M2", "B2");
+    }
+    Library restored;
+    restored.setOutputMode(OutputSink::Mode::Headless);
+    CHECK(restored.loadSnapshot(snapshot));
+    CHECK(restored.openJournal(journalPath) == 2);
+    CHECK(restored.findBook("B0")->getAvailability());
+    CHECK(!restored.findBook("B1")->getAvailability() && !restored.findBook("B2")->getAvailability());
+    CHECK(restored.findMember("M0")->getIssuedBooksCount() == 0);
+    CHECK(restored.findMember("M2")->getIssuedBooksCount() == 1);
+    remove(snapshot.c_str());
+    remove(journalPath.c_str());
+}
+
+// Everything a snapshot holds comes back from it: every kind of book with its
+// subtype fields, members and their loans, live and sealed history, hold
+// queues and the transaction counter
+static void testSnapshotRoundTrip() {
+    const string path = "test_round_trip.snapshot";
+    {
+        Library library;
+        populate(library, 6, 3);
+        library.addEBook("E1", "Digital", "Author E", "Category E", "EPUB", 12);
+        library.addJournal("J1", "Quarterly", "Author J", "Category J", 7, 3, "2024-05");
+        library.issueBook("M0", "B0");
+        library.issueBook("M0", "B1");
+        library.returnBook("M0", "B1");
+        library.sealHistory(time(nullptr) + 62 * Transaction::SECONDS_PER_DAY);
+        library.issueBook("M1", "E1");
+        library.issueBook("M2", "B0"); // on loan, so M2 joins the hold queue
+        library.saveSnapshot(path);
+    }
+    CHECK(!fileExists(path + ".tmp"));
+
+    Library restored;
+    restored.setOutputMode(OutputSink::Mode::Headless);
+    CHECK(!restored.loadSnapshot("test_missing.snapshot"));
+    CHECK(restored.loadSnapshot(path));
+    CHECK(restored.readCatalogStats().books == 8);
+    CHECK(restored.findBook("B3")->getTitle() == "Title 3" && restored.findBook("B3")->getAuthor() == "Author 3");
+    CHECK(restored.findBook("E1")->getKind() == BookKind::EBook && restored.findBook("J1")->getKind() == BookKind::Journal);
+    const EBook* ebook = static_cast<const EBook*>(restored.findBook("E1"));
+    CHECK(ebook->getFormat() == "EPUB" && ebook->getFileSize() == 12 && !ebook->getAvailability());
+    const Journal* journal = static_cast<const Journal*>(restored.findBook("J1"));
+    CHECK(journal->getVolume() == 7 && journal->getIssue() == 3 && journal->getPublishDate() == "2024-05");
+    CHECK(!restored.findBook("B0")->getAvailability() && restored.findBook("B1")->getAvailability());
+    CHECK(restored.findMember("M0")->getIssuedBooksCount() == 1 && restored.findMember("M1")->getIssuedBooksCount() == 1);
+    CHECK(restored.findMember("M2")->getContactInfo() == "m2@example.com");
+    CHECK(restored.readHistoryStats().sealedLoans == 1);
+    CHECK(restored.getMemberHistory("M0").size() == 2);
+    CHECK_THROWS(restored.loadSnapshot(path));
+
+    // The restored hold queue hands B0 to M2 on return, under a new transaction number
+    restored.returnBook("M0", "B0");
+    CHECK(restored.findMember("M2")->getIssuedBooksCount() == 1 && !restored.findBook("B0")->getAvailability());
+    vector<Transaction> loans = restored.getBookHistory("B0");
+    CHECK(loans.size() == 2 && loans[0].getTransactionNumber() != loans[1].getTransactionNumber());
+    remove(path.c_str());
+}
+
+// A loaded catalog is served from the snapshot: books are built on first use,
+// searches and ID ranges cover the loaded books, books added afterwards join
+// them, a re-save writes everything back, and version 1 files still load
+static void testSnapshotLazyCatalog() {
+    const string path = "test_lazy_catalog.snapshot";
+    const string resaved = "test_lazy_catalog_resaved.snapshot";
+    const size_t books = 2000;
+    {
+        Library library;
+        populate(library, books, 2);
+        library.addJournal("J1", "Annual Review", "Author J", "Category J", 4, 2, "2023-11");
+        library.issueBook("M0", "B7");
+        library.saveSnapshot(path);
+    }
+
+    Library restored;
+    restored.setOutputMode(OutputSink::Mode::Headless);
+    size_t before = allocations.load();
+    CHECK(restored.loadSnapshot(path));
+    CHECK(allocations.load() - before < books / 4);
+    CHECK(restored.readCatalogStats().books == books + 1);
+    CHECK(restored.findBook("B5") == restored.findBook("B5"));
+    CHECK(restored.findBook("B1500")->getTitle() == "Title 1500" && restored.findBook("B1500")->getAuthor() == "Author 2");
+    CHECK(!restored.findBook("B7")->getAvailability() && restored.findBook("B8")->getAvailability());
+    const Journal* journal = static_cast<const Journal*>(restored.findBook("J1"));
+    CHECK(journal->getVolume() == 4 && journal->getIssue() == 2 && journal->getPublishDate() == "2023-11");
+    CHECK(restored.findBooksInRange("B10", "B12").size() == 3);
+    vector<Book*> found = restored.searchBooks("title 1234");
+    CHECK(found.size() == 1 && found[0]->getBookId() == "B1234");
+
+    // A duplicate ID keeps the loaded book; a new one joins the lazy indexes
+    restored.addBook("B5", "Duplicate", "Author X", "Category X");
+    restored.addBook("B5000", "Late Arrival", "Author Y", "Category Y");
+    CHECK(restored.findBook("B5")->getTitle() == "Title 5");
+    CHECK(restored.findBooksInRange("B1999", "B5000").size() == 2);
+    CHECK(restored.searchBooks("arrival").size() == 1);
+    restored.issueBook("M1", "B9");
+    restored.returnBook("M0", "B7");
+    restored.saveSnapshot(resaved);
+
+    Library again;
+    again.setOutputMode(OutputSink::Mode::Headless);
+    CHECK(again.loadSnapshot(resaved));
+    CHECK(again.readCatalogStats().books == books + 3);
+    CHECK(again.findBook("B5")->getTitle() == "Title 5" && again.findBook("B5000")->getAuthor() == "Author Y");
+    CHECK(again.findBook("B7")->getAvailability() && !again.findBook("B9")->getAvailability());
+    CHECK(static_cast<const Journal*>(again.findBook("J1"))->getPublishDate() == "2023-11");
+    CHECK(again.findMember("M1")->getIssuedBooksCount() == 1);
+
+    // A cut-off file is rejected rather than mapped past its end
+    string image;
+    CHECK(readFile(path, image));
+    {
+        ofstream file(resaved.c_str(), ios::binary | ios::trunc);
+        file.write(image.data(), static_cast<streamsize>(image.size() / 2));
+    }
+    Library truncated;
+    CHECK_THROWS(truncated.loadSnapshot(resaved));
+
+    // Version 1: header without the journal LSN, then one record per book
+    SnapshotWriter out;
+    out.putU32(0x534D4C53); // "SLMS"
+    out.putU32(1);
+    out.putU32(1000);
+    out.putU32(1);
+    out.putU8(static_cast<uint8_t>(BookKind::Book));
+    for (const char* field : { "V1", "Old Title", "Old Author", "Old Category" }) {
+        out.putString(field);
+    }
+    out.putU8(1);
+    for (int section = 0; section < 3; ++section) {
+        out.putU32(0); // members, transactions, hold queues
+    }
+    {
+        ofstream file(resaved.c_str(), ios::binary | ios::trunc);
+        file.write(out.data().data(), static_cast<streamsize>(out.data().size()));
+    }
+    Library legacy;
+    legacy.setOutputMode(OutputSink::Mode::Headless);
+    CHECK(legacy.loadSnapshot(resaved));
+    CHECK(legacy.findBook("V1")->getTitle() == "Old Title" && legacy.findBook("V1")->getAvailability());
+    CHECK(legacy.searchBooks("old").size() == 1);
+    remove(path.c_str());
+    remove(resaved.c_str());
+}
+
+// Sealed months spilled to files survive a restart from the checkpoint, and
+// the checkpoint deletes spill files its snapshot does not refer to
+static void testHistorySpillCheckpoint() {
+    const string prefix = "test_spill";
+    const string snapshot = "test_spill.snapshot";
+    const string stale = prefix + "-1999-01-T1.seg";
+    {
+        ofstream file(stale.c_str());
+        file << "left over from an earlier run";
+    }
+    {
+        Library library;
+        populate(library, 4, 2);
+        library.setHistorySpill(prefix);
+        for (int round = 0; round < 3; ++round) {
+            library.issueBook("M0", "B0");
+            library.returnBook("M0", "B0");
+        }
+        CHECK(library.sealHistory(time(nullptr) + 62 * Transaction::SECONDS_PER_DAY) == 3);
+        library.checkpoint(snapshot);
+    }
+    CHECK(!fileExists(stale));
+    size_t segmentFiles = 0;
+    for (const string& name : listDirectory(".")) {
+        segmentFiles += name.compare(0, prefix.size() + 1, prefix + "-") == 0;
+    }
+    CHECK(segmentFiles == 1);
+
+    Library restored;
+    restored.setOutputMode(OutputSink::Mode::Headless);
+    CHECK(restored.loadSnapshot(snapshot));
+    CHECK(restored.readHistoryStats().sealedLoans == 3);
+    CHECK(restored.getMemberHistory("M0").size() == 3);
+    for (const string& name : listDirectory(".")) {
+        if (name.compare(0, prefix.size() + 1, prefix + "-") == 0) {
+            remove(name.c_str());
+        }
+    }
+    remove(snapshot.c_str());
+}
+
+// ---- Indexes ----
+
+static void testGenericSort() {
+    Library library;
+    populate(library, 0, 0);
+    vector<Book*> books;
+    for (const char* id : { "B30", "A7", "B3", "C1", "A10" }) {
+        books.push_back(&library.addBook(id, "Title", "Author", "Category"));
+    }
+    GenericManager<Book>::sort(books, &Book::getBookId);
+    vector<string> order;
+    for (const Book* book : books) {
+        order.push_back(book->getBookId());
+    }
+    CHECK((order == vector<string>{ "A10", "A7", "B3", "B30", "C1" }));
+    CHECK(GenericManager<Book>::search(books, "B30", &Book::getBookId) == 3);
+}
+
+static vector<string> idsInRange(const Library& library, const string& from, const string& to) {
+    vector<string> ids;
+    for (const Book* book : library.findBooksInRange(from, to)) {
+        ids.push_back(book->getBookId());
+    }
+    return ids;
+}
+
+// IDs compare in natural order, equal keys keep registration order, and books
+// added after an ordered read are merged in by the next one
+static void testOrderedIdRange() {
+    Library library;
+    populate(library, 0, 0);
+    for (const char* id : { "B100", "B9", "B1000", "B10", "B01", "B150", "B199", "B1", "B200", "A7" }) {
+        library.addBook(id, "Title", "Author", "Category");
+    }
+    CHECK((idsInRange(library, "B0", "B99999")
+           == vector<string>{ "B01", "B1", "B9", "B10", "B100", "B150", "B199", "B200", "B1000" }));
+    CHECK((idsInRange(library, "B100", "B199") == vector<string>{ "B100", "B150", "B199" }));
+    CHECK((idsInRange(library, "B1", "B001") == vector<string>{ "B01", "B1" }));
+    CHECK(idsInRange(library, "B200", "B100").empty());
+    CHECK((idsInRange(library, "A", "B1") == vector<string>{ "A7", "B01", "B1" }));
+
+    for (const char* id : { "B120", "B2", "B0150" }) {
+        library.addBook(id, "Title", "Author", "Category");
+    }
+    CHECK((idsInRange(library, "B100", "B199") == vector<string>{ "B100", "B120", "B150", "B0150", "B199" }));
+    CHECK((idsInRange(library, "B1", "B9") == vector<string>{ "B01", "B1", "B2", "B9" }));
+}
+
+// Words are lowercase letter/digit runs; every query word is a prefix and all
+// must match. A rare word against a common one goes through the galloping
+// intersection, and words added after a query are merged into the word order.
+static void testCatalogSearch() {
+    CHECK((CatalogSearchIndex::tokenize("Hello, World-2nd ed.") == vector<string>{ "hello", "world", "2nd", "ed" }));
+    CHECK(CatalogSearchIndex::tokenize(" -- ").empty());
+
+    CatalogSearchIndex index;
+    index.add(0, "Programming Languages");
+    index.add(1, "Programming Pearls");
+    index.add(2, "Language Design");
+    index.add(3, "THE C PROGRAMMING LANGUAGE");
+    CHECK((index.query("programming") == vector<uint32_t>{ 0, 1, 3 }));
+    CHECK((index.query("PROG lang") == vector<uint32_t>{ 0, 3 }));
+    CHECK((index.query("lang prog pearl") == vector<uint32_t>{}));
+    CHECK(index.query("").empty() && index.query("?!").empty() && index.query("cobol").empty());
+
+    // Added after the word order was first built
+    index.add(4, "Prolog Programming");
+    index.add(5, "Aardvark Languages");
+    CHECK((index.query("pro") == vector<uint32_t>{ 0, 1, 3, 4 }));
+    CHECK((index.query("aard lang") == vector<uint32_t>{ 5 }));
+
+    // A common word in every book and a rare word in a few, checked against a
+    // plain scan of the same texts
+    CatalogSearchIndex large;
+    vector<string> texts;
+    for (uint32_t ordinal = 0; ordinal < 50000; ++ordinal) {
+        string text = "common w" + to_string(ordinal % 97);
+        if (ordinal % 4999 == 7) {
+            text += " rare";
+        }
+        texts.push_back(text);
+        large.add(ordinal, text);
+    }
+    vector<uint32_t> expected;
+    for (uint32_t ordinal = 0; ordinal < texts.size(); ++ordinal) {
+        if (texts[ordinal].find(" rare") != string::npos) {
+            expected.push_back(ordinal);
+        }
+    }
+    CHECK(expected.size() == 11 && large.query("common rare") == expected && large.query("rare common") == expected);
+    expected.clear();
+    for (uint32_t ordinal = 0; ordinal < texts.size(); ++ordinal) {
+        string word = to_string(ordinal % 97); // "w5" also begins w50..w59
+        if (word[0] == '5' && texts[ordinal].find(" rare") != string::npos) {
+            expected.push_back(ordinal);
+        }
+    }
+    CHECK(!expected.empty() && large.query("rare w5 comm") == expected);
+}
+
+// ---- Object pools ----
+
+struct PooledObject {
+    static int live;
+    uint64_t payload[4];
+    PooledObject() { live++; }
+    ~PooledObject() { live--; }
+};
+
+int PooledObject::live = 0;
+
+// Objects come from chunks, one allocation per chunk; freed slots are reused
+// before a new chunk is taken, and the pool destroys only the live objects
+static void testObjectPool() {
+    {
+        ObjectPool<PooledObject, 64> pool;
+        vector<PooledObject*> objects;
+        objects.reserve(1000);
+        size_t before = allocations.load();
+        for (int i = 0; i < 1000; ++i) {
+            objects.push_back(pool.create());
+        }
+        size_t chunkAllocations = allocations.load() - before;
+        CHECK(chunkAllocations >= 16 && chunkAllocations <= 16 + 8); // 16 chunks, plus the chunk list growing
+        CHECK(pool.size() == 1000 && PooledObject::live == 1000);
+
+        for (size_t i = 0; i < objects.size(); i += 2) {
+            pool.destroy(objects[i]);
+        }
+        CHECK(pool.size() == 500 && PooledObject::live == 500);
+        before = allocations.load();
+        for (size_t i = 0; i < objects.size(); i += 2) {
+            objects[i] = pool.create();
+        }
+        CHECK(allocations.load() == before);
+        CHECK(pool.size() == 1000);
+        pool.destroy(objects[1]);
+    }
+    CHECK(PooledObject::live == 0);
+}
+
+// Issue/return cycles draw transactions from the pool and reuse the index
+// slots, so a steady cycle hardly touches the allocator; a large catalog
+// stays within a fixed resident footprint per book
+static void testPoolFootprint() {
+    Library library;
+    populate(library, 100, 1);
+    for (int i = 0; i < 100; ++i) {
+        library.tryIssueBook("M0", "B1");
+        library.tryReturnBook("M0", "B1");
+    }
+    const size_t cycles = 20000;
+    size_t before = allocations.load();
+    for (size_t i = 0; i < cycles; ++i) {
+        library.tryIssueBook("M0", "B1");
+        library.tryReturnBook("M0", "B1");
+    }
+    CHECK(allocations.load() - before < cycles / 20);
+
+    size_t residentBefore = residentBytes();
+    const size_t books = 200000;
+    Library large;
+    populate(large, books, 0);
+    if (residentBefore != 0) {
+        CHECK((residentBytes() - residentBefore) / books < 800); // about 400 bytes per book today
+    }
+}
+
+// ---- Metrics ----
+
+// Threads come and go in waves, far more of them than there are private
+// shards; their shards are handed on as they exit and no count is lost
+static void testMetricsThreadChurn() {
+    Library library;
+    populate(library, 10, 2);
+    const size_t waves = 40, perWave = 8, callsEach = 600;
+    for (size_t wave = 0; wave < waves; ++wave) {
+        vector<thread> threads;
+        for (size_t t = 0; t < perWave; ++t) {
+            threads.push_back(thread([&library, t] {
+                for (size_t i = 0; i < callsEach; ++i) {
+                    library.findBook("B" + to_string((t + i) % 12)); // B10 and B11 miss
+                }
+            }));
+        }
+        for (thread& t : threads) {
+            t.join();
+        }
+    }
+    LibraryMetrics::Snapshot metrics = library.readMetrics();
+    size_t findBook = static_cast<size_t>(MetricOp::FindBook);
+    CHECK(metrics.calls[findBook] == waves * perWave * callsEach);
+    CHECK(metrics.misses[findBook] == waves * perWave * callsEach / 6);
+}
+
+// ---- Open loans ----
+
+// Per-return cost of cycling one extra loan while 'openLoans' other loans stay
+// out: the best of several rounds, to keep scheduler noise out of the ratio
+static double returnNanos(size_t openLoans) {
+    Library library;
+    populate(library, openLoans + 1, openLoans + 1);
+    for (size_t i = 0; i < openLoans; ++i) {
+        library.tryIssueBook("M" + to_string(i), "B" + to_string(i));
+    }
+    const string member = "M" + to_string(openLoans), book = "B" + to_string(openLoans);
+    double best = 0;
+    for (int round = 0; round < 5; ++round) {
+        double total = 0;
+        const int cycles = 2000;
+        for (int i = 0; i < cycles; ++i) {
+            library.tryIssueBook(member, book);
+            auto started = chrono::steady_clock::now();
+            library.tryReturnBook(member, book);
+            total += chrono::duration<double, nano>(chrono::steady_clock::now() - started).count();
+        }
+        best = round == 0 ? total / cycles : min(best, total / cycles);
+    }
+    return best;
+}
+
+// A return finds its loan through the book's open-loan entry: it closes the
+// right loan among many, rejects a member who does not hold the book, and
+// costs the same with a hundred or a hundred thousand loans outstanding
+static void testOpenLoans() {
+    Library library;
+    populate(library, 1000, 200);
+    size_t issued = 0, returned = 0;
+    for (size_t i = 0; i < 1000; ++i) {
+        issued += library.tryIssueBook("M" + to_string(i % 200), "B" + to_string(i)).getStatus()
+                  == CirculationStatus::Issued;
+    }
+    CHECK(issued == 1000);
+    CHECK(library.tryReturnBook("M1", "B0").getStatus() == CirculationStatus::NoActiveLoan);
+    CHECK(!library.findBook("B0")->getAvailability());
+    for (size_t i = 0; i < 1000; i += 3) {
+        returned += library.tryReturnBook("M" + to_string(i % 200), "B" + to_string(i)).getStatus()
+                    == CirculationStatus::Returned;
+    }
+    CHECK(returned == 334);
+    CHECK(library.tryReturnBook("M0", "B0").getStatus() == CirculationStatus::NoActiveLoan);
+    size_t available = 0, onLoan = 0;
+    for (size_t i = 0; i < 1000; ++i) {
+        (library.findBook("B" + to_string(i))->getAvailability() ? available : onLoan)++;
+    }
+    CHECK(available == 334 && onLoan == 666);
+    size_t held = 0;
+    for (size_t i = 0; i < 200; ++i) {
+        held += library.findMember("M" + to_string(i))->getIssuedBooksCount();
+    }
+    CHECK(held == onLoan);
+
+    double few = returnNanos(100), many = returnNanos(100000);
+    // Generous: a scan over the open loans would be hundreds of times slower
+    CHECK(many < few * 5);
+}
+
+// Books B0..B5 and members M0..M3 (two loans each), with B1 out to M1
+static void prepareBatchLibrary(Library& library, const string& journalPath) {
+    remove(journalPath.c_str());
+    populate(library, 6, 4, 2);
+    library.openJournal(journalPath);
+    library.tryIssueBook("M1", "B1");
+}
+
+// Availability of every book and the books each member holds, in order
+static string circulationState(Library& library) {
+    string state;
+    for (size_t i = 0; i < 6; ++i) {
+        state += library.findBook("B" + to_string(i))->getAvailability() ? 'A' : 'I';
+    }
+    for (size_t i = 0; i < 4; ++i) {
+        state += " M" + to_string(i) + ":";
+        for (Symbol book : library.findMember("M" + to_string(i))->getIssuedBooks()) {
+            state += book.str();
+        }
+    }
+    return state;
+}
+
+// A batch gives the statuses and the state that the same calls made one by
+// one give, and commits the journal once for all of them
+static void testProcessBatch() {
+    const string batchPath = "test_batch.journal", sequentialPath = "test_sequential.journal";
+    const vector<CirculationRequest> requests = {
+        { "M9", "B0", CirculationOp::Issue },  // unknown member
+        { "M0", "B9", CirculationOp::Issue },  // unknown book
+        { "M0", "B0", CirculationOp::Issue },
+        { "M0", "B2", CirculationOp::Issue },
+        { "M0", "B3", CirculationOp::Issue },  // over M0's limit
+        { "M2", "B0", CirculationOp::Return }, // M0 holds it
+        { "M0", "B0", CirculationOp::Return },
+        { "M2", "B0", CirculationOp::Issue },  // issued again after the return
+        { "M3", "B1", CirculationOp::Issue },  // out to M1: M3 joins the hold queue
+        { "M1", "B1", CirculationOp::Return }, // ... and is served by this return
+        { "M3", "B4", CirculationOp::Return }, // never issued
+    };
+    const vector<CirculationStatus> expected = {
+        CirculationStatus::InvalidMember, CirculationStatus::BookNotFound, CirculationStatus::Issued,
+        CirculationStatus::Issued, CirculationStatus::LimitReached, CirculationStatus::NoActiveLoan,
+        CirculationStatus::Returned, CirculationStatus::Issued, CirculationStatus::Reserved,
+        CirculationStatus::Returned, CirculationStatus::NoActiveLoan,
+    };
+
+    Library sequential;
+    prepareBatchLibrary(sequential, sequentialPath);
+    vector<CirculationStatus> oneByOne;
+    for (const CirculationRequest& request : requests) {
+        oneByOne.push_back(request.op == CirculationOp::Issue
+                               ? sequential.tryIssueBook(request.memberId, request.bookId).getStatus()
+                               : sequential.tryReturnBook(request.memberId, request.bookId).getStatus());
+    }
+    CHECK(oneByOne == expected);
+
+    string batchState;
+    {
+        Library batch;
+        prepareBatchLibrary(batch, batchPath);
+        uint64_t syncsBefore = batch.readJournalSyncs();
+        CHECK(batch.processBatch(requests) == expected);
+        CHECK(batch.readJournalSyncs() == syncsBefore + 1);
+        batchState = circulationState(batch);
+        CHECK(batchState == circulationState(sequential));
+        CHECK(batchState == "IIIAAA M0:B2 M1: M2:B0 M3:B1");
+    }
+
+    // Everything the batch did was durable when it returned
+    Library replayed;
+    populate(replayed, 6, 4, 2);
+    replayed.openJournal(batchPath);
+    CHECK(circulationState(replayed) == batchState);
+    remove(batchPath.c_str());
+    remove(sequentialPath.c_str());
+}
+
+// ---- Catalog columns ----
+
+// The status summary is a scan over the availability bitset and the code
+// columns; its totals must agree with the Book objects and with
+// readCatalogStats. 200k books rather than the benchmark's millions keeps the
+// test quick while still catching a per-book pointer chase in the timing.
+static void testStatusSummary() {
+    const size_t bookCount = 200000;
+    Library library;
+    populate(library, 0, 1000, 1000);
+    size_t total[3][3] = {}, available[3][3] = {}; // [category][kind]
+    for (size_t i = 0; i < bookCount; ++i) {
+        string id = "B" + to_string(i), category = "Category " + to_string(i % 3);
+        size_t kind = i % 10 == 1 ? 1 : i % 10 == 2 ? 2 : 0;
+        if (kind == 1) {
+            library.addEBook(id, "Title", "Author", category, "PDF", 5);
+        } else if (kind == 2) {
+            library.addJournal(id, "Title", "Author", category, 1, 1, "2024-01");
+        } else {
+            library.addBook(id, "Title", "Author", category);
+        }
+        total[i % 3][kind]++;
+        if (i % 7 == 0) {
+            library.tryIssueBook("M" + to_string(i % 1000), id);
+        } else {
+            available[i % 3][kind]++;
+        }
+    }
+    size_t availableBooks = 0;
+    for (size_t category = 0; category < 3; ++category) {
+        for (size_t kind = 0; kind < 3; ++kind) {
+            availableBooks += available[category][kind];
+        }
+    }
+
+    Library::CatalogStats stats = library.readCatalogStats();
+    CHECK(stats.books == bookCount && stats.available == availableBooks && stats.members == 1000);
+
+    auto started = chrono::steady_clock::now();
+    string summary = captureOutput([&] { library.printStatusSummary(library.openReadView()); });
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - started).count();
+    CHECK(summary.find("Total Books: " + to_string(bookCount) + "\n") != string::npos);
+    CHECK(summary.find("Available: " + to_string(availableBooks) + "\n") != string::npos);
+    CHECK(summary.find("Issued: " + to_string(bookCount - availableBooks) + "\n") != string::npos);
+    static const char* const KIND_NAMES[3] = { "Books", "E-Books", "Journals" };
+    for (size_t index = 0; index < 3; ++index) {
+        size_t categoryAvailable = 0, categoryTotal = 0, kindAvailable = 0, kindTotal = 0;
+        for (size_t other = 0; other < 3; ++other) {
+            categoryAvailable += available[index][other];
+            categoryTotal += total[index][other];
+            kindAvailable += available[other][index];
+            kindTotal += total[other][index];
+        }
+        CHECK(summary.find("  Category " + to_string(index) + ": " + to_string(categoryAvailable) + "/"
+                           + to_string(categoryTotal) + "\n") != string::npos);
+        CHECK(summary.find(string("  ") + KIND_NAMES[index] + ": " + to_string(kindAvailable) + "/"
+                           + to_string(kindTotal) + "\n") != string::npos);
+    }
+    // Generous: the scan takes well under a millisecond here
+    CHECK(ms < 100);
+
+    // The full report lists every row, with the same summary underneath
+    string report = captureOutput([&] { library.generateBookStatusReport(); });
+    CHECK(static_cast<size_t>(count(report.begin(), report.end(), '\n')) > bookCount);
+    CHECK(report.find("B7\tTitle\tIssued\n") != string::npos && report.find("B8\tTitle\tAvailable\n") != string::npos);
+    CHECK(report.find(summary.substr(summary.find("Total Books:"))) != string::npos);
+}
+
+// ---- Bulk import ----
+
+// Hand-written rows covering quoting, the material types, duplicates and bad
+// rows, followed by enough generated rows (a few MB) to be parsed as several
+// chunks and a last line longer than a small streaming window. The benchmark
+// imports millions of rows; this checks that every row lands, once, with its
+// fields intact and in file order.
+static void testBulkImport() {
+    const string bookPath = "test_import_books.csv", memberPath = "test_import_members.tsv";
+    const size_t generated = 100000;
+    {
+        ofstream books(bookPath.c_str(), ios::binary);
+        books << "id,title,author,category,type,format,size\n"
+              << "I1,\"Quoted, \"\"with\"\" commas\",Author A,Fiction\r\n"   // line 2
+              << "I2,Digital,Author B,Science,ebook,EPUB,12\n"
+              << "I3,Quarterly,Author C,Science,journal,7,2,2024-03\n"
+              << "B0,Already here,Author D,Fiction\n"                        // line 5: in the library
+              << "I1,Second copy,Author E,Fiction\n"                         // earlier in the file
+              << ",No ID,Author F,Fiction\n"                                 // line 7
+              << "I4,Bad size,Author G,Science,ebook,PDF,big\n"
+              << "I5,Odd type,Author H,Science,scroll\n"
+              << "\n";
+        for (size_t i = 0; i < generated; ++i) {
+            books << "G" << i << ",Generated " << i << ",Author " << i % 11 << ",Category " << i % 5 << "\n";
+        }
+        books << "L1," << string(10000, 'x') << ",Author L,Fiction"; // no final newline
+    }
+
+    // Streamed through a small window (the long line spans several), the file
+    // gives the same records and error lines as when parsed whole
+    auto idOnly = [](const vector<string>& fields, string& id, string& error) {
+        if (fields.size() < 4 || fields[0].empty() || fields[1].empty()) {
+            error = "short row";
+            return false;
+        }
+        id = fields[0];
+        return true;
+    };
+    string image;
+    CHECK(readFile(bookPath, image));
+    DelimitedParser::Result<string> whole = DelimitedParser::parse<string>(image, ',', "id", idOnly);
+    vector<string> wholeIds, streamedIds;
+    vector<size_t> wholeErrors, streamedErrors;
+    for (const vector<string>& chunk : whole.chunks) {
+        wholeIds.insert(wholeIds.end(), chunk.begin(), chunk.end());
+    }
+    for (const DelimitedParser::Error& error : whole.errors) {
+        wholeErrors.push_back(error.line);
+    }
+    size_t windows = 0, streamedRows = 0, sizeSeen = 0;
+    CHECK(DelimitedParser::stream<string>(bookPath, "id", idOnly,
+        [&](DelimitedParser::Result<string>& window, size_t fileBytes) {
+            sizeSeen = fileBytes;
+            windows++;
+            streamedRows += window.rows;
+            for (const vector<string>& chunk : window.chunks) {
+                streamedIds.insert(streamedIds.end(), chunk.begin(), chunk.end());
+            }
+            for (const DelimitedParser::Error& error : window.errors) {
+                streamedErrors.push_back(error.line);
+            }
+        }, 4096));
+    CHECK(sizeSeen == image.size() && windows > image.size() / 4096 / 2 && streamedRows == whole.rows && whole.rows == generated + 9);
+    CHECK(streamedIds == wholeIds && wholeIds.back() == "L1" && wholeIds[wholeIds.size() - 2] == "G" + to_string(generated - 1));
+    CHECK(streamedErrors == wholeErrors && (wholeErrors == vector<size_t>{ 7 }));
+
+    {
+        ofstream members(memberPath.c_str(), ios::binary);
+        members << "id\tname\tcontact\tmaxBooks\n"
+                << "N1\t\"Quoted\" Name\tn1@example.com\t7\n"   // quotes are data in TSV
+                << "N2\tDefault Limit\tn2@example.com\n"
+                << "M0\tExisting\tm0@example.com\t2\n"
+                << "N3\tNo Limit\tn3@example.com\t0\n"          // line 5
+                << "N4\tToo\tMany\t1\tcolumns\n";
+    }
+
+    Library library;
+    populate(library, 1, 1);
+    ImportReport books, members;
+    ostringstream errors;
+    streambuf* savedErrors = cerr.rdbuf(errors.rdbuf());
+    string summary = captureOutput([&] {
+        books = library.importBooks(bookPath);
+        members = library.importMembers(memberPath);
+    });
+    cerr.rdbuf(savedErrors);
+
+    CHECK(books.rows == generated + 9 && books.imported == generated + 4);
+    CHECK(books.duplicates == 2 && books.invalid == 3);
+    CHECK(members.rows == 5 && members.imported == 2 && members.duplicates == 1 && members.invalid == 2);
+    CHECK(summary.find("Imported " + to_string(generated + 4) + " of " + to_string(generated + 9) + " book row(s)")
+          != string::npos);
+    CHECK(errors.str().find("Line 7: ") != string::npos && errors.str().find("Line 5: invalid book limit") != string::npos);
+
+    Book* quoted = library.findBook("I1");
+    CHECK(quoted && quoted->getTitle() == "Quoted, \"with\" commas" && quoted->getCategory() == "Fiction");
+    CHECK(library.findBook("B0")->getTitle() == "Title 0");
+    Book* ebook = library.findBook("I2");
+    CHECK(ebook && ebook->getKind() == BookKind::EBook && static_cast<EBook*>(ebook)->getFormat() == "EPUB"
+          && static_cast<EBook*>(ebook)->getFileSize() == 12);
+    Book* journal = library.findBook("I3");
+    CHECK(journal && journal->getKind() == BookKind::Journal && static_cast<Journal*>(journal)->getVolume() == 7
+          && static_cast<Journal*>(journal)->getIssue() == 2
+          && static_cast<Journal*>(journal)->getPublishDate() == "2024-03");
+    CHECK(!library.findBook("I4") && !library.findBook("I5"));
+    CHECK(library.findEBooksLargerThan(10).size() == 1 && library.findJournalsByVolume(7).size() == 1);
+
+    // Generated rows keep file order across chunks and are fully indexed
+    size_t misplaced = 0;
+    for (size_t i = 0; i < generated; i += 997) {
+        Book* book = library.findBook("G" + to_string(i));
+        misplaced += !book || book->getTitle() != "Generated " + to_string(i);
+    }
+    CHECK(misplaced == 0);
+    CHECK(library.searchBooks("Generated 99999").size() == 1);
+    CHECK(library.readCatalogStats().books == generated + 5);
+    CHECK(library.findBook("L1") && library.findBook("L1")->getTitle().size() == 10000);
+
+    Member* member = library.findMember("N1");
+    CHECK(member && member->getName() == "\"Quoted\" Name" && member->getMaxBooksAllowed() == 7);
+    CHECK(library.findMember("N2") && library.findMember("N2")->getMaxBooksAllowed() == 3);
+    CHECK(library.findMember("M0")->getName() == "Member 0" && !library.findMember("N3"));
+    CHECK(library.tryIssueBook("N1", "G5").getStatus() == CirculationStatus::Issued);
+
+    remove(bookPath.c_str());
+    remove(memberPath.c_str());
+}
+
+// ---- Circulation analytics ----
+
+static bool sameRanking(const vector<AnalyticsReport::Ranked>& a, const vector<AnalyticsReport::Ranked>& b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (a[i].id != b[i].id || a[i].loans != b[i].loans || a[i].fines != b[i].fines) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Everything but the timing and the thread count
+static bool sameReport(const AnalyticsReport& a, const AnalyticsReport& b) {
+    bool same = a.loans == b.loans && a.openLoans == b.openLoans && a.overdueLoans == b.overdueLoans
+                && a.finesCharged == b.finesCharged && a.finesOutstanding == b.finesOutstanding
+                && a.activeMembers == b.activeMembers && a.membersWithFines == b.membersWithFines
+                && sameRanking(a.topTitles, b.topTitles) && sameRanking(a.topMembers, b.topMembers)
+                && a.categories.size() == b.categories.size();
+    for (size_t i = 0; same && i < a.categories.size(); ++i) {
+        same = a.categories[i].category == b.categories[i].category && a.categories[i].loans == b.categories[i].loans
+               && a.categories[i].openLoans == b.categories[i].openLoans
+               && a.categories[i].fines == b.categories[i].fines;
+    }
+    return same;
+}
+
+// Replays a hand-built history (three loans sealed, three live) and checks the
+// report at two dates. Before the later returns, those loans count as open
+// with the fine they had accrued; ties in the rankings go to the lower ID.
+// A larger generated history, with IDs spread over several merge ranges and
+// loans over many monthly segments, must report the same on 1 and 4 threads.
+static void testCirculationAnalytics() {
+    const string path = "test_analytics.journal";
+    const time_t DAY = Transaction::SECONDS_PER_DAY;
+    const time_t base = 1673308800; // 2023-01-10
+    remove(path.c_str());
+    {
+        TransactionJournal journal;
+        journal.open(path, 0);
+        // Txn, member, book, issued and returned (days after base; -1: still out)
+        const struct { uint32_t number; const char* member; const char* book; int issued, returned; } loans[] = {
+            { 1, "M0", "B0", 0, 20 },  // fine 12
+            { 2, "M1", "B0", 21, 25 },
+            { 3, "M1", "B1", 0, 40 },  // fine 52
+            { 4, "M2", "B2", 30, -1 },
+            { 5, "M0", "B3", 35, 60 }, // fine 22
+            { 6, "M3", "B0", 61, -1 },
+        };
+        for (const auto& loan : loans) {
+            journal.append(JournalOp::Issue, base + loan.issued * DAY, loan.number, loan.member, loan.book);
+            if (loan.returned >= 0) {
+                journal.append(JournalOp::Return, base + loan.returned * DAY, loan.number, loan.member, loan.book);
+            }
+        }
+        journal.commit(journal.lastLsn());
+    }
+    {
+        Library library;
+        populate(library, 6, 4);
+        library.openJournal(path);
+        CHECK(library.sealHistory(base + 55 * DAY) == 3); // returned before March
+        CHECK(library.readHistoryStats().liveLoans == 3);
+
+        AnalyticsReport early = library.analyzeCirculation(base + 38 * DAY, 3);
+        CHECK(early.loans == 5 && early.openLoans == 3 && early.overdueLoans == 1);
+        CHECK(early.finesCharged == 12.0 && early.finesOutstanding == 48.0);
+        CHECK(early.activeMembers == 3 && early.membersWithFines == 2);
+        CHECK(early.topTitles.size() == 3 && early.topTitles[0].id.str() == "B0" && early.topTitles[0].loans == 2
+              && early.topTitles[1].id.str() == "B1" && early.topTitles[2].id.str() == "B2");
+        CHECK(early.topMembers.size() == 3 && early.topMembers[0].id.str() == "M0" && early.topMembers[0].fines == 12.0
+              && early.topMembers[1].id.str() == "M1" && early.topMembers[1].fines == 48.0
+              && early.topMembers[2].id.str() == "M2");
+        CHECK(early.categories.size() == 3 && early.categories[0].category == "Category 0"
+              && early.categories[0].loans == 3 && early.categories[0].openLoans == 1
+              && early.categories[0].fines == 12.0 && early.categories[1].category == "Category 1"
+              && early.categories[1].fines == 48.0);
+
+        AnalyticsReport late = library.analyzeCirculation(base + 70 * DAY, 3);
+        CHECK(late.loans == 6 && late.openLoans == 2 && late.overdueLoans == 1);
+        CHECK(late.finesCharged == 86.0 && late.finesOutstanding == 52.0);
+        CHECK(late.activeMembers == 4 && late.membersWithFines == 3);
+        CHECK(late.topTitles[0].id.str() == "B0" && late.topTitles[0].loans == 3);
+        CHECK(late.topMembers[0].id.str() == "M0" && late.topMembers[0].fines == 34.0
+              && late.topMembers[2].id.str() == "M2" && late.topMembers[2].fines == 52.0);
+        CHECK(late.categories[0].loans == 4 && late.categories[0].openLoans == 1 && late.categories[0].fines == 34.0
+              && late.categories[2].openLoans == 1 && late.categories[2].fines == 52.0);
+    }
+    remove(path.c_str());
+
+    // Push the generated IDs past the first merge range of symbol values
+    for (size_t i = 0; i < 140000; ++i) {
+        symbols().intern("analytics-pad-" + to_string(i));
+    }
+    {
+        TransactionJournal journal;
+        journal.open(path, 0);
+        for (uint32_t i = 0; i < 50000; ++i) {
+            string member = "AM" + to_string(i % 300);
+            int issued = (i * 7) % 400;
+            if (i % 20 == 0 && i < 6000) { // each book of its own, still out
+                journal.append(JournalOp::Issue, base + issued * DAY, i + 1, member, "AY" + to_string(i / 20));
+            } else {
+                string book = "AX" + to_string(i % 200);
+                journal.append(JournalOp::Issue, base + issued * DAY, i + 1, member, book);
+                journal.append(JournalOp::Return, base + (issued + i % 40) * DAY, i + 1, member, book);
+            }
+        }
+        journal.commit(journal.lastLsn());
+    }
+    {
+        Library library;
+        library.setOutputMode(OutputSink::Mode::Headless);
+        for (size_t i = 0; i < 200; ++i) {
+            library.addBook("AX" + to_string(i), "Title", "Author", "Category " + to_string(i % 3));
+        }
+        for (size_t i = 0; i < 300; ++i) {
+            library.addBook("AY" + to_string(i), "Title", "Author", "Category " + to_string(i % 4));
+            library.addMember(Member("AM" + to_string(i), "Member", "contact", 100));
+        }
+        library.openJournal(path);
+        CHECK(library.sealHistory(base + 300 * DAY) > 0 && library.readHistoryStats().segments > 3);
+        // Which worker claims which task is up to the scheduler, so the
+        // parallel run is repeated
+        for (time_t asOf : { base + 150 * DAY, base + 500 * DAY }) {
+            library.setAnalyticsThreads(1);
+            AnalyticsReport serial = library.analyzeCirculation(asOf, 5);
+            library.setAnalyticsThreads(4);
+            size_t differing = 0;
+            for (int run = 0; run < 5; ++run) {
+                AnalyticsReport parallel = library.analyzeCirculation(asOf, 5);
+                differing += parallel.threads != 4 || !sameReport(serial, parallel);
+            }
+            CHECK(serial.threads == 1 && serial.loans > 0 && differing == 0);
+        }
+    }
+    remove(path.c_str());
+}
+
+// ---- Due-date index ----
+
+// Returned loans leave the index at once, so it never holds more than the
+// open loans, and the overdue query sees only the open ones
+static void testDueDateIndex() {
+    DueDateIndex index;
+    time_t start = 1000 * Transaction::SECONDS_PER_DAY;
+    vector<Transaction> loans;
+    for (uint32_t i = 0; i < 1000; ++i) {
+        loans.push_back(Transaction(i + 1, Symbol(i % 10), Symbol(i), start + (i % 30) * Transaction::SECONDS_PER_DAY,
+                                    0, 0.0, false));
+        index.add(loans.back());
+    }
+    CHECK(index.size() == 1000);
+    for (uint32_t i = 0; i < 1000; ++i) {
+        if (i % 100 != 0) {
+            index.remove(loans[i]);
+        }
+    }
+    index.remove(loans[1]); // already gone
+    CHECK(index.size() == 10);
+    vector<DueDateIndex::Entry> due = index.dueBefore(start + 365 * Transaction::SECONDS_PER_DAY);
+    CHECK(due.size() == 10);
+    for (const DueDateIndex::Entry& entry : due) {
+        CHECK((entry.transactionNumber - 1) % 100 == 0 && entry.bookId == Symbol(entry.transactionNumber - 1));
+    }
+    for (uint32_t i = 0; i < 1000; i += 100) {
+        index.remove(loans[i]);
+    }
+    CHECK(index.size() == 0 && index.dueBefore(start + 365 * Transaction::SECONDS_PER_DAY).empty());
+}
+
+// Loans issued 40 days ago are overdue until they are returned
+static void testOverdueReport() {
+    const string path = "test_overdue.journal";
+    remove(path.c_str());
+    time_t issued = time(nullptr) - 40 * Transaction::SECONDS_PER_DAY;
+    {
+        TransactionJournal journal;
+        journal.open(path, 0);
+        journal.append(JournalOp::Issue, issued, 1, "M0", "B0");
+        journal.append(JournalOp::Issue, issued, 2, "M1", "B1");
+        journal.append(JournalOp::Issue, issued, 3, "M1", "B2");
+        journal.commit(journal.append(JournalOp::Return, issued + 60, 2, "M1", "B1"));
+    }
+    {
+        Library library;
+        populate(library, 4, 2);
+        CHECK(library.openJournal(path) == 4);
+        string report = captureOutput([&] { library.generateOverdueReport(); });
+        CHECK(report.find("Total overdue: 2,") != string::npos);
+        CHECK(report.find("| T1\t") != string::npos && report.find("| T3\t") != string::npos);
+        CHECK(report.find("| T2\t") == string::npos);
+
+        library.returnBook("M0", "B0");
+        library.returnBook("M1", "B2");
+        report = captureOutput([&] { library.generateOverdueReport(); });
+        CHECK(report.find("No overdue books.") != string::npos);
+    }
+    remove(path.c_str());
+}
+
+// ---- Concurrent circulation ----
+
+// Readers open views while writers issue and return. Every view must describe
+// one instant: each on-loan book has a borrower and a transaction, and each
+// member's loan count matches the books the view shows them holding.
+static void testReadViewConsistency() {
+    const size_t books = 256, memberCount = 32, writers = 4;
+    Library library;
+    populate(library, books, memberCount, 8);
+    atomic<bool> stop(false);
+    vector<thread> threads;
+    for (size_t w = 0; w < writers; ++w) {
+        threads.push_back(thread([&library, &stop, w] {
+            uint64_t state = 0x9E3779B97F4A7C15ull * (w + 1);
+            while (!stop.load()) {
+                state ^= state << 13;
+                state ^= state >> 7;
+                state ^= state << 17;
+                string memberId = "M" + to_string(state % memberCount);
+                string bookId = "B" + to_string((state >> 16) % books);
+                if (library.tryIssueBook(memberId, bookId).getStatus() == CirculationStatus::Issued) {
+                    library.tryReturnBook(memberId, bookId);
+                }
+            }
+        }));
+    }
+
+    size_t views = 0, inconsistent = 0, sawLoans = 0;
+    auto until = chrono::steady_clock::now() + chrono::milliseconds(500);
+    while (chrono::steady_clock::now() < until || views < 50) {
+        Library::ReadView view = library.openReadView();
+        map<const Member*, int> held;
+        int onLoan = 0;
+        for (uint32_t ordinal = 0; ordinal < view.bookCount(); ++ordinal) {
+            if (view.isAvailable(ordinal)) {
+                continue;
+            }
+            onLoan++;
+            if (!view.borrower(ordinal) || view.loanNumber(ordinal) == 0) {
+                inconsistent++;
+                continue;
+            }
+            held[view.borrower(ordinal)]++;
+        }
+        int counted = 0;
+        for (MemberStore::Handle handle = 0; handle < view.memberCount(); ++handle) {
+            int issued = view.issuedCount(handle);
+            counted += issued;
+            auto found = held.find(&view.member(handle));
+            inconsistent += issued != (found == held.end() ? 0 : found->second);
+        }
+        inconsistent += counted != onLoan;
+        sawLoans += onLoan != 0;
+        views++;
+    }
+    stop.store(true);
+    for (thread& t : threads) {
+        t.join();
+    }
+    CHECK(inconsistent == 0);
+    CHECK(sawLoans != 0);
+    // Copies still reachable by a pinned writer when the last view closed are
+    // freed at the next open or close, once the writers are gone
+    library.openReadView();
+    CHECK(library.pendingViewCopies() == 0);
+}
+
+// Many threads issue and return overlapping books for overlapping members,
+// and reservations are served on return. Afterwards no book may be on loan
+// twice, each member's loan count must equal their open loans and stay within
+// the limit, and the thread's own tally of issues and returns must add up.
+static void testCirculationStress() {
+    const size_t books = 64, memberCount = 16, threadCount = 8, opsEach = 20000;
+    const int limit = 3;
+    Library library;
+    populate(library, books, memberCount, limit);
+    atomic<size_t> issued(0), returned(0);
+    vector<thread> threads;
+    for (size_t t = 0; t < threadCount; ++t) {
+        threads.push_back(thread([&, t] {
+            uint64_t state = 0xD1B54A32D192ED03ull * (t + 1);
+            for (size_t i = 0; i < opsEach; ++i) {
+                state ^= state << 13;
+                state ^= state >> 7;
+                state ^= state << 17;
+                string memberId = "M" + to_string(state % memberCount);
+                string bookId = "B" + to_string((state >> 16) % books);
+                if ((state >> 40) % 2 == 0) {
+                    issued += library.tryIssueBook(memberId, bookId).getStatus() == CirculationStatus::Issued;
+                } else {
+                    returned += library.tryReturnBook(memberId, bookId).getStatus() == CirculationStatus::Returned;
+                }
+            }
+        }));
+    }
+    for (thread& t : threads) {
+        t.join();
+    }
+    CHECK(issued.load() > 0 && returned.load() > 0);
+
+    map<string, int> openLoans; // member -> open loans found in the book histories
+    size_t onLoan = 0, loans = 0, doubleIssued = 0, stateMismatch = 0;
+    for (size_t b = 0; b < books; ++b) {
+        string bookId = "B" + to_string(b);
+        int open = 0;
+        for (const Transaction& loan : library.getBookHistory(bookId)) {
+            loans++;
+            if (!loan.getReturnStatus()) {
+                open++;
+                openLoans[loan.getMemberId()]++;
+            }
+        }
+        bool available = library.findBook(bookId)->getAvailability();
+        doubleIssued += open > 1;
+        stateMismatch += available != (open == 0);
+        onLoan += !available;
+    }
+    CHECK(doubleIssued == 0);
+    CHECK(stateMismatch == 0);
+
+    size_t counted = 0, countMismatch = 0, limitBroken = 0;
+    for (size_t m = 0; m < memberCount; ++m) {
+        string memberId = "M" + to_string(m);
+        const Member* member = library.findMember(memberId);
+        counted += member->getIssuedBooksCount();
+        countMismatch += member->getIssuedBooksCount() != openLoans[memberId];
+        limitBroken += member->getIssuedBooksCount() > limit;
+        for (Symbol bookId : member->getIssuedBooks()) {
+            stateMismatch += library.findBook(bookId.str())->getAvailability();
+        }
+    }
+    CHECK(countMismatch == 0);
+    CHECK(limitBroken == 0);
+    CHECK(counted == onLoan);
+    CHECK(stateMismatch == 0);
+    // Loans served from reservations were not issued by a tryIssueBook call,
+    // but every loan was closed by one
+    CHECK(loans >= issued.load() && loans - onLoan == returned.load());
+}
+
+struct TestCase {
+    const char* name;
+    void (*run)();
+};
+
+static const TestCase TESTS[] = {
+    { "journal_round_trip", testJournalRoundTrip },
+    { "journal_torn_tail", testJournalTornTail },
+    { "journal_sticky_failure", testJournalStickyFailure },
+    { "checkpoint", testCheckpoint },
+    { "snapshot_round_trip", testSnapshotRoundTrip },
+    { "snapshot_lazy_catalog", testSnapshotLazyCatalog },
+    { "history_spill_checkpoint", testHistorySpillCheckpoint },
+    { "object_pool", testObjectPool },
+    { "pool_footprint", testPoolFootprint },
+    { "generic_sort", testGenericSort },
+    { "ordered_id_range", testOrderedIdRange },
+    { "catalog_search", testCatalogSearch },
+    { "metrics_thread_churn", testMetricsThreadChurn },
+    { "open_loans", testOpenLoans },
+    { "process_batch", testProcessBatch },
+    { "status_summary", testStatusSummary },
+    { "bulk_import", testBulkImport },
+    { "circulation_analytics", testCirculationAnalytics },
+    { "due_date_index", testDueDateIndex },
+    { "overdue_report", testOverdueReport },
+    { "read_view_consistency", testReadViewConsistency },
+    { "circulation_stress", testCirculationStress },
+};
+
+int main(int argc, char** argv) {
+    string filter = argc > 1 ? argv[1] : "";
+    size_t ran = 0;
+    for (const TestCase& test : TESTS) {
+        if (string(test.name).find(filter) == string::npos) {
+            continue;
+        }
+        size_t failedBefore = checksFailed;
+        auto started = chrono::steady_clock::now();
+        test.run();
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - started).count();
+        printf("%-32s %s (%.0f ms)\n", test.name, checksFailed == failedBefore ? "ok" : "FAILED", ms);
+        ran++;
+    }
+    printf("%zu test(s), %zu check(s), %zu failed\n", ran, checksRun, checksFailed);
+    return checksFailed == 0 && ran != 0 ? 0 : 1;
+}